@@ -0,0 +1,42 @@
+#!/bin/sh
+# benchmark-xvfb.sh -- Run the redshift benchmark on a virtual display
+#
+# Usage: benchmark-xvfb.sh [REDSHIFT] [UPDATES]
+#
+# Starts Xvfb with the RANDR extension on a free display and runs
+# `REDSHIFT -m randr -B UPDATES' against it. Each update is timed
+# until the ramps were read back from the server.
+#
+# If DRM_CARD is set to the number of a vkms card (see
+# `modprobe vkms'), the drm method is benchmarked on it as well.
+
+REDSHIFT=${1:-./redshift}
+UPDATES=${2:-1000}
+
+command -v Xvfb >/dev/null 2>&1 || {
+	echo "Xvfb not found." >&2
+	exit 1
+}
+
+fifo=$(mktemp -u) || exit 1
+mkfifo "$fifo" || exit 1
+
+Xvfb -displayfd 3 -screen 0 1920x1080x24 +extension RANDR \
+	-nolisten tcp 3>"$fifo" &
+xvfb_pid=$!
+trap 'kill $xvfb_pid 2>/dev/null; rm -f "$fifo"' EXIT INT TERM
+
+read -r display <"$fifo"
+if [ -z "$display" ]; then
+	echo "Xvfb failed to start." >&2
+	exit 1
+fi
+
+status=0
+DISPLAY=":$display" "$REDSHIFT" -m randr -B "$UPDATES" || status=1
+
+if [ -n "$DRM_CARD" ]; then
+	"$REDSHIFT" -m "drm:card=$DRM_CARD" -B "$UPDATES" || status=1
+fi
+
+exit $status
@@ -20,9 +20,13 @@
 #include "framework.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "redshift/redshift.h"
+#include "colorramp.h"
+#include "trace.h"
 
 /* Whitepoint values for temperatures at 100K intervals.
    These will be interpolated for the actual temperature.
@@ -287,22 +291,364 @@ interpolate_color(double a, const float *c1, const float *c2, float *c)
 #define F(Y, C)  (pow((Y) * \
            white_point[C], 1.0/setting->gamma[C]) * setting->brightness )
 
+/* Approximate the white point of TEMPERATURE from the blackbody table. */
 void
-colorramp_fill(unsigned short *gamma_r, unsigned short *gamma_g, unsigned short *gamma_b,
-               int size, const color_setting_t *setting)
+colorramp_white_point(int temperature, float *white_point)
 {
-   /* Approximate white point_i32 */
-   float white_point[3];
-   double alpha = (setting->temperature % 100) / 100.0;
-   int temp_index = ((setting->temperature - 1000) / 100)*3;
+   double alpha = (temperature % 100) / 100.0;
+   int temp_index = ((temperature - 1000) / 100)*3;
    interpolate_color(alpha, &blackbody_color[temp_index],
                      &blackbody_color[temp_index+3], white_point);
+}
+
+/* Sparse approximation of pow(Y, EXPONENT) on [0, 1] by a monotone
+   piecewise cubic through a few control points. Large ramps are
+   filled from it instead of calling pow for every entry. */
+typedef struct {
+   int count;
+   double exponent;
+   double x[COLORRAMP_SPARSE_MAX_POINTS];
+   double y[COLORRAMP_SPARSE_MAX_POINTS];
+   double d[COLORRAMP_SPARSE_MAX_POINTS];
+} sparse_curve_t;
+
+/* Append the control point at X. */
+static void
+sparse_curve_append(sparse_curve_t *sc, double x)
+{
+   int n = sc->count++;
+   sc->x[n] = x;
+   sc->y[n] = pow(x, sc->exponent);
+   sc->d[n] = sc->exponent*pow(x, sc->exponent - 1.0);
+}
+
+/* Add control points covering (X0, X1], where X0 is the last point,
+   until the interpolant is monotone and its error is below TOL.
+   The error of a cubic Hermite interpolant with exact slopes is
+   at most h^4/384 * max |f''''|, and the fourth derivative of a
+   power is monotone, so it peaks at one of the ends. */
+static int
+sparse_curve_refine(sparse_curve_t *sc, double x0, double x1, double tol)
+{
+   double p = sc->exponent;
+   double h = x1 - x0;
+   double y0 = sc->y[sc->count-1];
+   double y1 = pow(x1, p);
+   double d0 = sc->d[sc->count-1];
+   double d1 = p*pow(x1, p - 1.0);
+
+   /* Fritsch-Carlson condition for a monotone interpolant */
+   int monotone = 1;
+   double delta = (y1 - y0)/h;
+   if (delta > 0.0)
+   {
+      double a = d0/delta;
+      double b = d1/delta;
+      monotone = a >= 0.0 && b >= 0.0 && a*a + b*b <= 9.0;
+   }
+
+   double m4 = fabs(p*(p - 1.0)*(p - 2.0)*(p - 3.0)) *
+      fmax(pow(x0, p - 4.0), pow(x1, p - 4.0));
+   double error = h*h*h*h/384.0 * m4;
+
+   /* Ramp entries are multiples of 1/65536, so an interval
+      that short has no entries inside. */
+   if ((monotone && error <= tol) || h <= 1.0/(UINT16_MAX + 1))
+   {
+      if (sc->count == COLORRAMP_SPARSE_MAX_POINTS) return -1;
+      sparse_curve_append(sc, x1);
+      return 0;
+   }
+
+   double mid = x0 + h/2;
+   if (sparse_curve_refine(sc, x0, mid, tol) < 0) return -1;
+   return sparse_curve_refine(sc, mid, x1, tol);
+}
+
+/* Choose control points for pow(Y, EXPONENT) with an error of at
+   most MAX_ERROR in 16-bit units. The derivative is unbounded or
+   vanishes at zero, so the points start out doubling in distance
+   from 1/65536. Returns -1 if more points are needed than fit. */
+static int
+sparse_curve_build(sparse_curve_t *sc, double exponent, double max_error)
+{
+   double tol = max_error/(UINT16_MAX + 1);
+
+   sc->count = 0;
+   sc->exponent = exponent;
+
+   /* No entry lies between zero and the first step, so the
+      slope at zero is only needed to make it a straight line. */
+   double first = 1.0/(UINT16_MAX + 1);
+   sc->count = 1;
+   sc->x[0] = 0.0;
+   sc->y[0] = 0.0;
+   sc->d[0] = pow(first, exponent)/first;
+   sparse_curve_append(sc, first);
+
+   for (double x = first; x < 1.0; x *= 2)
+   {
+      if (sparse_curve_refine(sc, x, 2*x, tol) < 0) return -1;
+   }
+
+   return 0;
+}
+
+/* Number of exponents whose control points are kept per thread; one
+   for each channel is enough when only the brightness and white
+   point change between fills. */
+#define SPARSE_CACHE_SIZE  3
+
+static thread_local sparse_curve_t sparse_cache[SPARSE_CACHE_SIZE];
+static thread_local int sparse_cache_next = 0;
+
+/* Return the control points for pow(Y, EXPONENT), building them only
+   the first time the exponent is seen, or NULL if more points are
+   needed than fit. A cached entry with no points is unused, one with
+   a negative count records an exponent that failed. */
+static const sparse_curve_t *
+sparse_curve_get(double exponent)
+{
+   for (int i = 0; i < SPARSE_CACHE_SIZE; i++)
+   {
+      const sparse_curve_t *sc = &sparse_cache[i];
+      if (sc->count != 0 && sc->exponent == exponent)
+      {
+         return sc->count > 0 ? sc : nullptr;
+      }
+   }
+
+   sparse_curve_t *sc = &sparse_cache[sparse_cache_next];
+   sparse_cache_next = (sparse_cache_next + 1) % SPARSE_CACHE_SIZE;
+
+   if (sparse_curve_build(sc, exponent, COLORRAMP_SPARSE_MAX_ERROR) < 0)
+   {
+      sc->count = -1;
+      sc->exponent = exponent;
+      return nullptr;
+   }
+
+   return sc;
+}
+
+/* Evaluate the curve at X. SEGMENT is the interval found for the
+   previous entry; ramps are mostly increasing, so the search
+   usually stops right away. */
+static double
+sparse_curve_eval(const sparse_curve_t *sc, double x, int *segment)
+{
+   int i = *segment;
+   while (i < sc->count - 2 && x > sc->x[i+1]) i++;
+   while (i > 0 && x < sc->x[i]) i--;
+   *segment = i;
+
+   double h = sc->x[i+1] - sc->x[i];
+   double t = (x - sc->x[i])/h;
+   double t2 = t*t;
+   double t3 = t2*t;
+
+   return (2*t3 - 3*t2 + 1)*sc->y[i] + (t3 - 2*t2 + t)*h*sc->d[i] +
+      (-2*t3 + 3*t2)*sc->y[i+1] + (t3 - t2)*h*sc->d[i+1];
+}
+
+static inline float
+bits_to_float(uint32_t u)
+{
+   float f;
+   memcpy(&f, &u, sizeof(f));
+   return f;
+}
+
+static inline uint32_t
+float_to_bits(float f)
+{
+   uint32_t u;
+   memcpy(&u, &f, sizeof(u));
+   return u;
+}
+
+/* pow(V/65536, EXPONENT) for a ramp entry V, within 0.02 of a 16-bit
+   step for exponents from 0.1 to 10. It has no branches and no calls,
+   so a loop over it with a known trip count is vectorized. The power
+   is computed as the square of 2^(EXPONENT*log2(V/65536)/2), which
+   stays in the normal range for every entry but zero. */
+static inline float
+ramp_pow(unsigned short v, float exponent)
+{
+   /* V = m * 2^k with m in [0.75, 1.5); zero is masked below */
+   uint32_t u = float_to_bits((float) (v | (v == 0)));
+   int32_t k = (int32_t) (u - 0x3f400000u) >> 23;
+   float m = bits_to_float(u - ((uint32_t) k << 23));
+
+   /* log2(m) = 2/ln(2) * atanh(s) */
+   float s = (m - 1.0f)/(m + 1.0f);
+   float s2 = s*s;
+   float log2_m = s*(2.8853901f + s2*(0.96179669f + s2*(0.57707802f +
+                                                          s2*0.41219858f)));
+
+   /* 2^h = 2^n * 2^f with f in [-0.5, 0.5] */
+   float h = 0.5f*exponent*((float) k - 16.0f + log2_m);
+   int32_t n = (int32_t) (h - 0.5f);
+   float f = h - (float) n;
+   float p = 1.0f + f*(0.69314718f + f*(0.24022651f + f*(0.055504109f +
+             f*(0.0096181291f + f*(0.0013333558f + f*0.00015403530f)))));
+   float q = bits_to_float(float_to_bits(p) + ((uint32_t) n << 23));
+
+   uint32_t mask = 0u - (uint32_t) (v != 0);
+   return bits_to_float(float_to_bits(q*q) & mask);
+}
+
+/* Set OUT[i] to pow(IN[i]/65536, EXPONENT) * SCALE for the ramp IN of
+   SIZE entries, which may be the same as OUT. If N is not zero it is
+   the size, known at compile time, and every entry is computed
+   directly so the loop can be unrolled and vectorized. Otherwise
+   large ramps are synthesized from control points. */
+template < typename T, int N >
+static void
+colorramp_power(const unsigned short *in, T *out, int size,
+                double exponent, double scale)
+{
+   if (N > 0)
+   {
+      float e = (float) exponent;
+      float s = (float) scale;
+      for (int i = 0; i < N; i++)
+      {
+         out[i] = (T) (ramp_pow(in[i], e) * s);
+      }
+      return;
+   }
+
+   const sparse_curve_t *sc = size >= COLORRAMP_SPARSE_MIN_SIZE ?
+      sparse_curve_get(exponent) : nullptr;
+   if (sc != nullptr)
+   {
+      int segment = 0;
+      for (int i = 0; i < size; i++)
+      {
+         double y = sparse_curve_eval(sc, (double)in[i] / (UINT16_MAX + 1),
+                                      &segment);
+         out[i] = (T) (y * scale);
+      }
+      return;
+   }
 
    for (int i = 0; i < size; i++)
    {
-      gamma_r[i] = (unsigned short) (F((double)gamma_r[i] / (UINT16_MAX + 1), 0) * (UINT16_MAX + 1));
-      gamma_g[i] = (unsigned short) (F((double)gamma_g[i] / (UINT16_MAX + 1), 1) * (UINT16_MAX + 1));
-      gamma_b[i] = (unsigned short) (F((double)gamma_b[i] / (UINT16_MAX + 1), 2) * (UINT16_MAX + 1));
+      out[i] = (T) (pow((double)in[i] / (UINT16_MAX + 1), exponent) * scale);
+   }
+}
+
+template < int N >
+static void
+colorramp_fill_size(unsigned short *gamma_r, unsigned short *gamma_g,
+                    unsigned short *gamma_b, int size,
+                    const color_setting_t *setting)
+{
+   TRACE_BEGIN(span, "colorramp_fill");
+
+   /* Approximate white point_i32 */
+   float white_point[3];
+   colorramp_white_point(setting->temperature, white_point);
+
+   /* F(Y, C) = pow(Y, 1/gamma) * pow(white_point, 1/gamma) * brightness */
+   unsigned short *ramps[3] = { gamma_r, gamma_g, gamma_b };
+   for (int c = 0; c < 3; c++)
+   {
+      double exponent = 1.0/setting->gamma[c];
+      double scale = pow(white_point[c], exponent) *
+         setting->brightness * (UINT16_MAX + 1);
+      colorramp_power<unsigned short, N>(ramps[c], ramps[c], size,
+                                         exponent, scale);
+   }
+
+   TRACE_END(span);
+}
+
+/* Fill ramps of N entries. The loops have a constant trip count, so
+   the compiler can unroll and vectorize them for the size. */
+template < int N >
+void
+colorramp_fill(unsigned short *gamma_r, unsigned short *gamma_g,
+               unsigned short *gamma_b, const color_setting_t *setting)
+{
+   colorramp_fill_size<N>(gamma_r, gamma_g, gamma_b, N, setting);
+}
+
+template void colorramp_fill<256>(unsigned short *, unsigned short *,
+                                  unsigned short *, const color_setting_t *);
+template void colorramp_fill<1024>(unsigned short *, unsigned short *,
+                                   unsigned short *, const color_setting_t *);
+template void colorramp_fill<4096>(unsigned short *, unsigned short *,
+                                   unsigned short *, const color_setting_t *);
+
+void
+colorramp_fill(unsigned short *gamma_r, unsigned short *gamma_g, unsigned short *gamma_b,
+               int size, const color_setting_t *setting)
+{
+   /* Use the kernel for the size if there is one */
+   switch (size)
+   {
+   case 256:
+      colorramp_fill<256>(gamma_r, gamma_g, gamma_b, setting);
+      break;
+   case 1024:
+      colorramp_fill<1024>(gamma_r, gamma_g, gamma_b, setting);
+      break;
+   case 4096:
+      colorramp_fill<4096>(gamma_r, gamma_g, gamma_b, setting);
+      break;
+   default:
+      colorramp_fill_size<0>(gamma_r, gamma_g, gamma_b, size, setting);
+      break;
+   }
+}
+
+/* Fill the ramps of SIZE entries for SETTING, starting from pure
+   ramps. Entries are STRIDE bytes apart and are unsigned integers of
+   BITS bits (stored in bytes up to 8 bits, otherwise in 16-bit
+   integers) or floats if BITS is zero. */
+void
+colorramp_fill_strided(void *gamma_r, void *gamma_g, void *gamma_b,
+                       int size, ptrdiff_t stride, int bits,
+                       const color_setting_t *setting)
+{
+   float white_point[3];
+   colorramp_white_point(setting->temperature, white_point);
+
+   /* Largest value and the factor from a normalized value */
+   double max = bits > 0 ? (double) ((1 << bits) - 1) : 1.0;
+   double range = bits > 0 ? (double) (1 << bits) : 1.0;
+
+   char *ramps[3] = { (char *)gamma_r, (char *)gamma_g, (char *)gamma_b };
+   for (int c = 0; c < 3; c++)
+   {
+      double exponent = 1.0/setting->gamma[c];
+      double scale = pow(white_point[c], exponent) *
+         setting->brightness * range;
+
+      const sparse_curve_t *sc = size >= COLORRAMP_SPARSE_MIN_SIZE ?
+         sparse_curve_get(exponent) : nullptr;
+
+      int segment = 0;
+      char *entry = ramps[c];
+      for (int i = 0; i < size; i++, entry += stride)
+      {
+         double x = (double)i/size;
+         double y = (sc != nullptr ? sparse_curve_eval(sc, x, &segment) :
+                     pow(x, exponent)) * scale;
+
+         if (bits == 0)
+         {
+            *(float *)entry = (float) y;
+         }
+         else
+         {
+            if (y > max) y = max;
+            if (bits <= 8) *(uint8_t *)entry = (uint8_t) y;
+            else *(uint16_t *)entry = (uint16_t) y;
+         }
+      }
    }
 }
 
@@ -312,10 +658,7 @@ colorramp_fill_float(float *gamma_r, float *gamma_g, float *gamma_b,
 {
    /* Approximate white point_i32 */
    float white_point[3];
-   double alpha = (setting->temperature % 100) / 100.0;
-   int temp_index = ((setting->temperature - 1000) / 100)*3;
-   interpolate_color(alpha, &blackbody_color[temp_index],
-                     &blackbody_color[temp_index+3], white_point);
+   colorramp_white_point(setting->temperature, white_point);
 
    for (int i = 0; i < size; i++)
    {
@@ -326,3 +669,251 @@ colorramp_fill_float(float *gamma_r, float *gamma_g, float *gamma_b,
 }
 
 #undef F
+
+/* Convert V to an IEEE half float, rounding to nearest even. */
+static uint16_t
+float_to_half(float v)
+{
+   union { float f; uint32_t u; } bits = { v };
+   uint32_t sign = (bits.u >> 16) & 0x8000;
+   uint32_t magnitude = bits.u & 0x7fffffff;
+
+   if (magnitude >= 0x47800000)
+   {
+      /* Overflow, infinity and NaN */
+      return (uint16_t) (sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00));
+   }
+
+   if (magnitude < 0x38800000)
+   {
+      /* Subnormal; shift the mantissa with the implicit bit in */
+      if (magnitude < 0x33000000) return (uint16_t) sign;
+      uint32_t exponent = magnitude >> 23;
+      uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+      uint32_t shift = 126 - exponent;
+      uint32_t half = mantissa >> shift;
+      uint32_t rest = mantissa & ((1u << shift) - 1);
+      uint32_t midpoint = 1u << (shift - 1);
+      if (rest > midpoint || (rest == midpoint && (half & 1))) half++;
+      return (uint16_t) (sign | half);
+   }
+
+   uint32_t half = (magnitude - 0x38000000) >> 13;
+   uint32_t rest = magnitude & 0x1fff;
+   if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+   return (uint16_t) (sign | half);
+}
+
+/* Number of texels computed at a time */
+#define LUT_CHUNK  64
+
+/* Fill the lookup texture DATA of SIZE texels in FORMAT for SETTING.
+   Texel i is the output for the input i/(SIZE-1). If MATRIX is not
+   NULL only the gamma curve is written to the texture and MATRIX is
+   set to the diagonal matrix of the white point and brightness. */
+void
+colorramp_fill_lut(void *data, int size, int format,
+                   const color_setting_t *setting, float *matrix)
+{
+   color_setting_t curve_setting = *setting;
+   if (matrix != nullptr)
+   {
+      /* The white point of 6500K is neutral */
+      curve_setting.temperature = 6500;
+      curve_setting.brightness = 1.0f;
+
+      float white_point[3];
+      colorramp_white_point(setting->temperature, white_point);
+      for (int i = 0; i < 9; i++) matrix[i] = 0.0f;
+      for (int c = 0; c < 3; c++)
+      {
+         matrix[4*c] = (float) (pow(white_point[c], 1.0/setting->gamma[c]) *
+                                setting->brightness);
+      }
+   }
+
+   double last = size > 1 ? size - 1 : 1;
+   for (int start = 0; start < size; start += LUT_CHUNK)
+   {
+      int count = size - start < LUT_CHUNK ? size - start : LUT_CHUNK;
+
+      float ramps[3][LUT_CHUNK];
+      for (int i = 0; i < count; i++)
+      {
+         float x = (float) ((start + i)/last);
+         ramps[0][i] = x;
+         ramps[1][i] = x;
+         ramps[2][i] = x;
+      }
+
+      colorramp_fill_float(ramps[0], ramps[1], ramps[2], count,
+                           &curve_setting);
+
+      for (int i = 0; i < count; i++)
+      {
+         if (format == COLORRAMP_LUT_RGBA16F)
+         {
+            uint16_t *texel = (uint16_t *)data + 4*(start + i);
+            for (int c = 0; c < 3; c++)
+            {
+               texel[c] = float_to_half(ramps[c][i]);
+            }
+            texel[3] = 0x3c00;
+         }
+         else
+         {
+            uint32_t texel = 3u << 30;
+            for (int c = 0; c < 3; c++)
+            {
+               float v = ramps[c][i];
+               v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+               texel |= (uint32_t) lrintf(v*1023.0f) << (10*c);
+            }
+            ((uint32_t *)data)[start + i] = texel;
+         }
+      }
+   }
+}
+
+/* Resample the ramp IN of IN_SIZE entries to OUT of OUT_SIZE entries
+   by linear interpolation. Entry i of a ramp of SIZE entries is the
+   output for the input i/SIZE. */
+void
+colorramp_resample(const unsigned short *in, int in_size,
+                   unsigned short *out, int out_size)
+{
+   for (int i = 0; i < out_size; i++)
+   {
+      double x = (double)i/out_size * in_size;
+      int j = (int) x;
+      double t = x - j;
+      int k = j + 1 < in_size ? j + 1 : in_size - 1;
+      out[i] = (unsigned short) ((1.0 - t)*in[j] + t*in[k] + 0.5);
+   }
+}
+
+/* Since F(Y, C) = pow(Y, 1/gamma) * pow(white_point, 1/gamma) *
+   brightness, the ramps are computed in two stages: a curve of
+   pow(Y, 1/gamma) per channel that is kept as long as the gamma and
+   the initial ramps stay the same, and a scale per channel applied
+   to it for every update. Changes of temperature and brightness
+   then only cost one multiply per entry. */
+
+void
+colorramp_curve_init(colorramp_curve_t *curve)
+{
+   curve->curve = nullptr;
+   curve->size = 0;
+   curve->valid = 0;
+   for (int c = 0; c < 3; c++) curve->gamma[c] = NAN;
+}
+
+void
+colorramp_curve_free(colorramp_curve_t *curve)
+{
+   free(curve->curve);
+   colorramp_curve_init(curve);
+}
+
+/* Check whether CURVE can be scaled for SETTING on ramps of SIZE. */
+int
+colorramp_curve_matches(const colorramp_curve_t *curve, int size,
+                        const color_setting_t *setting)
+{
+   return curve->valid && curve->size == size &&
+      curve->gamma[0] == setting->gamma[0] &&
+      curve->gamma[1] == setting->gamma[1] &&
+      curve->gamma[2] == setting->gamma[2];
+}
+
+/* Compute CURVE from the initial ramps and the gamma of SETTING. */
+int
+colorramp_curve_update(colorramp_curve_t *curve,
+                       const unsigned short *gamma_r,
+                       const unsigned short *gamma_g,
+                       const unsigned short *gamma_b,
+                       int size, const color_setting_t *setting)
+{
+   if (curve->size != size || curve->curve == nullptr)
+   {
+      float *values = (float *) realloc(curve->curve,
+                                        3*size*sizeof(float));
+      if (values == nullptr)
+      {
+         curve->valid = 0;
+         return -1;
+      }
+      curve->curve = values;
+      curve->size = size;
+   }
+
+   TRACE_BEGIN(span, "colorramp_curve_update");
+
+   const unsigned short *ramps[3] = { gamma_r, gamma_g, gamma_b };
+   for (int c = 0; c < 3; c++)
+   {
+      colorramp_power<float, 0>(ramps[c], &curve->curve[c*size], size,
+                                1.0/setting->gamma[c], 1.0);
+      curve->gamma[c] = setting->gamma[c];
+   }
+
+   TRACE_END(span);
+
+   curve->valid = 1;
+   return 0;
+}
+
+/* Set RAMP to VALUES times SCALE. If N is not zero it is the size,
+   known at compile time. */
+template < int N >
+static void
+colorramp_scale(const float *values, unsigned short *ramp, int size,
+                float scale)
+{
+   if (N > 0) size = N;
+
+   for (int i = 0; i < size; i++)
+   {
+      ramp[i] = (unsigned short) (values[i] * scale);
+   }
+}
+
+/* Fill the ramps for SETTING by scaling CURVE, which must match the
+   gamma of SETTING. */
+void
+colorramp_curve_fill(const colorramp_curve_t *curve,
+                     unsigned short *gamma_r, unsigned short *gamma_g,
+                     unsigned short *gamma_b,
+                     const color_setting_t *setting)
+{
+   TRACE_BEGIN(span, "colorramp_curve_fill");
+
+   float white_point[3];
+   colorramp_white_point(setting->temperature, white_point);
+
+   unsigned short *ramps[3] = { gamma_r, gamma_g, gamma_b };
+   for (int c = 0; c < 3; c++)
+   {
+      const float *values = &curve->curve[c*curve->size];
+      float scale = (float) (pow(white_point[c], 1.0/setting->gamma[c]) *
+                             setting->brightness * (UINT16_MAX + 1));
+
+      switch (curve->size)
+      {
+      case 256:
+         colorramp_scale<256>(values, ramps[c], 256, scale);
+         break;
+      case 1024:
+         colorramp_scale<1024>(values, ramps[c], 1024, scale);
+         break;
+      case 4096:
+         colorramp_scale<4096>(values, ramps[c], 4096, scale);
+         break;
+      default:
+         colorramp_scale<0>(values, ramps[c], curve->size, scale);
+         break;
+      }
+   }
+
+   TRACE_END(span);
+}
@@ -20,13 +20,66 @@
 #ifndef REDSHIFT_COLORRAMP_H
 #define REDSHIFT_COLORRAMP_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "redshift/redshift.h"
 
+/* Ramps of at least this many entries are interpolated from a few
+   points of the transfer function instead of evaluating it for
+   every entry. */
+#define COLORRAMP_SPARSE_MIN_SIZE  1024
+/* Upper bound on the number of interpolation points */
+#define COLORRAMP_SPARSE_MAX_POINTS  256
+/* Maximum interpolation error (16-bit units) */
+#define COLORRAMP_SPARSE_MAX_ERROR  0.25
+
+/* Texel formats of colorramp_fill_lut */
+#define COLORRAMP_LUT_RGBA16F  0
+#define COLORRAMP_LUT_RGB10A2  1
+
+/* Ramps of one display split into the part that only changes with
+   the gamma and the initial ramps, and a scale per channel for the
+   white point and brightness. */
+typedef struct {
+	/* Normalized curve per channel, back to back */
+	float *curve;
+	int size;
+	float gamma[3];
+	int valid;
+} colorramp_curve_t;
+
+void colorramp_white_point(int temperature, float *white_point);
 void colorramp_fill(unsigned short *gamma_r, unsigned short *gamma_g, unsigned short *gamma_b,
 		    int size, const color_setting_t *setting);
+#ifdef __cplusplus
+/* Instantiated for 256, 1024 and 4096 entries */
+template < int N >
+void colorramp_fill(unsigned short *gamma_r, unsigned short *gamma_g,
+		    unsigned short *gamma_b, const color_setting_t *setting);
+#endif
 void colorramp_fill_float(float *gamma_r, float *gamma_g, float *gamma_b,
 			  int size, const color_setting_t *setting);
+void colorramp_fill_strided(void *gamma_r, void *gamma_g, void *gamma_b,
+			    int size, ptrdiff_t stride, int bits,
+			    const color_setting_t *setting);
+void colorramp_fill_lut(void *data, int size, int format,
+			const color_setting_t *setting, float *matrix);
+void colorramp_resample(const unsigned short *in, int in_size,
+			unsigned short *out, int out_size);
+
+void colorramp_curve_init(colorramp_curve_t *curve);
+void colorramp_curve_free(colorramp_curve_t *curve);
+int colorramp_curve_matches(const colorramp_curve_t *curve, int size,
+			    const color_setting_t *setting);
+int colorramp_curve_update(colorramp_curve_t *curve,
+			   const unsigned short *gamma_r,
+			   const unsigned short *gamma_g,
+			   const unsigned short *gamma_b,
+			   int size, const color_setting_t *setting);
+void colorramp_curve_fill(const colorramp_curve_t *curve,
+			  unsigned short *gamma_r, unsigned short *gamma_g,
+			  unsigned short *gamma_b,
+			  const color_setting_t *setting);
 
 #endif /* ! REDSHIFT_COLORRAMP_H */
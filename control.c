@@ -0,0 +1,470 @@
+/* control.c -- Local control socket source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* For accept4 */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef _WIN32
+# include <unistd.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL  0
+#endif
+
+#include "control.h"
+#include "systemtime.h"
+#include "trace.h"
+
+
+int
+control_init(control_state_t *state)
+{
+	state->listen_fd = -1;
+	state->path = NULL;
+
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		state->clients[i].fd = -1;
+		state->clients[i].subscribed = 0;
+		state->clients[i].rx_len = 0;
+	}
+
+	state->temperature = -1;
+	state->brightness = NAN;
+	state->pause_until = 0.0;
+
+	memset(&state->current, 0, sizeof(state->current));
+
+	return 0;
+}
+
+#ifndef _WIN32
+
+static int
+set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void
+client_close(control_client_t *client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client->subscribed = 0;
+	client->rx_len = 0;
+}
+
+/* Send a single message. Clients that cannot keep up are
+   disconnected rather than allowed to block the main loop. */
+static int
+client_send(control_client_t *client, uint8_t type,
+	    const void *payload, uint16_t length)
+{
+	uint8_t buf[sizeof(control_header_t) + sizeof(control_state_msg_t)];
+	control_header_t header = { type, 0, length };
+
+	memcpy(buf, &header, sizeof(header));
+	if (length > 0) memcpy(buf + sizeof(header), payload, length);
+
+	ssize_t n = send(client->fd, buf, sizeof(header) + length,
+			 MSG_NOSIGNAL);
+	if (n != (ssize_t)(sizeof(header) + length)) {
+		client_close(client);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+client_send_error(control_client_t *client, int32_t code)
+{
+	return client_send(client, CONTROL_MSG_ERROR, &code, sizeof(code));
+}
+
+/* Handle one complete request. Returns 1 if an override changed. */
+static int
+handle_message(control_state_t *state, control_client_t *client,
+	       const control_header_t *header, const uint8_t *payload)
+{
+	switch (header->type) {
+	case CONTROL_MSG_GET_STATE:
+		if (header->length != 0) break;
+		client_send(client, CONTROL_MSG_STATE, &state->current,
+			    sizeof(state->current));
+		return 0;
+	case CONTROL_MSG_SET_TEMPERATURE:
+	{
+		int32_t temperature;
+		if (header->length != sizeof(temperature)) break;
+		memcpy(&temperature, payload, sizeof(temperature));
+		if (temperature < 0) {
+			client_send_error(client, CONTROL_ERROR_OUT_OF_RANGE);
+			return 0;
+		}
+		state->temperature = temperature > 0 ? temperature : -1;
+		client_send(client, CONTROL_MSG_ACK, NULL, 0);
+		return 1;
+	}
+	case CONTROL_MSG_SET_BRIGHTNESS:
+	{
+		float brightness;
+		if (header->length != sizeof(brightness)) break;
+		memcpy(&brightness, payload, sizeof(brightness));
+		if (isnan(brightness) || brightness < 0.0 ||
+		    brightness > 1.0) {
+			client_send_error(client, CONTROL_ERROR_OUT_OF_RANGE);
+			return 0;
+		}
+		state->brightness = brightness > 0.0 ? brightness : NAN;
+		client_send(client, CONTROL_MSG_ACK, NULL, 0);
+		return 1;
+	}
+	case CONTROL_MSG_PAUSE_UNTIL:
+	{
+		double until;
+		if (header->length != sizeof(until)) break;
+		memcpy(&until, payload, sizeof(until));
+		if (isnan(until)) {
+			client_send_error(client, CONTROL_ERROR_OUT_OF_RANGE);
+			return 0;
+		}
+		state->pause_until = until;
+		client_send(client, CONTROL_MSG_ACK, NULL, 0);
+		return 1;
+	}
+	case CONTROL_MSG_SUBSCRIBE:
+		if (header->length != 1) break;
+		client->subscribed = payload[0] != 0;
+		client_send(client, CONTROL_MSG_ACK, NULL, 0);
+		return 0;
+	case CONTROL_MSG_DUMP_TRACE:
+		if (header->length != 0) break;
+		if (trace_dump(NULL) < 0) {
+			client_send_error(client, CONTROL_ERROR_FAILED);
+			return 0;
+		}
+		client_send(client, CONTROL_MSG_ACK, NULL, 0);
+		return 0;
+	default:
+		client_send_error(client, CONTROL_ERROR_UNKNOWN_TYPE);
+		return 0;
+	}
+
+	client_send_error(client, CONTROL_ERROR_BAD_LENGTH);
+	return 0;
+}
+
+/* Read pending data from a client and handle all complete
+   requests. Returns 1 if an override changed. */
+static int
+client_read(control_state_t *state, control_client_t *client)
+{
+	int changed = 0;
+
+	ssize_t n = recv(client->fd, client->rx + client->rx_len,
+			 sizeof(client->rx) - client->rx_len, 0);
+	if (n <= 0) {
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+		client_close(client);
+		return 0;
+	}
+	client->rx_len += n;
+
+	while (client->fd >= 0 &&
+	       client->rx_len >= sizeof(control_header_t)) {
+		control_header_t header;
+		memcpy(&header, client->rx, sizeof(header));
+
+		if (header.length > CONTROL_MAX_PAYLOAD) {
+			client_send_error(client, CONTROL_ERROR_BAD_LENGTH);
+			if (client->fd >= 0) client_close(client);
+			break;
+		}
+
+		unsigned int size = sizeof(header) + header.length;
+		if (client->rx_len < size) break;
+
+		changed |= handle_message(state, client, &header,
+					  client->rx + sizeof(header));
+		if (client->fd < 0) break;
+
+		client->rx_len -= size;
+		memmove(client->rx, client->rx + size, client->rx_len);
+	}
+
+	return changed;
+}
+
+static void
+accept_client(control_state_t *state)
+{
+	/* Like the listening socket, clients must not leak into hooks. */
+	int fd = accept4(state->listen_fd, NULL, NULL,
+			 SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0) return;
+
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		control_client_t *client = &state->clients[i];
+		if (client->fd >= 0) continue;
+
+		client->fd = fd;
+		client->subscribed = 0;
+		client->rx_len = 0;
+		return;
+	}
+
+	/* No free slot */
+	close(fd);
+}
+
+int
+control_start(control_state_t *state, const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, _("Control socket path too long: `%s'.\n"),
+			path);
+		return -1;
+	}
+
+	state->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (state->listen_fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* Remove a stale socket left behind by a previous instance,
+	   but never anything else that happens to have the name. */
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, _("Control socket path `%s' exists"
+					  " and is not a socket.\n"), path);
+			close(state->listen_fd);
+			state->listen_fd = -1;
+			return -1;
+		}
+		unlink(path);
+	}
+
+	int r = bind(state->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+	if (r < 0) {
+		perror("bind");
+		close(state->listen_fd);
+		state->listen_fd = -1;
+		return -1;
+	}
+
+	r = listen(state->listen_fd, CONTROL_MAX_CLIENTS);
+	if (r < 0 || set_nonblocking(state->listen_fd) < 0) {
+		perror("listen");
+		close(state->listen_fd);
+		state->listen_fd = -1;
+		unlink(path);
+		return -1;
+	}
+
+	state->path = strdup(path);
+
+	return 0;
+}
+
+void
+control_free(control_state_t *state)
+{
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (state->clients[i].fd >= 0) {
+			client_close(&state->clients[i]);
+		}
+	}
+
+	if (state->listen_fd >= 0) {
+		close(state->listen_fd);
+		state->listen_fd = -1;
+	}
+
+	if (state->path != NULL) {
+		unlink(state->path);
+		free(state->path);
+		state->path = NULL;
+	}
+}
+
+/* Wait up to MSECS milliseconds while serving clients. Returns early
+   with 1 as soon as a client changes an override, 0 on timeout, when
+   WAKE_FD (unless -1) becomes readable or when interrupted by a
+   signal. */
+int
+control_wait(control_state_t *state, unsigned int msecs, int wake_fd)
+{
+	struct pollfd fds[CONTROL_MAX_CLIENTS + 2];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsed = (now.tv_sec - start.tv_sec)*1000 +
+			(now.tv_nsec - start.tv_nsec)/1000000;
+		if (elapsed >= (long)msecs) return 0;
+
+		int nfds = 0;
+		fds[nfds].fd = state->listen_fd;
+		fds[nfds].events = POLLIN;
+		nfds += 1;
+
+		for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			fds[nfds].fd = state->clients[i].fd;
+			fds[nfds].events = POLLIN;
+			nfds += 1;
+		}
+
+		fds[nfds].fd = wake_fd;
+		fds[nfds].events = POLLIN;
+		nfds += 1;
+
+		int r = poll(fds, nfds, msecs - elapsed);
+		if (r < 0) {
+			if (errno == EINTR) return 0;
+			perror("poll");
+			return -1;
+		} else if (r == 0) {
+			return 0;
+		}
+
+		if (fds[nfds-1].revents & POLLIN) return 0;
+
+		int changed = 0;
+		for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			if (fds[i+1].revents & (POLLIN | POLLHUP | POLLERR)) {
+				changed |= client_read(state,
+						       &state->clients[i]);
+			}
+		}
+
+		if (fds[0].revents & POLLIN) accept_client(state);
+
+		if (changed) return 1;
+	}
+}
+
+#else /* _WIN32 */
+
+int
+control_start(control_state_t *state, const char *path)
+{
+	fputs(_("Control socket is not supported on this platform.\n"),
+	      stderr);
+	return -1;
+}
+
+void
+control_free(control_state_t *state)
+{
+}
+
+int
+control_wait(control_state_t *state, unsigned int msecs, int wake_fd)
+{
+	systemtime_msleep(msecs);
+	return 0;
+}
+
+#endif /* _WIN32 */
+
+/* Whether a client has paused adjustments at time NOW. Expired
+   pauses are cleared. */
+int
+control_is_paused(control_state_t *state, double now)
+{
+	if (state->pause_until == 0.0) return 0;
+	if (state->pause_until > 0.0 && now >= state->pause_until) {
+		state->pause_until = 0.0;
+		return 0;
+	}
+	return 1;
+}
+
+void
+control_resume(control_state_t *state)
+{
+	state->pause_until = 0.0;
+}
+
+/* Record the current state and notify subscribed clients
+   if it changed since the last call. */
+void
+control_publish(control_state_t *state, const color_setting_t *setting,
+		period_t period, int disabled, const location_t *loc)
+{
+	control_state_msg_t msg;
+	memset(&msg, 0, sizeof(msg));
+
+	msg.temperature = setting->temperature;
+	msg.gamma[0] = setting->gamma[0];
+	msg.gamma[1] = setting->gamma[1];
+	msg.gamma[2] = setting->gamma[2];
+	msg.brightness = setting->brightness;
+	msg.lat = loc->lat;
+	msg.lon = loc->lon;
+	msg.period = period;
+	msg.disabled = disabled;
+	msg.paused = state->pause_until != 0.0;
+	msg.pause_until = state->pause_until;
+
+	if (memcmp(&msg, &state->current, sizeof(msg)) == 0) return;
+	state->current = msg;
+
+#ifndef _WIN32
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		control_client_t *client = &state->clients[i];
+		if (client->fd < 0 || !client->subscribed) continue;
+		client_send(client, CONTROL_MSG_EVENT, &msg, sizeof(msg));
+	}
+#endif
+}
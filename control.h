@@ -0,0 +1,109 @@
+/* control.h -- Local control socket header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_CONTROL_H
+#define REDSHIFT_CONTROL_H
+
+#include <stdint.h>
+
+#include "redshift.h"
+
+/* Wire protocol.
+   Every message is a control_header_t followed by `length' bytes of
+   payload. The socket is local only, so all fields are in host byte
+   order. Every request is answered with exactly one reply (ACK, ERROR
+   or STATE). Subscribed clients additionally receive EVENT messages,
+   carrying a control_state_msg_t, whenever the state changes. */
+#define CONTROL_MSG_GET_STATE        0x01 /* no payload */
+#define CONTROL_MSG_SET_TEMPERATURE  0x02 /* int32_t, 0 clears override */
+#define CONTROL_MSG_SET_BRIGHTNESS   0x03 /* float, 0 clears override */
+#define CONTROL_MSG_PAUSE_UNTIL      0x04 /* double, epoch seconds,
+					     0 resumes, negative pauses
+					     indefinitely */
+#define CONTROL_MSG_SUBSCRIBE        0x05 /* uint8_t, 0 unsubscribes */
+#define CONTROL_MSG_DUMP_TRACE       0x06 /* no payload */
+
+#define CONTROL_MSG_ACK              0x80 /* no payload */
+#define CONTROL_MSG_ERROR            0x81 /* int32_t error code */
+#define CONTROL_MSG_STATE            0x82 /* control_state_msg_t */
+#define CONTROL_MSG_EVENT            0x83 /* control_state_msg_t */
+
+#define CONTROL_ERROR_UNKNOWN_TYPE   1
+#define CONTROL_ERROR_BAD_LENGTH     2
+#define CONTROL_ERROR_OUT_OF_RANGE   3
+#define CONTROL_ERROR_FAILED         4
+
+#define CONTROL_MAX_PAYLOAD   64
+#define CONTROL_MAX_CLIENTS   16
+
+typedef struct {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t length;
+} control_header_t;
+
+/* Current state as reported to clients. The layout has no
+   implicit padding so it can be read directly by other languages. */
+typedef struct {
+	int32_t temperature;
+	float gamma[3];
+	float brightness;
+	float lat;
+	float lon;
+	uint8_t period;
+	uint8_t disabled;
+	uint8_t paused;
+	uint8_t reserved;
+	double pause_until;
+} control_state_msg_t;
+
+typedef struct {
+	int fd;
+	int subscribed;
+	unsigned int rx_len;
+	uint8_t rx[sizeof(control_header_t) + CONTROL_MAX_PAYLOAD];
+} control_client_t;
+
+typedef struct {
+	int listen_fd;
+	char *path;
+	control_client_t clients[CONTROL_MAX_CLIENTS];
+
+	/* Overrides pushed by clients. Unset overrides are
+	   -1 (temperature), NAN (brightness) and 0 (pause_until). */
+	int temperature;
+	float brightness;
+	double pause_until;
+
+	/* Last published state. */
+	control_state_msg_t current;
+} control_state_t;
+
+
+int control_init(control_state_t *state);
+int control_start(control_state_t *state, const char *path);
+void control_free(control_state_t *state);
+
+int control_wait(control_state_t *state, unsigned int msecs,
+		 int wake_fd);
+int control_is_paused(control_state_t *state, double now);
+void control_resume(control_state_t *state);
+void control_publish(control_state_t *state, const color_setting_t *setting,
+		     period_t period, int disabled, const location_t *loc);
+
+
+#endif /* ! REDSHIFT_CONTROL_H */
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <alloca.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -40,6 +41,8 @@
 
 #include "gamma-drm.h"
 #include "colorramp.h"
+#include "gamma-snapshot.h"
+#include "trace.h"
 
 
 int
@@ -49,12 +52,98 @@ drm_init(drm_state_t *state)
 	state->card_num = 0;
 	state->crtc_num = -1;
 	state->fd = -1;
+	state->ctm = 0;
+	state->snapshot = 1;
 	state->res = NULL;
 	state->crtcs = NULL;
 
 	return 0;
 }
 
+/* Look up the CTM property of the CRTC and remember its current
+   value so it can be restored. */
+static void
+drm_find_ctm(drm_state_t *state, drm_crtc_state_t *crtcs)
+{
+	drmModeObjectProperties *props =
+		drmModeObjectGetProperties(state->fd, crtcs->crtc_id,
+					   DRM_MODE_OBJECT_CRTC);
+	if (props == NULL) return;
+
+	for (uint32_t i = 0; i < props->count_props; i++) {
+		drmModePropertyRes *prop =
+			drmModeGetProperty(state->fd, props->props[i]);
+		if (prop == NULL) continue;
+
+		if (strcmp(prop->name, "CTM") == 0) {
+			crtcs->ctm_prop = prop->prop_id;
+			crtcs->ctm_saved = props->prop_values[i];
+		}
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+}
+
+/* Fill KEY with the snapshot key of the display driven by the CRTC.
+   The connector is identified by type and index rather than by its
+   object ID, which may change when the driver is reloaded. */
+static void
+drm_snapshot_key(drm_state_t *state, drm_crtc_state_t *crtcs, char *key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "card%d-crtc-%d", state->card_num,
+		 crtcs->crtc_num);
+	gamma_snapshot_key(key, "drm", name, NULL, 0);
+
+	for (int i = 0; i < state->res->count_connectors; i++) {
+		/* Do not probe the connector, which can take long. */
+		drmModeConnector *connector =
+			drmModeGetConnectorCurrent(state->fd,
+						   state->res->connectors[i]);
+		if (connector == NULL) continue;
+
+		drmModeEncoder *encoder = NULL;
+		if (connector->encoder_id != 0) {
+			encoder = drmModeGetEncoder(state->fd,
+						    connector->encoder_id);
+		}
+		if (encoder == NULL ||
+		    encoder->crtc_id != (uint32_t)crtcs->crtc_id) {
+			if (encoder != NULL) drmModeFreeEncoder(encoder);
+			drmModeFreeConnector(connector);
+			continue;
+		}
+		drmModeFreeEncoder(encoder);
+
+		drmModePropertyBlobRes *edid = NULL;
+		for (int j = 0; j < connector->count_props; j++) {
+			drmModePropertyRes *prop =
+				drmModeGetProperty(state->fd,
+						   connector->props[j]);
+			if (prop == NULL) continue;
+
+			if (strcmp(prop->name, "EDID") == 0 &&
+			    connector->prop_values[j] != 0) {
+				edid = drmModeGetPropertyBlob(
+					state->fd, connector->prop_values[j]);
+			}
+			drmModeFreeProperty(prop);
+		}
+
+		snprintf(name, sizeof(name), "card%d-%u-%u", state->card_num,
+			 connector->connector_type,
+			 connector->connector_type_id);
+		gamma_snapshot_key(key, "drm", name,
+				   edid != NULL ? edid->data : NULL,
+				   edid != NULL ? edid->length : 0);
+
+		if (edid != NULL) drmModeFreePropertyBlob(edid);
+		drmModeFreeConnector(connector);
+		break;
+	}
+}
+
 int
 drm_start(drm_state_t *state)
 {
@@ -109,6 +198,10 @@ drm_start(drm_state_t *state)
 		state->crtcs->r_gamma = NULL;
 		state->crtcs->g_gamma = NULL;
 		state->crtcs->b_gamma = NULL;
+		state->crtcs->ctm_prop = 0;
+		state->crtcs->ctm_saved = 0;
+		state->crtcs->ctm_blob = 0;
+		colorramp_curve_init(&state->crtcs->curve);
 	} else {
 		int crtc_num;
 		state->crtcs = malloc((crtc_count + 1) * sizeof(drm_crtc_state_t));
@@ -120,9 +213,19 @@ drm_start(drm_state_t *state)
 			state->crtcs[crtc_num].r_gamma = NULL;
 			state->crtcs[crtc_num].g_gamma = NULL;
 			state->crtcs[crtc_num].b_gamma = NULL;
+			state->crtcs[crtc_num].ctm_prop = 0;
+			state->crtcs[crtc_num].ctm_saved = 0;
+			state->crtcs[crtc_num].ctm_blob = 0;
+			colorramp_curve_init(&state->crtcs[crtc_num].curve);
 		}
 	}
 
+	/* Ramps from before redshift first adjusted a display are
+	   taken from the snapshot, so they survive an unclean exit
+	   and need not be read back. */
+	gamma_snapshot_t snapshot;
+	if (state->snapshot) gamma_snapshot_open(&snapshot);
+
 	/* Load CRTC information and gamma ramps. */
 	drm_crtc_state_t *crtcs = state->crtcs;
 	for (; crtcs->crtc_num >= 0; crtcs++) {
@@ -144,7 +247,21 @@ drm_start(drm_state_t *state)
 		crtcs->r_gamma = calloc(3 * crtcs->gamma_size, sizeof(u16));
 		crtcs->g_gamma = crtcs->r_gamma + crtcs->gamma_size;
 		crtcs->b_gamma = crtcs->g_gamma + crtcs->gamma_size;
-		if (crtcs->r_gamma != NULL) {
+		char key[GAMMA_SNAPSHOT_KEY_SIZE];
+		const uint16_t *saved = NULL;
+		if (state->snapshot && crtcs->r_gamma != NULL) {
+			drm_snapshot_key(state, crtcs, key);
+			saved = gamma_snapshot_find(&snapshot, key,
+						    crtcs->gamma_size);
+		}
+		if (saved != NULL) {
+			memcpy(crtcs->r_gamma, saved,
+			       3 * crtcs->gamma_size * sizeof(u16));
+			if (!gamma_snapshot_in_use(&snapshot, key)) {
+				gamma_snapshot_add(&snapshot, key, saved,
+						   crtcs->gamma_size);
+			}
+		} else if (crtcs->r_gamma != NULL) {
 			int r = drmModeCrtcGetGamma(state->fd, crtcs->crtc_id, crtcs->gamma_size,
 						    crtcs->r_gamma, crtcs->g_gamma, crtcs->b_gamma);
 			if (r < 0) {
@@ -153,9 +270,13 @@ drm_start(drm_state_t *state)
 					crtcs->crtc_num, state->card_num);
 				free(crtcs->r_gamma);
 				crtcs->r_gamma = NULL;
+			} else if (state->snapshot) {
+				gamma_snapshot_add(&snapshot, key, crtcs->r_gamma,
+						   crtcs->gamma_size);
 			}
 		} else {
 			fprintf(stderr, "malloc");
+			if (state->snapshot) gamma_snapshot_close(&snapshot);
 			drmModeFreeResources(state->res);
 			state->res = NULL;
 			close(state->fd);
@@ -166,6 +287,26 @@ drm_start(drm_state_t *state)
 			state->crtcs = NULL;
 			return -1;
 		}
+
+		/* The LUT holds the calibration loaded before start. */
+		for (int c = 0; c < 3; c++) crtcs->lut_gamma[c] = 1.0;
+		if (state->ctm && crtcs->r_gamma != NULL) {
+			drm_find_ctm(state, crtcs);
+			if (crtcs->ctm_prop == 0) {
+				fprintf(stderr, _("CRTC %i on graphics card %i has"
+						  " no color transformation matrix,\n"
+						  "using gamma ramps instead.\n"),
+					crtcs->crtc_num, state->card_num);
+			}
+		}
+	}
+
+	if (state->snapshot) {
+		if (gamma_snapshot_commit(&snapshot) < 0) {
+			fputs(_("Unable to save gamma ramp snapshot.\n"),
+			      stderr);
+		}
+		gamma_snapshot_close(&snapshot);
 	}
 
 	return 0;
@@ -179,6 +320,15 @@ drm_restore(drm_state_t *state)
 		if (crtcs->r_gamma != NULL) {
 			drmModeCrtcSetGamma(state->fd, crtcs->crtc_id, crtcs->gamma_size,
 					    crtcs->r_gamma, crtcs->g_gamma, crtcs->b_gamma);
+			for (int c = 0; c < 3; c++) crtcs->lut_gamma[c] = 1.0;
+		}
+		if (crtcs->ctm_blob != 0) {
+			drmModeObjectSetProperty(state->fd, crtcs->crtc_id,
+						 DRM_MODE_OBJECT_CRTC,
+						 crtcs->ctm_prop,
+						 crtcs->ctm_saved);
+			drmModeDestroyPropertyBlob(state->fd, crtcs->ctm_blob);
+			crtcs->ctm_blob = 0;
 		}
 		crtcs++;
 	}
@@ -187,10 +337,21 @@ drm_restore(drm_state_t *state)
 void
 drm_free(drm_state_t *state)
 {
+	/* Drop the snapshot entries of this instance, whether or not the
+	   ramps were restored, so the next run reads them back. */
+	if (state->snapshot && state->crtcs != NULL) {
+		gamma_snapshot_release("drm");
+	}
+
 	if (state->crtcs != NULL) {
 		drm_crtc_state_t *crtcs = state->crtcs;
 		while (crtcs->crtc_num >= 0) {
+			if (crtcs->ctm_blob != 0) {
+				drmModeDestroyPropertyBlob(state->fd,
+							   crtcs->ctm_blob);
+			}
 			free(crtcs->r_gamma);
+			colorramp_curve_free(&crtcs->curve);
 			crtcs->crtc_num = -1;
 			crtcs++;
 		}
@@ -216,7 +377,11 @@ drm_print_help(FILE *f)
 	/* TRANSLATORS: DRM help output
 	   left column must not be translated */
 	fputs(_("  card=N\tGraphics card to apply adjustments to\n"
-		"  crtc=N\tCRTC to apply adjustments to\n"), f);
+		"  crtc=N\tCRTC to apply adjustments to\n"
+		"  ctm=1\tAdjust with the color transformation matrix\n"
+		"       \tand leave the gamma ramps to calibration\n"
+		"  snapshot=0\tDo not keep the ramps from before the first\n"
+		"            \tadjustment of each display across restarts\n"), f);
 	fputs("\n", f);
 }
 
@@ -231,6 +396,10 @@ drm_set_option(drm_state_t *state, const char *key, const char *value)
 			fprintf(stderr, _("CRTC must be a non-negative integer\n"));
 			return -1;
 		}
+	} else if (strcasecmp(key, "ctm") == 0) {
+		state->ctm = atoi(value) != 0;
+	} else if (strcasecmp(key, "snapshot") == 0) {
+		state->snapshot = atoi(value) != 0;
 	} else {
 		fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
 		return -1;
@@ -239,51 +408,336 @@ drm_set_option(drm_state_t *state, const char *key, const char *value)
 	return 0;
 }
 
-int
-drm_set_temperature(drm_state_t *state, const color_setting_t *setting)
+/* Convert to the S31.32 sign-magnitude format of the DRM CTM. */
+static uint64_t
+drm_ctm_value(double value)
 {
-	drm_crtc_state_t *crtcs = state->crtcs;
-	int last_gamma_size = 0;
-	u16 *r_gamma = NULL;
-	u16 *g_gamma = NULL;
-	u16 *b_gamma = NULL;
+	uint64_t mag = (uint64_t)(fabs(value) * ((uint64_t)1 << 32));
+	return value < 0.0 ? mag | ((uint64_t)1 << 63) : mag;
+}
+
+/* Apply the white point and brightness as a diagonal color
+   transformation matrix. The gamma LUT holds the calibration loaded
+   before start; a gamma correction is applied on top of it, in the
+   same way the ramps of the other methods are derived from their
+   initial ramps. */
+static int
+drm_set_ctm_for_crtc(drm_state_t *state, drm_crtc_state_t *crtcs,
+		     const color_setting_t *setting)
+{
+	int gamma_changed = 0;
+	for (int c = 0; c < 3; c++) {
+		if (setting->gamma[c] != crtcs->lut_gamma[c]) gamma_changed = 1;
+	}
 
+	if (gamma_changed) {
+		int identity = 1;
+		for (int c = 0; c < 3; c++) {
+			if (setting->gamma[c] != 1.0) identity = 0;
+		}
+
+		int ramp_size = crtcs->gamma_size;
+		int r;
+		if (identity) {
+			r = drmModeCrtcSetGamma(state->fd, crtcs->crtc_id,
+						ramp_size, crtcs->r_gamma,
+						crtcs->g_gamma, crtcs->b_gamma);
+		} else {
+			u16 *gamma_r = malloc(3 * ramp_size * sizeof(u16));
+			if (gamma_r == NULL) {
+				fprintf(stderr, "malloc");
+				return -1;
+			}
+			u16 *gamma_g = gamma_r + ramp_size;
+			u16 *gamma_b = gamma_g + ramp_size;
+			memcpy(gamma_r, crtcs->r_gamma,
+			       3 * ramp_size * sizeof(u16));
+
+			/* Only the gamma; the white point of 6500K is
+			   neutral and the brightness is in the CTM. */
+			color_setting_t curve_setting = *setting;
+			curve_setting.temperature = 6500;
+			curve_setting.brightness = 1.0;
+			colorramp_fill(gamma_r, gamma_g, gamma_b, ramp_size,
+				       &curve_setting);
+
+			r = drmModeCrtcSetGamma(state->fd, crtcs->crtc_id,
+						ramp_size, gamma_r, gamma_g,
+						gamma_b);
+			free(gamma_r);
+		}
+
+		if (r < 0) {
+			fprintf(stderr, _("DRM could not set gamma ramps on"
+					  " CRTC %i.\n"), crtcs->crtc_num);
+			return -1;
+		}
+
+		for (int c = 0; c < 3; c++) {
+			crtcs->lut_gamma[c] = setting->gamma[c];
+		}
+	}
+
+	/* The LUT raises its input to 1/gamma, so the brightness is
+	   raised to gamma to give the same result as the ramps. */
+	float white_point[3];
+	colorramp_white_point(setting->temperature, white_point);
+
+	struct drm_color_ctm ctm;
+	memset(&ctm, 0, sizeof(ctm));
+	for (int c = 0; c < 3; c++) {
+		ctm.matrix[4*c] = drm_ctm_value(white_point[c] *
+			pow(setting->brightness, setting->gamma[c]));
+	}
+
+	uint32_t blob;
+	int r = drmModeCreatePropertyBlob(state->fd, &ctm, sizeof(ctm), &blob);
+	if (r < 0) {
+		fprintf(stderr, _("DRM could not create CTM on CRTC %i.\n"),
+			crtcs->crtc_num);
+		return -1;
+	}
+
+	r = drmModeObjectSetProperty(state->fd, crtcs->crtc_id,
+				     DRM_MODE_OBJECT_CRTC, crtcs->ctm_prop,
+				     blob);
+	if (r < 0) {
+		fprintf(stderr, _("DRM could not set CTM on CRTC %i.\n"),
+			crtcs->crtc_num);
+		drmModeDestroyPropertyBlob(state->fd, blob);
+		return -1;
+	}
+
+	/* The property holds its own reference to the blob. */
+	if (crtcs->ctm_blob != 0) {
+		drmModeDestroyPropertyBlob(state->fd, crtcs->ctm_blob);
+	}
+	crtcs->ctm_blob = blob;
+
+	return 0;
+}
+
+/* Compute the ramps for SETTING into FRAME. A frame holds the setting
+   followed by the ramps of every CRTC that is adjusted with gamma
+   ramps, back to back. Returns the size of a frame; if FRAME is NULL
+   only the size is computed. */
+long
+drm_prepare(drm_state_t *state, const color_setting_t *setting, void *frame)
+{
+	size_t size = sizeof(color_setting_t);
+	drm_crtc_state_t *crtcs = state->crtcs;
 	for (; crtcs->crtc_num >= 0; crtcs++) {
-		if (crtcs->gamma_size <= 1)
+		if (crtcs->gamma_size <= 1 || crtcs->ctm_prop != 0)
 			continue;
-		if (crtcs->gamma_size != last_gamma_size) {
-			if (last_gamma_size == 0) {
-				r_gamma = malloc(3 * crtcs->gamma_size * sizeof(u16));
-				g_gamma = r_gamma + crtcs->gamma_size;
-				b_gamma = g_gamma + crtcs->gamma_size;
-			} else if (crtcs->gamma_size > last_gamma_size) {
-				r_gamma = realloc(r_gamma, 3 * crtcs->gamma_size * sizeof(u16));
-				g_gamma = r_gamma + crtcs->gamma_size;
-				b_gamma = g_gamma + crtcs->gamma_size;
+		size += 3 * crtcs->gamma_size * sizeof(u16);
+	}
+
+	if (frame == NULL) return size;
+
+	memcpy(frame, setting, sizeof(color_setting_t));
+	u16 *ramps = (u16 *)((char *)frame + sizeof(color_setting_t));
+
+	for (crtcs = state->crtcs; crtcs->crtc_num >= 0; crtcs++) {
+		if (crtcs->gamma_size <= 1 || crtcs->ctm_prop != 0)
+			continue;
+
+		int ramp_size = crtcs->gamma_size;
+		u16 *r_gamma = ramps;
+		u16 *g_gamma = r_gamma + ramp_size;
+		u16 *b_gamma = g_gamma + ramp_size;
+
+		/* The curve only changes with the gamma */
+		if (!colorramp_curve_matches(&crtcs->curve, ramp_size,
+					     setting)) {
+			/* Initialize gamma ramps to pure state */
+			for (int i = 0; i < ramp_size; i++) {
+				u16 value = (double)i/ramp_size * (UINT16_MAX+1);
+				r_gamma[i] = value;
+				g_gamma[i] = value;
+				b_gamma[i] = value;
 			}
-			if (r_gamma == NULL) {
-				fprintf(stderr, last_gamma_size == 0 ? "malloc" : "realloc");
+
+			int r = colorramp_curve_update(&crtcs->curve, r_gamma,
+						       g_gamma, b_gamma,
+						       ramp_size, setting);
+			if (r < 0) {
+				fprintf(stderr, "malloc");
 				return -1;
 			}
-			last_gamma_size = crtcs->gamma_size;
 		}
 
-		/* Initialize gamma ramps to pure state */
+		colorramp_curve_fill(&crtcs->curve, r_gamma, g_gamma, b_gamma,
+				     setting);
+		ramps += 3 * ramp_size;
+	}
+
+	return size;
+}
+
+/* Apply a frame computed by drm_prepare. */
+int
+drm_set_prepared(drm_state_t *state, const void *frame)
+{
+	const color_setting_t *setting = (const color_setting_t *)frame;
+	u16 *ramps = (u16 *)((const char *)frame + sizeof(color_setting_t));
+
+	drm_crtc_state_t *crtcs = state->crtcs;
+	for (; crtcs->crtc_num >= 0; crtcs++) {
+		if (crtcs->gamma_size <= 1)
+			continue;
+		if (crtcs->ctm_prop != 0) {
+			int r = drm_set_ctm_for_crtc(state, crtcs, setting);
+			if (r < 0) return -1;
+			continue;
+		}
+
 		int ramp_size = crtcs->gamma_size;
-		for (int i = 0; i < ramp_size; i++) {
-			u16 value = (double)i/ramp_size * (UINT16_MAX+1);
-			r_gamma[i] = value;
-			g_gamma[i] = value;
-			b_gamma[i] = value;
+		TRACE_BEGIN_CAT(span, "drm", "drmModeCrtcSetGamma");
+		drmModeCrtcSetGamma(state->fd, crtcs->crtc_id, ramp_size,
+				    ramps, ramps + ramp_size,
+				    ramps + 2*ramp_size);
+		TRACE_END(span);
+		ramps += 3 * ramp_size;
+	}
+
+	return 0;
+}
+
+/* Read the gamma ramps of the adjusted CRTCs back, which only
+   returns once the driver holds the ramps set before. */
+int
+drm_readback(drm_state_t *state)
+{
+	drm_crtc_state_t *crtcs = state->crtcs;
+	for (; crtcs->crtc_num >= 0; crtcs++) {
+		if (crtcs->gamma_size <= 1 || crtcs->ctm_prop != 0)
+			continue;
+
+		int ramp_size = crtcs->gamma_size;
+		u16 *ramps = malloc(3 * ramp_size * sizeof(u16));
+		if (ramps == NULL) {
+			fprintf(stderr, "malloc");
+			return -1;
 		}
 
-		colorramp_fill(r_gamma, g_gamma, b_gamma, crtcs->gamma_size,
-			       setting);
-		drmModeCrtcSetGamma(state->fd, crtcs->crtc_id, crtcs->gamma_size,
-				    r_gamma, g_gamma, b_gamma);
+		int r = drmModeCrtcGetGamma(state->fd, crtcs->crtc_id,
+					    ramp_size, ramps, ramps + ramp_size,
+					    ramps + 2*ramp_size);
+		free(ramps);
+		if (r < 0) {
+			fprintf(stderr, _("DRM could not read gamma ramps"
+					  " on CRTC %i.\n"), crtcs->crtc_num);
+			return -1;
+		}
 	}
 
-	free(r_gamma);
+	return 0;
+}
+
+int
+drm_set_temperature(drm_state_t *state, const color_setting_t *setting)
+{
+	long size = drm_prepare(state, setting, NULL);
+	void *frame = malloc(size);
+	if (frame == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
+	int r = -1;
+	if (drm_prepare(state, setting, frame) >= 0) {
+		r = drm_set_prepared(state, frame);
+	}
+	free(frame);
+
+	return r;
+}
+
+/* Check the CRTCs after the system resumed. The driver may have
+   reset the gamma ramps, so the LUT is uploaded again with the next
+   update, and a CRTC whose ramp size changed has its saved ramps
+   read again. */
+int
+drm_revalidate(drm_state_t *state)
+{
+	drm_crtc_state_t *crtcs = state->crtcs;
+	for (; crtcs->crtc_num >= 0; crtcs++) {
+		if (crtcs->r_gamma == NULL) continue;
+
+		for (int c = 0; c < 3; c++) crtcs->lut_gamma[c] = NAN;
+
+		drmModeCrtc *crtc_info = drmModeGetCrtc(state->fd,
+							crtcs->crtc_id);
+		if (crtc_info == NULL) {
+			fprintf(stderr, _("CRTC %i lost, skipping\n"),
+				crtcs->crtc_num);
+			continue;
+		}
+		int gamma_size = crtc_info->gamma_size;
+		drmModeFreeCrtc(crtc_info);
+
+		if (gamma_size == crtcs->gamma_size) continue;
+
+		fprintf(stderr, _("Gamma ramp size of CRTC %i changed"
+				  " from %i to %i.\n"), crtcs->crtc_num,
+			crtcs->gamma_size, gamma_size);
+
+		/* The CRTC now holds adjusted ramps, or whatever the
+		   driver reset it to, so the saved ramps are resampled
+		   to the new size rather than read back. */
+		u16 *r_gamma = NULL;
+		if (gamma_size > 1) {
+			r_gamma = calloc(3 * gamma_size, sizeof(u16));
+			if (r_gamma == NULL) {
+				fprintf(stderr, "malloc");
+				return -1;
+			}
+
+			u16 *saved[3] = { crtcs->r_gamma, crtcs->g_gamma,
+					  crtcs->b_gamma };
+			for (int c = 0; c < 3; c++) {
+				colorramp_resample(saved[c], crtcs->gamma_size,
+						   r_gamma + c*gamma_size,
+						   gamma_size);
+			}
+		}
+
+		free(crtcs->r_gamma);
+		crtcs->gamma_size = gamma_size;
+		crtcs->r_gamma = r_gamma;
+		if (r_gamma == NULL) continue;
+
+		crtcs->g_gamma = crtcs->r_gamma + gamma_size;
+		crtcs->b_gamma = crtcs->g_gamma + gamma_size;
+	}
+
+	return 0;
+}
+
+/* Wait for the next vertical blank on the first adjusted CRTC. */
+int
+drm_wait_vblank(drm_state_t *state, unsigned int *sequence)
+{
+	drm_crtc_state_t *crtcs = state->crtcs;
+	while (crtcs->crtc_num >= 0 && crtcs->gamma_size <= 1) crtcs++;
+	if (crtcs->crtc_num < 0) return -1;
+
+	drmVBlank vbl;
+	vbl.request.type = DRM_VBLANK_RELATIVE;
+	if (crtcs->crtc_num > 1) {
+		vbl.request.type |= (crtcs->crtc_num <<
+				     DRM_VBLANK_HIGH_CRTC_SHIFT) &
+			DRM_VBLANK_HIGH_CRTC_MASK;
+	} else if (crtcs->crtc_num == 1) {
+		vbl.request.type |= DRM_VBLANK_SECONDARY;
+	}
+	vbl.request.sequence = 1;
+	vbl.request.signal = 0;
+
+	int r = drmWaitVBlank(state->fd, &vbl);
+	if (r < 0) return -1;
+
+	*sequence = vbl.reply.sequence;
 
 	return 0;
 }
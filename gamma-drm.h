@@ -26,6 +26,7 @@
 #include <xf86drmMode.h>
 
 #include "redshift.h"
+#include "colorramp.h"
 
 
 typedef struct {
@@ -35,12 +36,24 @@ typedef struct {
 	unsigned short* r_gamma;
 	unsigned short* g_gamma;
 	unsigned short* b_gamma;
+
+	/* Color transformation matrix, or zero if unsupported */
+	uint32_t ctm_prop;
+	uint64_t ctm_saved;
+	uint32_t ctm_blob;
+	/* Gamma of the curve currently in the gamma LUT */
+	float lut_gamma[3];
+	/* Ramps scaled for each update */
+	colorramp_curve_t curve;
 } drm_crtc_state_t;
 
 typedef struct {
 	int card_num;
 	int crtc_num;
 	int fd;
+	int ctm;
+	/* Take saved ramps from the snapshot when it has them */
+	int snapshot;
 	drmModeRes* res;
 	drm_crtc_state_t* crtcs;
 } drm_state_t;
@@ -56,6 +69,12 @@ int drm_set_option(drm_state_t *state, const ::string &key, const ::string &valu
 void drm_restore(drm_state_t *state);
 int drm_set_temperature(drm_state_t *state,
 			const color_setting_t *setting);
+int drm_wait_vblank(drm_state_t *state, unsigned int *sequence);
+int drm_revalidate(drm_state_t *state);
+long drm_prepare(drm_state_t *state, const color_setting_t *setting,
+		 void *frame);
+int drm_set_prepared(drm_state_t *state, const void *frame);
+int drm_readback(drm_state_t *state);
 
 
 #endif /* ! REDSHIFT_GAMMA_DRM_H */
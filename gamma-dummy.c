@@ -19,6 +19,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #ifdef ENABLE_NLS
 # include <libintl.h>
@@ -27,30 +29,56 @@
 # define _(s) s
 #endif
 
-#include "redshift.h"
+#include "gamma-dummy.h"
+#include "colorramp.h"
+#include "systemtime.h"
 
 
 int
-gamma_dummy_init(void *state)
+gamma_dummy_init(gamma_dummy_state_t *state)
 {
+	state->crtc_count = 0;
+	state->ramp_size = 256;
+	state->latency = 0;
+
+	state->ramps = NULL;
+	state->frame = NULL;
+	colorramp_curve_init(&state->curve);
+
 	return 0;
 }
 
 int
-gamma_dummy_start(void *state)
+gamma_dummy_start(gamma_dummy_state_t *state)
 {
 	fputs(_("WARNING: Using dummy gamma method! Display will not be affected by this gamma method.\n"), stderr);
+
+	if (state->crtc_count == 0) return 0;
+
+	size_t size = 3*state->crtc_count*state->ramp_size*sizeof(uint16_t);
+	state->ramps = (uint16_t *)calloc(1, size);
+	state->frame = malloc(sizeof(color_setting_t) + size);
+	if (state->ramps == NULL || state->frame == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
 	return 0;
 }
 
 void
-gamma_dummy_restore(void *state)
+gamma_dummy_restore(gamma_dummy_state_t *state)
 {
 }
 
 void
-gamma_dummy_free(void *state)
+gamma_dummy_free(gamma_dummy_state_t *state)
 {
+	free(state->ramps);
+	state->ramps = NULL;
+	free(state->frame);
+	state->frame = NULL;
+	colorramp_curve_free(&state->curve);
 }
 
 void
@@ -58,18 +86,126 @@ gamma_dummy_print_help(FILE *f)
 {
 	fputs(_("Does not affect the display but prints the color temperature to the terminal.\n"), f);
 	fputs("\n", f);
+
+	/* TRANSLATORS: dummy help output
+	   left column must not be translated */
+	fputs(_("  crtcs=N\tNumber of simulated CRTCs to compute ramps for\n"
+		"  ramp-size=N\tRamp size of the simulated CRTCs\n"
+		"  latency=N\tMilliseconds each update takes to apply\n"), f);
+	fputs("\n", f);
 }
 
 int
-gamma_dummy_set_option(void *state, const char *key, const char *value)
+gamma_dummy_set_option(gamma_dummy_state_t *state, const char *key,
+		       const char *value)
 {
-	fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
-	return -1;
+	if (strcasecmp(key, "crtcs") == 0) {
+		state->crtc_count = atoi(value);
+		if (state->crtc_count < 0) {
+			fputs(_("Number of CRTCs must not be negative.\n"),
+			      stderr);
+			return -1;
+		}
+	} else if (strcasecmp(key, "ramp-size") == 0) {
+		state->ramp_size = atoi(value);
+		if (state->ramp_size < 2 || state->ramp_size > 65536) {
+			fputs(_("Ramp size must be between 2 and"
+				" 65536.\n"), stderr);
+			return -1;
+		}
+	} else if (strcasecmp(key, "latency") == 0) {
+		int latency = atoi(value);
+		if (latency < 0) {
+			fputs(_("Latency must not be negative.\n"), stderr);
+			return -1;
+		}
+		state->latency = latency;
+	} else {
+		fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
+		return -1;
+	}
+
+	return 0;
 }
 
+/* Compute the ramps of the simulated CRTCs for SETTING into FRAME,
+   laid out as the setting followed by the ramps of every CRTC. */
+long
+gamma_dummy_prepare(gamma_dummy_state_t *state,
+		    const color_setting_t *setting, void *frame)
+{
+	int ramp_size = state->ramp_size;
+	size_t size = sizeof(color_setting_t) +
+		3*state->crtc_count*ramp_size*sizeof(uint16_t);
+	if (frame == NULL) return size;
+
+	memcpy(frame, setting, sizeof(color_setting_t));
+	uint16_t *ramps = (uint16_t *)((char *)frame +
+				       sizeof(color_setting_t));
+
+	/* All CRTCs share the curve, which only changes with the gamma */
+	if (state->crtc_count > 0 &&
+	    !colorramp_curve_matches(&state->curve, ramp_size, setting)) {
+		/* Initialize gamma ramps to pure state */
+		for (int i = 0; i < 3*ramp_size; i++) {
+			ramps[i] = (double)(i % ramp_size)/ramp_size *
+				(UINT16_MAX+1);
+		}
+
+		int r = colorramp_curve_update(&state->curve, &ramps[0],
+					       &ramps[ramp_size],
+					       &ramps[2*ramp_size],
+					       ramp_size, setting);
+		if (r < 0) {
+			fprintf(stderr, "malloc");
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < state->crtc_count; i++) {
+		uint16_t *r_gamma = &ramps[3*i*ramp_size];
+		uint16_t *g_gamma = r_gamma + ramp_size;
+		uint16_t *b_gamma = g_gamma + ramp_size;
+
+		colorramp_curve_fill(&state->curve, r_gamma, g_gamma,
+				     b_gamma, setting);
+	}
+
+	return size;
+}
+
+/* Apply a frame computed by gamma_dummy_prepare, taking as long as
+   the configured latency. */
 int
-gamma_dummy_set_temperature(void *state, const color_setting_t *setting)
+gamma_dummy_set_prepared(gamma_dummy_state_t *state, const void *frame)
 {
+	const color_setting_t *setting = (const color_setting_t *)frame;
 	printf(_("Temperature: %i\n"), setting->temperature);
+
+	if (state->crtc_count > 0) {
+		memcpy(state->ramps, (const char *)frame +
+		       sizeof(color_setting_t),
+		       3*state->crtc_count*state->ramp_size*
+		       sizeof(uint16_t));
+	}
+
+	if (state->latency > 0) systemtime_msleep(state->latency);
+
 	return 0;
 }
+
+int
+gamma_dummy_set_temperature(gamma_dummy_state_t *state,
+			    const color_setting_t *setting)
+{
+	if (state->frame == NULL) {
+		printf(_("Temperature: %i\n"), setting->temperature);
+		if (state->latency > 0) systemtime_msleep(state->latency);
+		return 0;
+	}
+
+	long r = gamma_dummy_prepare(state, setting, state->frame);
+	if (r < 0) return -1;
+
+	return gamma_dummy_set_prepared(state, state->frame);
+}
@@ -21,18 +21,41 @@
 #define REDSHIFT_GAMMA_DUMMY_H
 
 #include "redshift.h"
+#include "colorramp.h"
 
 
-int gamma_dummy_init(void *state);
-int gamma_dummy_start(void *state);
-void gamma_dummy_free(void *state);
+/* Simulated displays, so the adjustment loop and the computation of
+   ramps can be exercised and timed without hardware. No backend code
+   runs; the fake options of the RandR method (gamma-randr-fake.h)
+   cover its requests, round trips and hotplug handling instead. */
+typedef struct {
+	int crtc_count;
+	int ramp_size;
+	/* Milliseconds each update takes to be applied */
+	unsigned int latency;
+
+	/* Ramps currently in effect, and the frame for the next update */
+	uint16_t *ramps;
+	void *frame;
+	colorramp_curve_t curve;
+} gamma_dummy_state_t;
+
+
+int gamma_dummy_init(gamma_dummy_state_t *state);
+int gamma_dummy_start(gamma_dummy_state_t *state);
+void gamma_dummy_free(gamma_dummy_state_t *state);
 
 void gamma_dummy_print_help(FILE *f);
-int gamma_dummy_set_option(void *state, const ::string &key, const ::string &value);
+int gamma_dummy_set_option(gamma_dummy_state_t *state, const char *key,
+			   const char *value);
 
-void gamma_dummy_restore(void *state);
-int gamma_dummy_set_temperature(void *state,
+void gamma_dummy_restore(gamma_dummy_state_t *state);
+int gamma_dummy_set_temperature(gamma_dummy_state_t *state,
 				const color_setting_t *setting);
+long gamma_dummy_prepare(gamma_dummy_state_t *state,
+			 const color_setting_t *setting, void *frame);
+int gamma_dummy_set_prepared(gamma_dummy_state_t *state,
+			     const void *frame);
 
 
 #endif /* ! REDSHIFT_GAMMA_DUMMY_H */
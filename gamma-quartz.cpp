@@ -37,6 +37,7 @@
 
 #include "gamma-quartz.h"
 #include "colorramp.h"
+#include "trace.h"
 
 
 int
@@ -213,9 +214,11 @@ redshift_set_temperature_for_display(redshift_state_t *state, int display,
 			     setting);
 
    
+	TRACE_BEGIN_CAT(span, "quartz", "CGSetDisplayTransferByTable");
 	CGError error =
 		CGSetDisplayTransferByTable(state->displays[display].display, ramp_size,
 					    gamma_r, gamma_g, gamma_b);
+	TRACE_END(span);
 	if (error != kCGErrorSuccess) {
 		free(gamma_ramps);
 		return;
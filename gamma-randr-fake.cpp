@@ -0,0 +1,649 @@
+/* gamma-randr-fake.cpp -- In-process X server for the RANDR method source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#include "gamma-randr-fake.h"
+
+/* Opcodes and resources the fake server announces */
+#define FAKE_RANDR_OPCODE       140
+#define FAKE_RANDR_FIRST_EVENT  89
+#define FAKE_RANDR_FIRST_ERROR  147
+
+#define FAKE_ROOT         0x100
+#define FAKE_COLORMAP     0x101
+#define FAKE_VISUAL       0x102
+#define FAKE_CRTC_BASE    0x200
+#define FAKE_OUTPUT_BASE  0x300
+#define FAKE_MODE         0x400
+
+#define FAKE_CRTC_WIDTH   1920
+#define FAKE_CRTC_HEIGHT  1080
+
+/* Core protocol */
+#define X_INTERN_ATOM      16
+#define X_GET_INPUT_FOCUS  43
+#define X_QUERY_EXTENSION  98
+
+#define X_BAD_REQUEST  1
+#define X_BAD_MATCH    8
+#define X_BAD_LENGTH   16
+
+/* RANDR requests */
+#define RR_QUERY_VERSION                  0
+#define RR_GET_SCREEN_RESOURCES           8
+#define RR_GET_OUTPUT_INFO                9
+#define RR_CHANGE_OUTPUT_PROPERTY         13
+#define RR_GET_OUTPUT_PROPERTY            15
+#define RR_GET_CRTC_INFO                  20
+#define RR_GET_CRTC_GAMMA_SIZE            22
+#define RR_GET_CRTC_GAMMA                 23
+#define RR_SET_CRTC_GAMMA                 24
+#define RR_GET_SCREEN_RESOURCES_CURRENT   25
+
+/* RANDR errors, offset by the first error */
+#define RR_BAD_OUTPUT  0
+#define RR_BAD_CRTC    1
+
+#define PAD4(n)  (((n) + 3) & ~(size_t)3)
+
+
+struct _RANDR_FAKE {
+	randr_fake_config_t config;
+	int fd;
+	pthread_t thread;
+
+	/* Current ramp size and ramps of all CRTCs, each red, green
+	   and blue back to back */
+	int ramp_size;
+	uint16_t *ramps;
+	unsigned int sets;
+
+	/* Sequence number of the last request */
+	uint16_t sequence;
+
+	/* Received data not handled yet, and replies not sent yet */
+	uint8_t *in;
+	size_t in_len;
+	size_t in_size;
+	uint8_t *out;
+	size_t out_len;
+	size_t out_size;
+};
+
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t
+get16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Fill the ramps of all CRTCs with the identity for SIZE entries. */
+static int
+fake_reset_ramps(randr_fake_t *fake, int size)
+{
+	uint16_t *ramps = (uint16_t *)
+		realloc(fake->ramps, (size_t)fake->config.crtc_count*3*size*
+			sizeof(uint16_t));
+	if (ramps == nullptr) return -1;
+
+	for (int i = 0; i < fake->config.crtc_count*3; i++) {
+		for (int j = 0; j < size; j++) {
+			ramps[i*size + j] = (uint16_t)
+				((double)j/(size - 1)*UINT16_MAX);
+		}
+	}
+
+	fake->ramps = ramps;
+	fake->ramp_size = size;
+
+	return 0;
+}
+
+/* Append SIZE zeroed bytes to the replies and return them, or NULL
+   if there is no memory. */
+static uint8_t *
+fake_out(randr_fake_t *fake, size_t size)
+{
+	if (fake->out_len + size > fake->out_size) {
+		size_t out_size = fake->out_size > 0 ? fake->out_size : 4096;
+		while (out_size < fake->out_len + size) out_size *= 2;
+
+		uint8_t *out = (uint8_t *)realloc(fake->out, out_size);
+		if (out == nullptr) return nullptr;
+		fake->out = out;
+		fake->out_size = out_size;
+	}
+
+	uint8_t *p = fake->out + fake->out_len;
+	memset(p, 0, size);
+	fake->out_len += size;
+
+	return p;
+}
+
+/* Append a reply with EXTRA bytes after the first 32. */
+static uint8_t *
+fake_reply(randr_fake_t *fake, size_t extra)
+{
+	uint8_t *p = fake_out(fake, 32 + PAD4(extra));
+	if (p == nullptr) return nullptr;
+
+	p[0] = 1;
+	put16(&p[2], fake->sequence);
+	put32(&p[4], (uint32_t)(PAD4(extra)/4));
+
+	return p;
+}
+
+static void
+fake_error(randr_fake_t *fake, uint8_t code, uint32_t value,
+	   uint8_t major, uint16_t minor)
+{
+	uint8_t *p = fake_out(fake, 32);
+	if (p == nullptr) return;
+
+	p[1] = code;
+	put16(&p[2], fake->sequence);
+	put32(&p[4], value);
+	put16(&p[8], minor);
+	p[10] = major;
+}
+
+/* Index of the CRTC or output with ID, or -1 if there is none. */
+static int
+fake_lookup(randr_fake_t *fake, uint32_t id, uint32_t base)
+{
+	if (id < base || id >= base + (uint32_t)fake->config.crtc_count) {
+		return -1;
+	}
+	return (int)(id - base);
+}
+
+/* Answer the connection setup with a single screen. */
+static int
+fake_setup(randr_fake_t *fake)
+{
+	static const char vendor[8] = { 'r', 'e', 'd', 's', 'h', 'i', 'f', 't' };
+
+	uint8_t *p = fake_out(fake, 128);
+	if (p == nullptr) return -1;
+
+	p[0] = 1;
+	put16(&p[2], 11);
+	put16(&p[4], 0);
+	put16(&p[6], (128 - 8)/4);
+
+	/* Server information */
+	put32(&p[8], 12000000);
+	put32(&p[12], 0x00400000);
+	put32(&p[16], 0x001fffff);
+	put16(&p[24], sizeof(vendor));
+	put16(&p[26], UINT16_MAX);
+	p[28] = 1;
+	p[29] = 1;
+	p[32] = 32;
+	p[33] = 32;
+	p[34] = 8;
+	p[35] = 255;
+	memcpy(&p[40], vendor, sizeof(vendor));
+
+	/* Pixmap format */
+	p[48] = 24;
+	p[49] = 32;
+	p[50] = 32;
+
+	/* Screen covering all CRTCs side by side */
+	int width = FAKE_CRTC_WIDTH*fake->config.crtc_count;
+	if (width > INT16_MAX) width = INT16_MAX;
+	put32(&p[56], FAKE_ROOT);
+	put32(&p[60], FAKE_COLORMAP);
+	put32(&p[64], 0xffffff);
+	put16(&p[76], (uint16_t)width);
+	put16(&p[78], FAKE_CRTC_HEIGHT);
+	put16(&p[80], (uint16_t)(width/4));
+	put16(&p[82], FAKE_CRTC_HEIGHT/4);
+	put16(&p[84], 1);
+	put16(&p[86], 1);
+	put32(&p[88], FAKE_VISUAL);
+	p[94] = 24;
+	p[95] = 1;
+
+	/* Depth with a single true color visual */
+	p[96] = 24;
+	put16(&p[98], 1);
+	put32(&p[104], FAKE_VISUAL);
+	p[108] = 4;
+	p[109] = 8;
+	put16(&p[110], 256);
+	put32(&p[112], 0xff0000);
+	put32(&p[116], 0x00ff00);
+	put32(&p[120], 0x0000ff);
+
+	return 0;
+}
+
+static void
+fake_handle_core(randr_fake_t *fake, const uint8_t *req, size_t len)
+{
+	uint8_t *p;
+
+	switch (req[0]) {
+	case X_INTERN_ATOM:
+		/* No atom exists, so there is no CTM or EDID property */
+		fake_reply(fake, 0);
+		break;
+	case X_GET_INPUT_FOCUS:
+		p = fake_reply(fake, 0);
+		if (p == nullptr) break;
+		p[1] = 1;
+		put32(&p[8], FAKE_ROOT);
+		break;
+	case X_QUERY_EXTENSION:
+	{
+		uint16_t name_len = get16(&req[4]);
+		if (8 + (size_t)name_len > len) {
+			fake_error(fake, X_BAD_LENGTH, 0, req[0], 0);
+			break;
+		}
+
+		p = fake_reply(fake, 0);
+		if (p == nullptr) break;
+		if (name_len == 5 && memcmp(&req[8], "RANDR", 5) == 0) {
+			p[8] = 1;
+			p[9] = FAKE_RANDR_OPCODE;
+			p[10] = FAKE_RANDR_FIRST_EVENT;
+			p[11] = FAKE_RANDR_FIRST_ERROR;
+		}
+		break;
+	}
+	default:
+		fake_error(fake, X_BAD_REQUEST, 0, req[0], 0);
+		break;
+	}
+}
+
+static void
+fake_handle_randr(randr_fake_t *fake, const uint8_t *req, size_t len)
+{
+	int count = fake->config.crtc_count;
+	int size = fake->ramp_size;
+	uint8_t minor = req[1];
+	uint8_t *p;
+
+	/* All RANDR requests used take a resource first */
+	if (minor != RR_QUERY_VERSION && len < 8) {
+		fake_error(fake, X_BAD_LENGTH, 0, FAKE_RANDR_OPCODE, minor);
+		return;
+	}
+	uint32_t id = len >= 8 ? get32(&req[4]) : 0;
+
+	switch (minor) {
+	case RR_QUERY_VERSION:
+		p = fake_reply(fake, 0);
+		if (p == nullptr) break;
+		put32(&p[8], 1);
+		put32(&p[12], 6);
+		break;
+	case RR_GET_SCREEN_RESOURCES:
+	case RR_GET_SCREEN_RESOURCES_CURRENT:
+		p = fake_reply(fake, 8*(size_t)count);
+		if (p == nullptr) break;
+		put16(&p[16], (uint16_t)count);
+		put16(&p[18], (uint16_t)count);
+		for (int i = 0; i < count; i++) {
+			put32(&p[32 + 4*i], FAKE_CRTC_BASE + i);
+			put32(&p[32 + 4*(count + i)], FAKE_OUTPUT_BASE + i);
+		}
+		break;
+	case RR_GET_CRTC_INFO:
+	{
+		int i = fake_lookup(fake, id, FAKE_CRTC_BASE);
+		if (i < 0) goto bad_crtc;
+
+		p = fake_reply(fake, 8);
+		if (p == nullptr) break;
+		int x = FAKE_CRTC_WIDTH*i;
+		put16(&p[12], (uint16_t)(x > INT16_MAX ? INT16_MAX : x));
+		put16(&p[16], FAKE_CRTC_WIDTH);
+		put16(&p[18], FAKE_CRTC_HEIGHT);
+		put32(&p[20], FAKE_MODE);
+		put16(&p[24], 1);
+		put16(&p[26], 1);
+		put16(&p[28], 1);
+		put16(&p[30], 1);
+		put32(&p[32], FAKE_OUTPUT_BASE + i);
+		put32(&p[36], FAKE_OUTPUT_BASE + i);
+		break;
+	}
+	case RR_GET_OUTPUT_INFO:
+	{
+		int i = fake_lookup(fake, id, FAKE_OUTPUT_BASE);
+		if (i < 0) goto bad_output;
+
+		char name[16];
+		int name_len = snprintf(name, sizeof(name), "FAKE-%d", i);
+
+		p = fake_reply(fake, 8 + name_len);
+		if (p == nullptr) break;
+		put32(&p[12], FAKE_CRTC_BASE + i);
+		put32(&p[16], 520);
+		put32(&p[20], 290);
+		put16(&p[26], 1);
+		put16(&p[34], (uint16_t)name_len);
+		put32(&p[36], FAKE_CRTC_BASE + i);
+		memcpy(&p[40], name, name_len);
+		break;
+	}
+	case RR_GET_OUTPUT_PROPERTY:
+		if (fake_lookup(fake, id, FAKE_OUTPUT_BASE) < 0) {
+			goto bad_output;
+		}
+		/* Format zero: the property does not exist */
+		fake_reply(fake, 0);
+		break;
+	case RR_CHANGE_OUTPUT_PROPERTY:
+		if (fake_lookup(fake, id, FAKE_OUTPUT_BASE) < 0) {
+			goto bad_output;
+		}
+		break;
+	case RR_GET_CRTC_GAMMA_SIZE:
+		if (fake_lookup(fake, id, FAKE_CRTC_BASE) < 0) goto bad_crtc;
+
+		p = fake_reply(fake, 0);
+		if (p == nullptr) break;
+		put16(&p[8], (uint16_t)size);
+		break;
+	case RR_GET_CRTC_GAMMA:
+	{
+		int i = fake_lookup(fake, id, FAKE_CRTC_BASE);
+		if (i < 0) goto bad_crtc;
+
+		p = fake_reply(fake, 6*(size_t)size);
+		if (p == nullptr) break;
+		put16(&p[8], (uint16_t)size);
+		memcpy(&p[32], &fake->ramps[3*i*size],
+		       3*(size_t)size*sizeof(uint16_t));
+		break;
+	}
+	case RR_SET_CRTC_GAMMA:
+	{
+		int i = fake_lookup(fake, id, FAKE_CRTC_BASE);
+		if (i < 0) goto bad_crtc;
+
+		uint16_t req_size = len >= 12 ? get16(&req[8]) : 0;
+		if (len < 12 + 6*(size_t)req_size) {
+			fake_error(fake, X_BAD_LENGTH, 0, FAKE_RANDR_OPCODE,
+				   minor);
+			break;
+		}
+		if (req_size != size) {
+			fake_error(fake, X_BAD_MATCH, id, FAKE_RANDR_OPCODE,
+				   minor);
+			break;
+		}
+
+		memcpy(&fake->ramps[3*i*size], &req[12],
+		       3*(size_t)size*sizeof(uint16_t));
+
+		/* Replace the displays; requests sent for the old
+		   ramp size fail from now on. */
+		fake->sets += 1;
+		if (fake->config.hotplug > 0 &&
+		    fake->sets % fake->config.hotplug == 0) {
+			int new_size = size == fake->config.ramp_size ?
+				2*size : fake->config.ramp_size;
+			fake_reset_ramps(fake, new_size);
+		}
+		break;
+	}
+	default:
+		fake_error(fake, X_BAD_REQUEST, 0, FAKE_RANDR_OPCODE, minor);
+		break;
+	}
+
+	return;
+
+bad_crtc:
+	fake_error(fake, FAKE_RANDR_FIRST_ERROR + RR_BAD_CRTC, id,
+		   FAKE_RANDR_OPCODE, minor);
+	return;
+bad_output:
+	fake_error(fake, FAKE_RANDR_FIRST_ERROR + RR_BAD_OUTPUT, id,
+		   FAKE_RANDR_OPCODE, minor);
+}
+
+/* Handle the complete requests received. Returns the number of
+   bytes used, or -1 if the connection cannot continue. */
+static long
+fake_handle(randr_fake_t *fake, const uint8_t *in, size_t len, int *setup)
+{
+	size_t used = 0;
+
+	if (!*setup) {
+		if (len < 12) return 0;
+
+		/* Only clients in this process connect, which use the
+		   byte order of the host. */
+		uint16_t one = 1;
+		uint8_t order = *(uint8_t *)&one == 1 ? 'l' : 'B';
+		if (in[0] != order) return -1;
+
+		size_t size = 12 + PAD4(get16(&in[6])) + PAD4(get16(&in[8]));
+		if (len < size) return 0;
+
+		if (fake_setup(fake) < 0) return -1;
+		*setup = 1;
+		used = size;
+	}
+
+	while (len - used >= 4) {
+		const uint8_t *req = in + used;
+		size_t size = 4*(size_t)get16(&req[2]);
+
+		/* Big requests are not announced */
+		if (size == 0) return -1;
+		if (len - used < size) break;
+
+		fake->sequence += 1;
+		if (req[0] == FAKE_RANDR_OPCODE) {
+			fake_handle_randr(fake, req, size);
+		} else {
+			fake_handle_core(fake, req, size);
+		}
+		used += size;
+	}
+
+	return (long)used;
+}
+
+static int
+fake_write(randr_fake_t *fake)
+{
+	size_t done = 0;
+	while (done < fake->out_len) {
+		ssize_t r = write(fake->fd, fake->out + done,
+				  fake->out_len - done);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		done += r;
+	}
+
+	fake->out_len = 0;
+
+	return 0;
+}
+
+static void *
+fake_thread(void *data)
+{
+	randr_fake_t *fake = (randr_fake_t *)data;
+	int setup = 0;
+
+	while (1) {
+		if (fake->in_size - fake->in_len < 4096) {
+			size_t in_size = 2*fake->in_size;
+			uint8_t *in = (uint8_t *)realloc(fake->in, in_size);
+			if (in == nullptr) break;
+			fake->in = in;
+			fake->in_size = in_size;
+		}
+
+		ssize_t r = read(fake->fd, fake->in + fake->in_len,
+				 fake->in_size - fake->in_len);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) break;
+		fake->in_len += r;
+
+		/* Replies to everything received together are held back
+		   by the latency, like on a remote connection. */
+		struct timespec due;
+		clock_gettime(CLOCK_MONOTONIC, &due);
+		due.tv_sec += fake->config.latency/1000;
+		due.tv_nsec += (long)(fake->config.latency % 1000)*1000000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec += 1;
+			due.tv_nsec -= 1000000000;
+		}
+
+		long used = fake_handle(fake, fake->in, fake->in_len, &setup);
+		if (used < 0) break;
+		fake->in_len -= used;
+		memmove(fake->in, fake->in + used, fake->in_len);
+
+		if (fake->out_len == 0) continue;
+
+		if (fake->config.latency > 0) {
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &due, nullptr) == EINTR);
+		}
+		if (fake_write(fake) < 0) break;
+	}
+
+	/* Let the client see the connection close */
+	shutdown(fake->fd, SHUT_RDWR);
+
+	return nullptr;
+}
+
+/* Start the fake server and set FD to the end of the connection for
+   xcb_connect_to_fd, which takes it over. Returns NULL on failure. */
+randr_fake_t *
+randr_fake_start(const randr_fake_config_t *config, int *fd)
+{
+	if (config->crtc_count < 1 || config->ramp_size < 2 ||
+	    2*config->ramp_size > UINT16_MAX) {
+		fprintf(stderr, _("Invalid fake RANDR configuration.\n"));
+		return nullptr;
+	}
+
+	randr_fake_t *fake = (randr_fake_t *)calloc(1, sizeof(randr_fake_t));
+	if (fake == nullptr) {
+		fprintf(stderr, "malloc");
+		return nullptr;
+	}
+
+	fake->config = *config;
+	fake->in_size = 4096;
+	fake->in = (uint8_t *)malloc(fake->in_size);
+	if (fake->in == nullptr ||
+	    fake_reset_ramps(fake, config->ramp_size) < 0) {
+		fprintf(stderr, "malloc");
+		free(fake->in);
+		free(fake);
+		return nullptr;
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair");
+		free(fake->ramps);
+		free(fake->in);
+		free(fake);
+		return nullptr;
+	}
+	fake->fd = fds[0];
+
+	int r = pthread_create(&fake->thread, nullptr, fake_thread, fake);
+	if (r != 0) {
+		fprintf(stderr, "pthread_create");
+		close(fds[0]);
+		close(fds[1]);
+		free(fake->ramps);
+		free(fake->in);
+		free(fake);
+		return nullptr;
+	}
+
+	*fd = fds[1];
+
+	return fake;
+}
+
+/* Stop the server once the client has disconnected, or right away. */
+void
+randr_fake_stop(randr_fake_t *fake)
+{
+	shutdown(fake->fd, SHUT_RDWR);
+	pthread_join(fake->thread, nullptr);
+
+	close(fake->fd);
+	free(fake->ramps);
+	free(fake->in);
+	free(fake->out);
+	free(fake);
+}
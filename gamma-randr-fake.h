@@ -0,0 +1,46 @@
+/* gamma-randr-fake.h -- In-process X server for the RANDR method header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_GAMMA_RANDR_FAKE_H
+#define REDSHIFT_GAMMA_RANDR_FAKE_H
+
+/* A fake X server speaking the subset of the core protocol and of
+   RANDR that the RANDR method uses, over one end of a socketpair.
+   The method connects to the other end with xcb_connect_to_fd, so
+   its requests, round trips, batching and handling of ramp size
+   changes can be timed and tested without a display. Every CRTC
+   drives one connected output and has no CTM or EDID property. */
+typedef struct {
+	int crtc_count;
+	int ramp_size;
+	/* Milliseconds before the replies to the requests received
+	   together are sent, as on a remote connection */
+	unsigned int latency;
+	/* Double or halve the ramp size of all CRTCs after this many
+	   Set CRTC Gamma requests, as if the displays were replaced.
+	   Zero for never. */
+	unsigned int hotplug;
+} randr_fake_config_t;
+
+typedef struct _RANDR_FAKE randr_fake_t;
+
+
+randr_fake_t *randr_fake_start(const randr_fake_config_t *config, int *fd);
+void randr_fake_stop(randr_fake_t *fake);
+
+
+#endif /* ! REDSHIFT_GAMMA_RANDR_FAKE_H */
@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 
 #include <malloc.h>
 
@@ -49,6 +50,9 @@
 #include "redshift/_.h"
 #include "redshift/redshift.h"
 #include "colorramp.h"
+#include "gamma-randr-fake.h"
+#include "gamma-snapshot.h"
+#include "trace.h"
 
 
 #define redshift_VERSION_MAJOR  1
@@ -64,13 +68,42 @@ redshift_init(redshift_state_t *state)
 
 	state->crtc_count = 0;
 	state->crtcs = nullptr;
+	state->frame = nullptr;
 
 	state->preserve = 0;
+	state->snapshot = 1;
 
+	state->ctm = 0;
+	state->ctm_atom = XCB_ATOM_NONE;
+	state->output_count = 0;
+	state->outputs = nullptr;
+
+	state->conn = nullptr;
+	state->preferred_screen = 0;
+	state->fake.crtc_count = 0;
+	state->fake.ramp_size = 256;
+	state->fake.latency = 0;
+	state->fake.hotplug = 0;
+	state->fake_server = nullptr;
+
+	return 0;
+}
+
+/* Open the connection to the X server, or to a fake X server if the
+   fake option was given, and check the RANDR version. */
+static int
+redshift_connect(redshift_state_t *state)
+{
 	xcb_generic_error_t *error;
 
-	/* Open X server connection */
-	state->conn = xcb_connect(nullptr, &state->preferred_screen);
+	if (state->fake.crtc_count > 0) {
+		int fd;
+		state->fake_server = randr_fake_start(&state->fake, &fd);
+		if (state->fake_server == nullptr) return -1;
+		state->conn = xcb_connect_to_fd(fd, nullptr);
+	} else {
+		state->conn = xcb_connect(nullptr, &state->preferred_screen);
+	}
 
 	/* Query redshift version */
 	xcb_randr_query_version_cookie_t ver_cookie =
@@ -86,6 +119,7 @@ redshift_init(redshift_state_t *state)
 		fprintf(stderr, _("`%s' returned error %d\n"),
 			"redshift Query Version", ec);
 		xcb_disconnect(state->conn);
+		state->conn = nullptr;
 		return -1;
 	}
 
@@ -95,6 +129,7 @@ redshift_init(redshift_state_t *state)
 			ver_reply->major_version, ver_reply->minor_version);
 		free(ver_reply);
 		xcb_disconnect(state->conn);
+		state->conn = nullptr;
 		return -1;
 	}
 
@@ -103,9 +138,396 @@ redshift_init(redshift_state_t *state)
 	return 0;
 }
 
+/* Map the active outputs to CRTCs and save their CTM property.
+   CRTCs with an output lacking the property keep using ramps. */
+static int
+redshift_find_ctm(redshift_state_t *state)
+{
+	xcb_generic_error_t *error;
+
+	xcb_intern_atom_cookie_t atom_cookie =
+		xcb_intern_atom(state->conn, 1, strlen("CTM"), "CTM");
+	xcb_intern_atom_reply_t *atom_reply =
+		xcb_intern_atom_reply(state->conn, atom_cookie, &error);
+	if (error || atom_reply == nullptr) {
+		free(atom_reply);
+		return -1;
+	}
+
+	state->ctm_atom = atom_reply->atom;
+	free(atom_reply);
+	if (state->ctm_atom == XCB_ATOM_NONE) return -1;
+
+	xcb_randr_get_screen_resources_current_cookie_t res_cookie =
+		xcb_randr_get_screen_resources_current(state->conn,
+						       state->screen->root);
+	xcb_randr_get_screen_resources_current_reply_t *res_reply =
+		xcb_randr_get_screen_resources_current_reply(state->conn,
+							     res_cookie,
+							     &error);
+	if (error || res_reply == nullptr) {
+		free(res_reply);
+		return -1;
+	}
+
+	int output_count = res_reply->num_outputs;
+	xcb_randr_output_t *outputs =
+		xcb_randr_get_screen_resources_current_outputs(res_reply);
+
+	state->outputs = (redshift_output_state_t *)
+		calloc(output_count, sizeof(redshift_output_state_t));
+	if (state->outputs == nullptr) {
+		fprintf(stderr, "malloc");
+		free(res_reply);
+		return -1;
+	}
+
+	/* Every CRTC driving an output is a candidate until
+	   an output without the property is found. */
+	int *has_ctm = (int *)calloc(state->crtc_count, sizeof(int));
+	if (has_ctm == nullptr) {
+		fprintf(stderr, "malloc");
+		free(res_reply);
+		return -1;
+	}
+
+	for (int i = 0; i < output_count; i++) {
+		xcb_randr_get_output_info_cookie_t info_cookie =
+			xcb_randr_get_output_info(state->conn, outputs[i],
+						  XCB_CURRENT_TIME);
+		xcb_randr_get_output_info_reply_t *info_reply =
+			xcb_randr_get_output_info_reply(state->conn,
+							info_cookie, &error);
+		if (error || info_reply == nullptr) {
+			free(info_reply);
+			continue;
+		}
+
+		int crtc_num = -1;
+		for (int j = 0; j < state->crtc_count; j++) {
+			if (state->crtcs[j].crtc == info_reply->crtc) {
+				crtc_num = j;
+				break;
+			}
+		}
+		free(info_reply);
+		if (crtc_num < 0) continue;
+
+		xcb_randr_get_output_property_cookie_t prop_cookie =
+			xcb_randr_get_output_property(state->conn, outputs[i],
+						      state->ctm_atom,
+						      XCB_ATOM_ANY, 0, 18,
+						      0, 0);
+		xcb_randr_get_output_property_reply_t *prop_reply =
+			xcb_randr_get_output_property_reply(state->conn,
+							    prop_cookie,
+							    &error);
+		if (error || prop_reply == nullptr ||
+		    prop_reply->format != 32 || prop_reply->num_items != 18) {
+			free(prop_reply);
+			has_ctm[crtc_num] = -1;
+			continue;
+		}
+
+		redshift_output_state_t *output =
+			&state->outputs[state->output_count++];
+		output->output = outputs[i];
+		output->crtc_num = crtc_num;
+		::memcpy(output->saved_ctm,
+			 xcb_randr_get_output_property_data(prop_reply),
+			 sizeof(output->saved_ctm));
+		free(prop_reply);
+
+		if (has_ctm[crtc_num] == 0) has_ctm[crtc_num] = 1;
+	}
+
+	free(res_reply);
+
+	for (int i = 0; i < state->crtc_count; i++) {
+		state->crtcs[i].ctm = has_ctm[i] > 0;
+		if (has_ctm[i] < 0) {
+			fprintf(stderr, _("CRTC %i has an output without a"
+					  " color transformation matrix,\n"
+					  "using gamma ramps instead.\n"), i);
+		}
+	}
+	free(has_ctm);
+
+	return 0;
+}
+
+/* Fill KEYS with the snapshot key of the display on each CRTC. The
+   connector is named after the X screen and the output, so that
+   separate X servers such as Xvfb do not share entries. The requests
+   for all CRTCs are sent before waiting for any reply. */
+static void
+redshift_snapshot_keys(redshift_state_t *state,
+		       char (*keys)[GAMMA_SNAPSHOT_KEY_SIZE])
+{
+	int screen_num = state->screen_num;
+	if (screen_num < 0) screen_num = state->preferred_screen;
+
+	char display[24];
+	char *host = nullptr;
+	int display_num = 0;
+	if (state->fake_server != nullptr) {
+		host = strdup("fake");
+	} else if (xcb_parse_display(nullptr, &host, &display_num,
+				     nullptr) == 0) {
+		host = nullptr;
+	}
+	snprintf(display, sizeof(display), "%.12s:%d.%d",
+		 host != nullptr ? host : "", display_num, screen_num);
+	free(host);
+
+	xcb_intern_atom_cookie_t atom_cookie =
+		xcb_intern_atom(state->conn, 1, strlen("EDID"), "EDID");
+
+	xcb_randr_get_crtc_info_cookie_t *info_cookies =
+		(xcb_randr_get_crtc_info_cookie_t *)
+		alloca(state->crtc_count*sizeof(*info_cookies));
+	for (int i = 0; i < state->crtc_count; i++) {
+		info_cookies[i] = xcb_randr_get_crtc_info(
+			state->conn, state->crtcs[i].crtc, XCB_CURRENT_TIME);
+	}
+
+	xcb_atom_t edid_atom = XCB_ATOM_NONE;
+	xcb_intern_atom_reply_t *atom_reply =
+		xcb_intern_atom_reply(state->conn, atom_cookie, nullptr);
+	if (atom_reply != nullptr) {
+		edid_atom = atom_reply->atom;
+		free(atom_reply);
+	}
+
+	/* Name CRTCs without an output by their identifier. The
+	   first output of the others identifies the display. */
+	xcb_randr_output_t *outputs = (xcb_randr_output_t *)
+		alloca(state->crtc_count*sizeof(*outputs));
+	for (int i = 0; i < state->crtc_count; i++) {
+		char crtc_name[48];
+		snprintf(crtc_name, sizeof(crtc_name), "%s/crtc-%u", display,
+			 (unsigned int)state->crtcs[i].crtc);
+		gamma_snapshot_key(keys[i], "randr", crtc_name, nullptr, 0);
+
+		outputs[i] = XCB_NONE;
+		xcb_randr_get_crtc_info_reply_t *info_reply =
+			xcb_randr_get_crtc_info_reply(state->conn,
+						      info_cookies[i],
+						      nullptr);
+		if (info_reply == nullptr) continue;
+
+		if (xcb_randr_get_crtc_info_outputs_length(info_reply) > 0) {
+			outputs[i] = xcb_randr_get_crtc_info_outputs(
+				info_reply)[0];
+		}
+		free(info_reply);
+	}
+
+	xcb_randr_get_output_info_cookie_t *output_cookies =
+		(xcb_randr_get_output_info_cookie_t *)
+		alloca(state->crtc_count*sizeof(*output_cookies));
+	xcb_randr_get_output_property_cookie_t *edid_cookies =
+		(xcb_randr_get_output_property_cookie_t *)
+		alloca(state->crtc_count*sizeof(*edid_cookies));
+	for (int i = 0; i < state->crtc_count; i++) {
+		if (outputs[i] == XCB_NONE) continue;
+
+		output_cookies[i] = xcb_randr_get_output_info(
+			state->conn, outputs[i], XCB_CURRENT_TIME);
+		if (edid_atom != XCB_ATOM_NONE) {
+			edid_cookies[i] = xcb_randr_get_output_property(
+				state->conn, outputs[i], edid_atom,
+				XCB_ATOM_ANY, 0, 128, 0, 0);
+		}
+	}
+
+	for (int i = 0; i < state->crtc_count; i++) {
+		if (outputs[i] == XCB_NONE) continue;
+
+		xcb_randr_get_output_property_reply_t *edid_reply = nullptr;
+		if (edid_atom != XCB_ATOM_NONE) {
+			edid_reply = xcb_randr_get_output_property_reply(
+				state->conn, edid_cookies[i], nullptr);
+		}
+
+		xcb_randr_get_output_info_reply_t *output_reply =
+			xcb_randr_get_output_info_reply(state->conn,
+							output_cookies[i],
+							nullptr);
+		if (output_reply != nullptr) {
+			char name[GAMMA_SNAPSHOT_KEY_SIZE];
+			int length = xcb_randr_get_output_info_name_length(
+				output_reply);
+			snprintf(name, sizeof(name), "%s/%.*s", display,
+				 length, xcb_randr_get_output_info_name(
+					 output_reply));
+
+			const void *edid = nullptr;
+			size_t edid_size = 0;
+			if (edid_reply != nullptr) {
+				edid = xcb_randr_get_output_property_data(
+					edid_reply);
+				edid_size =
+					xcb_randr_get_output_property_data_length(
+						edid_reply);
+			}
+
+			gamma_snapshot_key(keys[i], "randr", name, edid,
+					   edid_size);
+			free(output_reply);
+		}
+		free(edid_reply);
+	}
+}
+
+/* Save the size and gamma ramps of all CRTCs, so they can be
+   restored at program exit. The ramps are taken from the snapshot
+   when it has them; they are then the ramps from before redshift
+   first adjusted the display, even if it did not exit cleanly. Only
+   the other CRTCs are read back, and added to the snapshot. */
+static int
+redshift_save_ramps(redshift_state_t *state)
+{
+	xcb_generic_error_t *error;
+
+	char (*keys)[GAMMA_SNAPSHOT_KEY_SIZE] = nullptr;
+	gamma_snapshot_t snapshot;
+	if (state->snapshot) {
+		keys = (char (*)[GAMMA_SNAPSHOT_KEY_SIZE])
+			calloc(state->crtc_count, GAMMA_SNAPSHOT_KEY_SIZE);
+		if (keys == nullptr) {
+			fprintf(stderr, "malloc");
+			return -1;
+		}
+		redshift_snapshot_keys(state, keys);
+		gamma_snapshot_open(&snapshot);
+	}
+
+	/* Request size_i32 of gamma ramps of all CRTCs at once */
+	xcb_randr_get_crtc_gamma_size_cookie_t *size_cookies =
+		(xcb_randr_get_crtc_gamma_size_cookie_t *)
+		alloca(state->crtc_count*sizeof(*size_cookies));
+	for (int i = 0; i < state->crtc_count; i++) {
+		size_cookies[i] = xcb_randr_get_crtc_gamma_size(
+			state->conn, state->crtcs[i].crtc);
+	}
+
+	int r = 0;
+	xcb_randr_get_crtc_gamma_cookie_t *gamma_cookies =
+		(xcb_randr_get_crtc_gamma_cookie_t *)
+		alloca(state->crtc_count*sizeof(*gamma_cookies));
+	int *pending = (int *)alloca(state->crtc_count*sizeof(int));
+	for (int i = 0; i < state->crtc_count; i++) {
+		redshift_crtc_state_t *crtc = &state->crtcs[i];
+
+		xcb_randr_get_crtc_gamma_size_reply_t *gamma_size_reply =
+			xcb_randr_get_crtc_gamma_size_reply(state->conn,
+							    size_cookies[i],
+							    &error);
+		if (error) {
+			fprintf(stderr, _("`%s' returned error %d\n"),
+				"redshift Get CRTC Gamma Size",
+				error->error_code);
+			r = -1;
+			break;
+		}
+
+		unsigned int ramp_size = gamma_size_reply->size;
+		crtc->ramp_size = ramp_size;
+		free(gamma_size_reply);
+
+		if (ramp_size == 0) {
+			fprintf(stderr, _("Gamma ramp size_i32 too small: %i\n"),
+				ramp_size);
+			r = -1;
+			break;
+		}
+
+		/* Allocate space for saved gamma ramps */
+		crtc->saved_ramps = (unsigned short *)
+			malloc(3*ramp_size*sizeof(unsigned short));
+		if (crtc->saved_ramps == nullptr) {
+			fprintf(stderr, "malloc");
+			r = -1;
+			break;
+		}
+
+		/* The ramps hold the calibration loaded before start. */
+		for (int c = 0; c < 3; c++) crtc->ramp_gamma[c] = 1.0;
+
+		pending[i] = 0;
+		const uint16_t *saved = nullptr;
+		if (keys != nullptr) {
+			saved = gamma_snapshot_find(&snapshot, keys[i],
+						    ramp_size);
+		}
+
+		if (saved != nullptr) {
+			::memcpy(crtc->saved_ramps, saved,
+				 3*ramp_size*sizeof(unsigned short));
+			if (!gamma_snapshot_in_use(&snapshot, keys[i])) {
+				gamma_snapshot_add(&snapshot, keys[i], saved,
+						   ramp_size);
+			}
+		} else {
+			/* Request current gamma ramps */
+			gamma_cookies[i] = xcb_randr_get_crtc_gamma(
+				state->conn, crtc->crtc);
+			pending[i] = 1;
+		}
+	}
+
+	for (int i = 0; r == 0 && i < state->crtc_count; i++) {
+		redshift_crtc_state_t *crtc = &state->crtcs[i];
+		if (!pending[i]) continue;
+
+		xcb_randr_get_crtc_gamma_reply_t *gamma_get_reply =
+			xcb_randr_get_crtc_gamma_reply(state->conn,
+						       gamma_cookies[i],
+						       &error);
+		if (error) {
+			fprintf(stderr, _("`%s' returned error %d\n"),
+				"redshift Get CRTC Gamma", error->error_code);
+			r = -1;
+			break;
+		}
+
+		/* Copy gamma ramps into CRTC state */
+		unsigned int ramp_size = crtc->ramp_size;
+		::memcpy(&crtc->saved_ramps[0*ramp_size],
+			 xcb_randr_get_crtc_gamma_red(gamma_get_reply),
+			 ramp_size*sizeof(unsigned short));
+		::memcpy(&crtc->saved_ramps[1*ramp_size],
+			 xcb_randr_get_crtc_gamma_green(gamma_get_reply),
+			 ramp_size*sizeof(unsigned short));
+		::memcpy(&crtc->saved_ramps[2*ramp_size],
+			 xcb_randr_get_crtc_gamma_blue(gamma_get_reply),
+			 ramp_size*sizeof(unsigned short));
+		free(gamma_get_reply);
+
+		if (keys != nullptr) {
+			gamma_snapshot_add(&snapshot, keys[i],
+					   crtc->saved_ramps, ramp_size);
+		}
+	}
+
+	if (keys != nullptr) {
+		if (r == 0 && gamma_snapshot_commit(&snapshot) < 0) {
+			fputs(_("Unable to save gamma ramp snapshot.\n"),
+			      stderr);
+		}
+		gamma_snapshot_close(&snapshot);
+		free(keys);
+	}
+
+	return r;
+}
+
 int
 redshift_start(redshift_state_t *state)
 {
+	if (redshift_connect(state) < 0) return -1;
+
 	xcb_generic_error_t *error;
 
 	int screen_num = state->screen_num;
@@ -160,24 +582,59 @@ redshift_start(redshift_state_t *state)
 	/* Save CRTC identifier in state */
 	for (int i = 0; i < state->crtc_count; i++) {
 		state->crtcs[i].crtc = crtcs[i];
+		colorramp_curve_init(&state->crtcs[i].curve);
 	}
 
 	free(res_reply);
 
-	/* Save size_i32 and gamma ramps of all CRTCs.
-	   Current gamma ramps are saved so we can restore them
-	   at program exit. */
+	int r = redshift_save_ramps(state);
+	if (r < 0) return -1;
+
+	if (state->ctm) {
+		int r = redshift_find_ctm(state);
+		if (r < 0) {
+			fprintf(stderr, _("Color transformation matrix not"
+					  " supported, using gamma ramps"
+					  " instead.\n"));
+		}
+	}
+
+	/* Allocate one buffer holding the ramps of all CRTCs so
+	   an update is written out with a single flush. */
+	size_t buffer_size = sizeof(color_setting_t);
 	for (int i = 0; i < state->crtc_count; i++) {
-		xcb_randr_crtc_t crtc = state->crtcs[i].crtc;
+		buffer_size += 3*state->crtcs[i].ramp_size*sizeof(unsigned short);
+	}
+
+	state->frame = malloc(buffer_size);
+	if (state->frame == nullptr) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Check the CRTCs after the system resumed. The server may have
+   reset the gamma ramps, so all ramps are sent again with the next
+   update, and a CRTC whose ramp size changed has its saved ramps
+   read again. */
+int
+redshift_revalidate(redshift_state_t *state)
+{
+	xcb_generic_error_t *error;
+	int resized = 0;
+
+	for (int i = 0; i < state->crtc_count; i++) {
+		redshift_crtc_state_t *crtc = &state->crtcs[i];
+		for (int c = 0; c < 3; c++) crtc->ramp_gamma[c] = NAN;
 
-		/* Request size_i32 of gamma ramps */
 		xcb_randr_get_crtc_gamma_size_cookie_t gamma_size_cookie =
-			xcb_randr_get_crtc_gamma_size(state->conn, crtc);
+			xcb_randr_get_crtc_gamma_size(state->conn, crtc->crtc);
 		xcb_randr_get_crtc_gamma_size_reply_t *gamma_size_reply =
 			xcb_randr_get_crtc_gamma_size_reply(state->conn,
 							    gamma_size_cookie,
 							    &error);
-
 		if (error) {
 			fprintf(stderr, _("`%s' returned error %d\n"),
 				"redshift Get CRTC Gamma Size",
@@ -186,55 +643,54 @@ redshift_start(redshift_state_t *state)
 		}
 
 		unsigned int ramp_size = gamma_size_reply->size;
-		state->crtcs[i].ramp_size = ramp_size;
-
 		free(gamma_size_reply);
+		if (ramp_size == crtc->ramp_size) continue;
 
+		fprintf(stderr, _("Gamma ramp size of CRTC %i changed"
+				  " from %u to %u.\n"), i, crtc->ramp_size,
+			ramp_size);
 		if (ramp_size == 0) {
 			fprintf(stderr, _("Gamma ramp size_i32 too small: %i\n"),
 				ramp_size);
 			return -1;
 		}
 
-		/* Request current gamma ramps */
-		xcb_randr_get_crtc_gamma_cookie_t gamma_get_cookie =
-			xcb_randr_get_crtc_gamma(state->conn, crtc);
-		xcb_randr_get_crtc_gamma_reply_t *gamma_get_reply =
-			xcb_randr_get_crtc_gamma_reply(state->conn,
-						       gamma_get_cookie,
-						       &error);
-
-		if (error) {
-			fprintf(stderr, _("`%s' returned error %d\n"),
-				"redshift Get CRTC Gamma", error->error_code);
-			return -1;
-		}
-
-		unsigned short *gamma_r =
-			xcb_randr_get_crtc_gamma_red(gamma_get_reply);
-		unsigned short *gamma_g =
-			xcb_randr_get_crtc_gamma_green(gamma_get_reply);
-		unsigned short *gamma_b =
-			xcb_randr_get_crtc_gamma_blue(gamma_get_reply);
-
-		/* Allocate space for saved gamma ramps */
-		state->crtcs[i].saved_ramps =(unsigned short *)
+		/* The CRTC now holds adjusted ramps, or whatever the
+		   driver reset it to, so the saved ramps are resampled
+		   to the new size rather than read back. */
+		unsigned short *saved_ramps = (unsigned short *)
 			malloc(3*ramp_size*sizeof(unsigned short));
-		if (state->crtcs[i].saved_ramps == nullptr) {
+		if (saved_ramps == nullptr) {
 			fprintf(stderr, "malloc");
-			free(gamma_get_reply);
 			return -1;
 		}
 
-		/* Copy gamma ramps into CRTC state */
-		::memcpy(&state->crtcs[i].saved_ramps[0*ramp_size], gamma_r,
-		       ramp_size*sizeof(unsigned short));
-		::memcpy(&state->crtcs[i].saved_ramps[1*ramp_size], gamma_g,
-		       ramp_size*sizeof(unsigned short));
-		::memcpy(&state->crtcs[i].saved_ramps[2*ramp_size], gamma_b,
-		       ramp_size*sizeof(unsigned short));
+		for (int c = 0; c < 3; c++) {
+			colorramp_resample(&crtc->saved_ramps[c*crtc->ramp_size],
+					   crtc->ramp_size,
+					   &saved_ramps[c*ramp_size], ramp_size);
+		}
 
-		free(gamma_get_reply);
+		free(crtc->saved_ramps);
+		crtc->saved_ramps = saved_ramps;
+		crtc->ramp_size = ramp_size;
+		crtc->curve.valid = 0;
+		resized = 1;
+	}
+
+	if (resized) {
+		size_t buffer_size = sizeof(color_setting_t);
+		for (int i = 0; i < state->crtc_count; i++) {
+			buffer_size += 3*state->crtcs[i].ramp_size*
+				sizeof(unsigned short);
+		}
+
+		void *frame = realloc(state->frame, buffer_size);
+		if (frame == nullptr) {
+			fprintf(stderr, "realloc");
+			return -1;
+		}
+		state->frame = frame;
 	}
 
 	return 0;
@@ -265,6 +721,31 @@ redshift_restore(redshift_state_t *state)
 			fprintf(stderr, _("`%s' returned error %d\n"),
 				"redshift Set CRTC Gamma", error->error_code);
 			fprintf(stderr, _("Unable to restore CRTC %i\n"), i);
+			free(error);
+		}
+
+		state->crtcs[i].ramp_gamma[0] = 1.0;
+		state->crtcs[i].ramp_gamma[1] = 1.0;
+		state->crtcs[i].ramp_gamma[2] = 1.0;
+	}
+
+	/* Restore output color transformation matrices */
+	for (int i = 0; i < state->output_count; i++) {
+		redshift_output_state_t *output = &state->outputs[i];
+
+		xcb_void_cookie_t ctm_set_cookie =
+			xcb_randr_change_output_property_checked(
+				state->conn, output->output, state->ctm_atom,
+				XCB_ATOM_INTEGER, 32, XCB_PROP_MODE_REPLACE,
+				18, output->saved_ctm);
+		error = xcb_request_check(state->conn, ctm_set_cookie);
+
+		if (error) {
+			fprintf(stderr, _("`%s' returned error %d\n"),
+				"redshift Change Output Property",
+				error->error_code);
+			fprintf(stderr, _("Unable to restore CTM of CRTC %i\n"),
+				output->crtc_num);
 		}
 	}
 }
@@ -272,14 +753,26 @@ redshift_restore(redshift_state_t *state)
 void
 redshift_free(redshift_state_t *state)
 {
+	/* Drop the snapshot entries of this instance, whether or not the
+	   ramps were restored. The display may be left adjusted or get
+	   another calibration before the next run, which must then read
+	   its ramps back. */
+	if (state->snapshot && state->crtcs != nullptr) {
+		gamma_snapshot_release("randr");
+	}
+
 	/* Free CRTC state */
 	for (int i = 0; i < state->crtc_count; i++) {
 		free(state->crtcs[i].saved_ramps);
+		colorramp_curve_free(&state->crtcs[i].curve);
 	}
 	free(state->crtcs);
+	free(state->frame);
+	free(state->outputs);
 
 	/* Close connection */
-	xcb_disconnect(state->conn);
+	if (state->conn != nullptr) xcb_disconnect(state->conn);
+	if (state->fake_server != nullptr) randr_fake_stop(state->fake_server);
 }
 
 void
@@ -293,7 +786,19 @@ redshift_print_help(FILE *f)
 	fputs(_("  screen=N\t\tX screen to apply adjustments to\n"
 		"  crtc=N\t\tCRTC to apply adjustments to\n"
 		"  preserve={0,1}\tWhether existing gamma should be"
-		" preserved\n"),
+		" preserved\n"
+		"  ctm={0,1}\t\tAdjust with the output color transformation"
+		" matrix\n"
+		"  \t\t\twhere available\n"
+		"  snapshot={0,1}\tWhether to keep the ramps from before"
+		" the first\n"
+		"  \t\t\tadjustment of each display across restarts\n"
+		"  fake=N\t\tConnect to a fake X server with N CRTCs"
+		" instead\n"
+		"  fake-ramp-size=N\tGamma ramp size of the fake CRTCs\n"
+		"  fake-latency=MS\tDelay of the fake server's replies\n"
+		"  fake-hotplug=N\tChange the fake ramp size every N"
+		" updates\n"),
 	      f);
 	fputs("\n", f);
 }
@@ -307,6 +812,18 @@ redshift_set_option(redshift_state_t *state, const char * key, const char * valu
 		state->crtc_num = atoi(value);
 	} else if (strcasecmp(key, "preserve") == 0) {
 		state->preserve = atoi(value);
+	} else if (strcasecmp(key, "ctm") == 0) {
+		state->ctm = atoi(value);
+	} else if (strcasecmp(key, "snapshot") == 0) {
+		state->snapshot = atoi(value);
+	} else if (strcasecmp(key, "fake") == 0) {
+		state->fake.crtc_count = atoi(value);
+	} else if (strcasecmp(key, "fake-ramp-size") == 0) {
+		state->fake.ramp_size = atoi(value);
+	} else if (strcasecmp(key, "fake-latency") == 0) {
+		state->fake.latency = atoi(value);
+	} else if (strcasecmp(key, "fake-hotplug") == 0) {
+		state->fake.hotplug = atoi(value);
 	} else {
 		fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
 		return -1;
@@ -315,13 +832,141 @@ redshift_set_option(redshift_state_t *state, const char * key, const char * valu
 	return 0;
 }
 
+/* Report errors of requests queued by previous updates. The requests are unchecked, so errors arrive
+   asynchronously and are matched to CRTCs by sequence number. */
 static int
-redshift_set_temperature_for_crtc(redshift_state_t *state, int crtc_num,
-			       const color_setting_t *setting)
+redshift_check_errors(redshift_state_t *state)
 {
-	xcb_generic_error_t *error;
+	int r = 0;
+
+	if (xcb_connection_has_error(state->conn)) {
+		fprintf(stderr, _("Lost connection to X server.\n"));
+		return -1;
+	}
+
+	xcb_generic_event_t *event;
+	while ((event = xcb_poll_for_event(state->conn)) != nullptr) {
+		if (event->response_type == 0) {
+			xcb_generic_error_t *error =
+				(xcb_generic_error_t *)event;
+
+			/* A CRTC may queue several requests; the error
+			   belongs to the first CRTC whose last request
+			   was sent at or after it. */
+			int crtc_num = -1;
+			for (int i = 0; i < state->crtc_count; i++) {
+				unsigned int sequence = state->crtcs[i].sequence;
+				if (sequence >= error->full_sequence &&
+				    (crtc_num < 0 ||
+				     sequence < state->crtcs[crtc_num].sequence)) {
+					crtc_num = i;
+				}
+			}
+
+			fprintf(stderr, _("`%s' returned error %d\n"),
+				crtc_num >= 0 && state->crtcs[crtc_num].ctm ?
+				"redshift Change Output Property" :
+				"redshift Set CRTC Gamma", error->error_code);
+			if (crtc_num >= 0) {
+				fprintf(stderr, _("Unable to adjust CRTC %i\n"),
+					crtc_num);
+			}
+			r = -1;
+		}
+
+		free(event);
+	}
+
+	return r;
+}
+
+/* Queue the white point and brightness of SETTING as a diagonal
+   CTM on the outputs of CRTC_NUM. The gamma ramps are only replaced,
+   using GAMMA_RAMPS, when the requested gamma changes; otherwise the
+   calibration loaded before start is kept. */
+static int
+redshift_queue_ctm_for_crtc(redshift_state_t *state, int crtc_num,
+			    const color_setting_t *setting,
+			    unsigned short *gamma_ramps)
+{
+	redshift_crtc_state_t *crtc = &state->crtcs[crtc_num];
+
+	if (setting->gamma[0] != crtc->ramp_gamma[0] ||
+	    setting->gamma[1] != crtc->ramp_gamma[1] ||
+	    setting->gamma[2] != crtc->ramp_gamma[2]) {
+		unsigned int ramp_size = crtc->ramp_size;
+
+		/* The gamma is applied on top of the calibration in the
+		   saved ramps. The white point of 6500K is neutral and
+		   the brightness is in the CTM. */
+		::memcpy(gamma_ramps, crtc->saved_ramps,
+			 3*ramp_size*sizeof(unsigned short));
+		if (setting->gamma[0] != 1.0 || setting->gamma[1] != 1.0 ||
+		    setting->gamma[2] != 1.0) {
+			color_setting_t curve_setting = *setting;
+			curve_setting.temperature = 6500;
+			curve_setting.brightness = 1.0;
+			colorramp_fill(&gamma_ramps[0*ramp_size],
+				       &gamma_ramps[1*ramp_size],
+				       &gamma_ramps[2*ramp_size],
+				       ramp_size, &curve_setting);
+		}
+
+		xcb_void_cookie_t gamma_set_cookie =
+			xcb_randr_set_crtc_gamma(state->conn, crtc->crtc,
+						 ramp_size,
+						 &gamma_ramps[0*ramp_size],
+						 &gamma_ramps[1*ramp_size],
+						 &gamma_ramps[2*ramp_size]);
+		crtc->sequence = gamma_set_cookie.sequence;
+
+		for (int c = 0; c < 3; c++) {
+			crtc->ramp_gamma[c] = setting->gamma[c];
+		}
+	}
+
+	/* The ramps raise their input to 1/gamma, so the brightness
+	   is raised to gamma to give the same result as the ramps. */
+	float white_point[3];
+	colorramp_white_point(setting->temperature, white_point);
+
+	/* S31.32 sign-magnitude, low half first */
+	uint32_t ctm[18] = { 0 };
+	for (int c = 0; c < 3; c++) {
+		double value = white_point[c] *
+			pow(setting->brightness, setting->gamma[c]);
+		uint64_t fixed = (uint64_t)(value * ((uint64_t)1 << 32));
+		ctm[2*(4*c)] = (uint32_t)fixed;
+		ctm[2*(4*c) + 1] = (uint32_t)(fixed >> 32);
+	}
+
+	for (int i = 0; i < state->output_count; i++) {
+		if (state->outputs[i].crtc_num != crtc_num) continue;
+
+		xcb_void_cookie_t ctm_set_cookie =
+			xcb_randr_change_output_property(
+				state->conn, state->outputs[i].output,
+				state->ctm_atom, XCB_ATOM_INTEGER, 32,
+				XCB_PROP_MODE_REPLACE, 18, ctm);
+		crtc->sequence = ctm_set_cookie.sequence;
+	}
 
-	if (crtc_num >= state->crtc_count || crtc_num < 0) {
+	return 0;
+}
+
+/* Determine the range of CRTCs to adjust. */
+static int
+redshift_selected_crtcs(redshift_state_t *state, int *first, int *last)
+{
+	/* If no CRTC number has been specified,
+	   set temperature on all CRTCs. */
+	if (state->crtc_num < 0) {
+		*first = 0;
+		*last = state->crtc_count;
+		return 0;
+	}
+
+	if (state->crtc_num >= state->crtc_count) {
 		fprintf(stderr, _("CRTC %d does not exist. "),
 			state->crtc_num);
 		if (state->crtc_count > 1) {
@@ -334,20 +979,31 @@ redshift_set_temperature_for_crtc(redshift_state_t *state, int crtc_num,
 		return -1;
 	}
 
-	xcb_randr_crtc_t crtc = state->crtcs[crtc_num].crtc;
-	unsigned int ramp_size = state->crtcs[crtc_num].ramp_size;
+	*first = state->crtc_num;
+	*last = state->crtc_num + 1;
+	return 0;
+}
 
-	/* Create new gamma ramps */
-	unsigned short *gamma_ramps = (unsigned short *)malloc(3*ramp_size*sizeof(unsigned short));
-	if (gamma_ramps == nullptr) {
-		fprintf(stderr, "malloc");
-		return -1;
-	}
+/* Fill GAMMA_RAMPS of CRTC_NUM for SETTING. The curve of the CRTC
+   is only computed again when the gamma changes. */
+static int
+redshift_fill_ramps_for_crtc(redshift_state_t *state, int crtc_num,
+			     const color_setting_t *setting,
+			     unsigned short *gamma_ramps)
+{
+	unsigned int ramp_size = state->crtcs[crtc_num].ramp_size;
+	colorramp_curve_t *curve = &state->crtcs[crtc_num].curve;
 
 	unsigned short *gamma_r = &gamma_ramps[0*ramp_size];
 	unsigned short *gamma_g = &gamma_ramps[1*ramp_size];
 	unsigned short *gamma_b = &gamma_ramps[2*ramp_size];
 
+	if (colorramp_curve_matches(curve, ramp_size, setting)) {
+		colorramp_curve_fill(curve, gamma_r, gamma_g, gamma_b,
+				     setting);
+		return 0;
+	}
+
 	if (state->preserve) {
 		/* Initialize gamma ramps from saved state */
 		::memcpy(gamma_ramps, state->crtcs[crtc_num].saved_ramps,
@@ -362,50 +1018,157 @@ redshift_set_temperature_for_crtc(redshift_state_t *state, int crtc_num,
 		}
 	}
 
-	colorramp_fill(gamma_r, gamma_g, gamma_b, ramp_size,
-		       setting);
-
-	/* Set new gamma ramps */
-	xcb_void_cookie_t gamma_set_cookie =
-		xcb_randr_set_crtc_gamma_checked(state->conn, crtc,
-						 ramp_size, gamma_r,
-						 gamma_g, gamma_b);
-	error = xcb_request_check(state->conn, gamma_set_cookie);
-
-	if (error) {
-		fprintf(stderr, _("`%s' returned error %d\n"),
-			"redshift Set CRTC Gamma", error->error_code);
-		free(gamma_ramps);
+	int r = colorramp_curve_update(curve, gamma_r, gamma_g, gamma_b,
+				       ramp_size, setting);
+	if (r < 0) {
+		fprintf(stderr, "malloc");
 		return -1;
 	}
 
-	free(gamma_ramps);
+	colorramp_curve_fill(curve, gamma_r, gamma_g, gamma_b, setting);
 
 	return 0;
 }
 
+/* Compute the ramps for SETTING into FRAME. A frame holds the setting
+   followed by the ramps of every adjusted CRTC, back to back. Space
+   is reserved for CRTCs adjusted with a CTM too, but it is not
+   filled. Returns the size of a frame; if FRAME is NULL only the
+   size is computed. */
+long
+redshift_prepare(redshift_state_t *state, const color_setting_t *setting,
+		 void *frame)
+{
+	int first, last;
+	int r = redshift_selected_crtcs(state, &first, &last);
+	if (r < 0) return -1;
+
+	size_t size = sizeof(color_setting_t);
+	for (int i = first; i < last; i++) {
+		size += 3*state->crtcs[i].ramp_size*sizeof(unsigned short);
+	}
+
+	if (frame == nullptr) return size;
+
+	::memcpy(frame, setting, sizeof(color_setting_t));
+	unsigned short *gamma_ramps = (unsigned short *)
+		((char *)frame + sizeof(color_setting_t));
+
+	for (int i = first; i < last; i++) {
+		if (!state->crtcs[i].ctm) {
+			r = redshift_fill_ramps_for_crtc(state, i, setting,
+							 gamma_ramps);
+			if (r < 0) return -1;
+		}
+		gamma_ramps += 3*state->crtcs[i].ramp_size;
+	}
+
+	return size;
+}
+
+/* Queue the requests for a frame computed by redshift_prepare without
+   waiting for replies, and send them with a single flush. */
 int
-redshift_set_temperature(redshift_state_t *state,
-		      const color_setting_t *setting)
+redshift_set_prepared(redshift_state_t *state, const void *frame)
 {
 	int r;
 
-	/* If no CRTC number has been specified,
-	   set temperature on all CRTCs. */
-	if (state->crtc_num < 0) {
-		for (int i = 0; i < state->crtc_count; i++) {
-			r = redshift_set_temperature_for_crtc(state, i,
-							   setting);
+	/* Fail if a previous update was rejected */
+	r = redshift_check_errors(state);
+	if (r < 0) return -1;
+
+	int first, last;
+	r = redshift_selected_crtcs(state, &first, &last);
+	if (r < 0) return -1;
+
+	const color_setting_t *setting = (const color_setting_t *)frame;
+	size_t offset = sizeof(color_setting_t);
+
+	for (int i = first; i < last; i++) {
+		redshift_crtc_state_t *crtc = &state->crtcs[i];
+		unsigned int ramp_size = crtc->ramp_size;
+
+		if (crtc->ctm) {
+			/* The space of this CRTC in the update buffer
+			   is free for the ramps of a gamma change. */
+			unsigned short *scratch = (unsigned short *)
+				((char *)state->frame + offset);
+			r = redshift_queue_ctm_for_crtc(state, i, setting,
+							scratch);
 			if (r < 0) return -1;
+		} else {
+			const unsigned short *gamma_ramps =
+				(const unsigned short *)
+				((const char *)frame + offset);
+
+			/* Queue new gamma ramps */
+			xcb_void_cookie_t gamma_set_cookie =
+				xcb_randr_set_crtc_gamma(
+					state->conn, crtc->crtc, ramp_size,
+					&gamma_ramps[0*ramp_size],
+					&gamma_ramps[1*ramp_size],
+					&gamma_ramps[2*ramp_size]);
+			crtc->sequence = gamma_set_cookie.sequence;
 		}
-	} else {
-		return redshift_set_temperature_for_crtc(state, state->crtc_num,
-						      setting);
+
+		offset += 3*ramp_size*sizeof(unsigned short);
 	}
 
+	/* Send all CRTC updates at once */
+	TRACE_BEGIN_CAT(span, "randr", "xcb_flush");
+	xcb_flush(state->conn);
+	TRACE_END(span);
+
 	return 0;
 }
 
+/* Read the gamma ramps of the adjusted CRTCs back. The server handles
+   requests in order, so the replies arrive only after the queued
+   updates were applied. */
+int
+redshift_readback(redshift_state_t *state)
+{
+	int first, last;
+	int r = redshift_selected_crtcs(state, &first, &last);
+	if (r < 0) return -1;
+
+	xcb_randr_get_crtc_gamma_cookie_t *gamma_cookies =
+		(xcb_randr_get_crtc_gamma_cookie_t *)
+		alloca((last - first)*sizeof(*gamma_cookies));
+	for (int i = first; i < last; i++) {
+		gamma_cookies[i - first] = xcb_randr_get_crtc_gamma(
+			state->conn, state->crtcs[i].crtc);
+	}
+
+	for (int i = first; i < last; i++) {
+		xcb_generic_error_t *error;
+		xcb_randr_get_crtc_gamma_reply_t *gamma_get_reply =
+			xcb_randr_get_crtc_gamma_reply(state->conn,
+						       gamma_cookies[i - first],
+						       &error);
+		if (error) {
+			fprintf(stderr, _("`%s' returned error %d\n"),
+				"redshift Get CRTC Gamma", error->error_code);
+			free(error);
+			r = -1;
+			continue;
+		}
+		free(gamma_get_reply);
+	}
+
+	return r;
+}
+
+int
+redshift_set_temperature(redshift_state_t *state,
+		      const color_setting_t *setting)
+{
+	long r = redshift_prepare(state, setting, state->frame);
+	if (r < 0) return -1;
+
+	return redshift_set_prepared(state, state->frame);
+}
+
 
 
 //redshift_state_t * redshift_alloc()
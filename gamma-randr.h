@@ -31,6 +31,8 @@
 
 #include "redshift/_.h"
 #include "redshift/redshift.h"
+#include "colorramp.h"
+#include "gamma-randr-fake.h"
 //#include "__standard_type.h"
 
 
@@ -38,17 +40,46 @@ typedef struct {
 	xcb_randr_crtc_t crtc;
 	unsigned int ramp_size;
 	unsigned short *saved_ramps;
+	/* Sequence number of the last queued Set CRTC Gamma request,
+	   used to attribute asynchronous errors. */
+	unsigned int sequence;
+	/* Non-zero if every output of the CRTC has a CTM property */
+	int ctm;
+	/* Gamma of the curve currently in the gamma ramps (CTM mode) */
+	float ramp_gamma[3];
+	/* Ramps scaled for each update */
+	colorramp_curve_t curve;
 } redshift_crtc_state_t;
 
+typedef struct {
+	xcb_randr_output_t output;
+	int crtc_num;
+	/* CTM before start, nine S31.32 values as 32-bit halves */
+	uint32_t saved_ctm[18];
+} redshift_output_state_t;
+
 typedef struct _REDSHIFT_STATE {
 	xcb_connection_t *conn;
 	xcb_screen_t *screen;
 	int preferred_screen;
 	int preserve;
+	/* Take saved ramps from the snapshot when it has them */
+	int snapshot;
 	int screen_num;
 	int crtc_num;
 	unsigned int crtc_count;
 	redshift_crtc_state_t *crtcs;
+	/* One update: the setting followed by the ramps of all CRTCs,
+	   back to back */
+	void *frame;
+	/* Color transformation matrix mode */
+	int ctm;
+	xcb_atom_t ctm_atom;
+	unsigned int output_count;
+	redshift_output_state_t *outputs;
+	/* Fake X server used instead of the display, if any */
+	randr_fake_config_t fake;
+	randr_fake_t *fake_server;
 } redshift_state_t;
 
 
@@ -62,6 +93,11 @@ int redshift_set_option(redshift_state_t *state, const char * key, const char *
 void redshift_restore(redshift_state_t *state);
 int redshift_set_temperature(redshift_state_t *state,
 			  const color_setting_t *setting);
+int redshift_revalidate(redshift_state_t *state);
+long redshift_prepare(redshift_state_t *state,
+		      const color_setting_t *setting, void *frame);
+int redshift_set_prepared(redshift_state_t *state, const void *frame);
+int redshift_readback(redshift_state_t *state);
 
 
 #endif /* ! REDSHIFT_GAMMA_redshift_H */
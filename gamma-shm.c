@@ -0,0 +1,267 @@
+/* gamma-shm.c -- Shared memory gamma publisher source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#include "gamma-shm.h"
+#include "colorramp.h"
+
+
+int
+shm_init(shm_state_t *state)
+{
+	state->name = NULL;
+	state->output_count = 1;
+	state->ramp_size = SHM_DEFAULT_RAMP_SIZE;
+
+	state->fd = -1;
+	state->size = 0;
+	state->header = NULL;
+	colorramp_curve_init(&state->curve);
+
+	return 0;
+}
+
+/* Wake readers blocked on the sequence. */
+static void
+shm_wake(shm_state_t *state)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &state->header->sequence, FUTEX_WAKE, INT_MAX,
+		NULL, NULL, 0);
+#endif
+}
+
+int
+shm_start(shm_state_t *state)
+{
+	const char *name = state->name != NULL ?
+		state->name : SHM_DEFAULT_NAME;
+
+	state->fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (state->fd < 0) {
+		perror("shm_open");
+		return -1;
+	}
+
+	state->size = sizeof(shm_header_t) +
+		3*state->output_count*state->ramp_size*sizeof(uint16_t);
+
+	if (ftruncate(state->fd, state->size) < 0) {
+		perror("ftruncate");
+		close(state->fd);
+		state->fd = -1;
+		return -1;
+	}
+
+	void *mem = mmap(NULL, state->size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, state->fd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		close(state->fd);
+		state->fd = -1;
+		return -1;
+	}
+	state->header = (shm_header_t *)mem;
+
+	/* Readers check the magic and layout only once the
+	   sequence is even, so an update has been published. */
+	shm_header_t *header = state->header;
+	uint32_t sequence = __atomic_load_n(&header->sequence,
+					    __ATOMIC_RELAXED);
+	if (sequence % 2 == 0) sequence++;
+	__atomic_store_n(&header->sequence, sequence, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	header->magic = SHM_MAGIC;
+	header->version = SHM_VERSION;
+	header->output_count = state->output_count;
+	header->ramp_size = state->ramp_size;
+	header->active = 1;
+
+	color_setting_t neutral = { 6500, { 1.0, 1.0, 1.0 }, 1.0 };
+	return shm_set_temperature(state, &neutral);
+}
+
+void
+shm_restore(shm_state_t *state)
+{
+	/* Publish the neutral setting so readers stop adjusting */
+	color_setting_t neutral = { 6500, { 1.0, 1.0, 1.0 }, 1.0 };
+	shm_set_temperature(state, &neutral);
+}
+
+void
+shm_free(shm_state_t *state)
+{
+	if (state->header != NULL) {
+		__atomic_store_n(&state->header->active, 0,
+				 __ATOMIC_RELEASE);
+		__atomic_add_fetch(&state->header->sequence, 2,
+				   __ATOMIC_RELEASE);
+		shm_wake(state);
+
+		munmap(state->header, state->size);
+		state->header = NULL;
+	}
+
+	/* Readers that still have the segment mapped keep it,
+	   new readers do not find a stale one. */
+	if (state->fd >= 0) {
+		close(state->fd);
+		state->fd = -1;
+		shm_unlink(state->name != NULL ?
+			   state->name : SHM_DEFAULT_NAME);
+	}
+
+	free(state->name);
+	state->name = NULL;
+	colorramp_curve_free(&state->curve);
+}
+
+void
+shm_print_help(FILE *f)
+{
+	fputs(_("Publish the gamma ramps in shared memory for other"
+		" programs instead of adjusting a display.\n"), f);
+	fputs("\n", f);
+
+	/* TRANSLATORS: shared memory help output
+	   left column must not be translated */
+	fputs(_("  name=NAME\tName of the shared memory segment\n"
+		"  outputs=N\tNumber of outputs to publish ramps for\n"
+		"  ramp-size=N\tNumber of entries per ramp\n"), f);
+	fputs("\n", f);
+}
+
+int
+shm_set_option(shm_state_t *state, const char *key, const char *value)
+{
+	if (strcasecmp(key, "name") == 0) {
+		if (value[0] != '/' || strchr(value + 1, '/') != NULL) {
+			fputs(_("Shared memory name must start with a slash"
+				" and contain no other.\n"), stderr);
+			return -1;
+		}
+		free(state->name);
+		state->name = strdup(value);
+		if (state->name == NULL) {
+			perror("strdup");
+			return -1;
+		}
+	} else if (strcasecmp(key, "outputs") == 0) {
+		state->output_count = atoi(value);
+		if (state->output_count < 1) {
+			fputs(_("Number of outputs must be positive.\n"),
+			      stderr);
+			return -1;
+		}
+	} else if (strcasecmp(key, "ramp-size") == 0) {
+		state->ramp_size = atoi(value);
+		if (state->ramp_size < 2 || state->ramp_size > 65536) {
+			fputs(_("Ramp size must be between 2 and"
+				" 65536.\n"), stderr);
+			return -1;
+		}
+	} else {
+		fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+shm_set_temperature(shm_state_t *state, const color_setting_t *setting)
+{
+	shm_header_t *header = state->header;
+	int ramp_size = state->ramp_size;
+	uint16_t *ramps = (uint16_t *)(header + 1);
+
+	/* Compute the curve outside of the write section to keep it
+	   short, in the ramps of the first output. */
+	if (!colorramp_curve_matches(&state->curve, ramp_size, setting)) {
+		uint16_t *pure = (uint16_t *)malloc(3*ramp_size*
+						    sizeof(uint16_t));
+		if (pure == NULL) {
+			perror("malloc");
+			return -1;
+		}
+
+		/* Initialize gamma ramps to pure state */
+		for (int i = 0; i < ramp_size; i++) {
+			uint16_t value = (double)i/ramp_size * (UINT16_MAX+1);
+			pure[i] = value;
+			pure[ramp_size + i] = value;
+			pure[2*ramp_size + i] = value;
+		}
+
+		int r = colorramp_curve_update(&state->curve, &pure[0],
+					       &pure[ramp_size],
+					       &pure[2*ramp_size],
+					       ramp_size, setting);
+		free(pure);
+		if (r < 0) {
+			perror("malloc");
+			return -1;
+		}
+	}
+
+	/* Enter the write section; the sequence becomes odd unless
+	   the segment has not been published yet. */
+	uint32_t sequence = __atomic_load_n(&header->sequence,
+					    __ATOMIC_RELAXED);
+	if (sequence % 2 == 0) {
+		sequence++;
+		__atomic_store_n(&header->sequence, sequence,
+				 __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+
+	header->setting = *setting;
+	for (int i = 0; i < state->output_count; i++) {
+		uint16_t *output = &ramps[3*i*ramp_size];
+		colorramp_curve_fill(&state->curve, &output[0],
+				     &output[ramp_size],
+				     &output[2*ramp_size], setting);
+	}
+
+	/* Publish and wake readers waiting for a change */
+	__atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+	shm_wake(state);
+
+	return 0;
+}
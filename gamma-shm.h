@@ -0,0 +1,75 @@
+/* gamma-shm.h -- Shared memory gamma publisher header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_GAMMA_SHM_H
+#define REDSHIFT_GAMMA_SHM_H
+
+#include <stdint.h>
+
+#include "redshift.h"
+#include "colorramp.h"
+
+#define SHM_DEFAULT_NAME  "/redshift-gamma"
+#define SHM_DEFAULT_RAMP_SIZE  1024
+
+/* "RSHM" */
+#define SHM_MAGIC  0x4d485352
+#define SHM_VERSION  1
+
+/* Start of the shared memory segment. It is followed by the ramps of
+   every output: red, green and blue of RAMP_SIZE 16-bit entries each.
+
+   SEQUENCE is a sequence lock. It is odd while an update is being
+   written. Readers copy what they need, and retry if the sequence was
+   odd before or changed after the copy. The writer never waits for
+   readers. On Linux SEQUENCE is also a futex that is woken after every
+   update, so readers can block on it until something changes. */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sequence;
+	/* Zero once the publisher has exited */
+	uint32_t active;
+	uint32_t output_count;
+	uint32_t ramp_size;
+	color_setting_t setting;
+} shm_header_t;
+
+typedef struct {
+	char *name;
+	int output_count;
+	int ramp_size;
+
+	int fd;
+	size_t size;
+	shm_header_t *header;
+	colorramp_curve_t curve;
+} shm_state_t;
+
+
+int shm_init(shm_state_t *state);
+int shm_start(shm_state_t *state);
+void shm_free(shm_state_t *state);
+
+void shm_print_help(FILE *f);
+int shm_set_option(shm_state_t *state, const char *key, const char *value);
+
+void shm_restore(shm_state_t *state);
+int shm_set_temperature(shm_state_t *state, const color_setting_t *setting);
+
+
+#endif /* ! REDSHIFT_GAMMA_SHM_H */
@@ -0,0 +1,481 @@
+/* gamma-snapshot.cpp -- Persisted snapshot of saved gamma ramps source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "gamma-snapshot.h"
+
+#define MAX_SNAPSHOT_PATH  4096
+
+
+/* Fill SP with the path of the snapshot file and create the directory
+   containing it if CREATE is set. The runtime directory is preferred
+   as it does not outlive the session, and with it the display server
+   that the ramps were read from. Returns -1 if there is no suitable
+   location. */
+static int
+snapshot_path(char *sp, int create)
+{
+	char *env;
+
+	if ((env = getenv("XDG_RUNTIME_DIR")) != nullptr && env[0] != '\0') {
+		snprintf(sp, MAX_SNAPSHOT_PATH, "%s/redshift-ramps", env);
+		return 0;
+	}
+
+	char dir[MAX_SNAPSHOT_PATH - 8];
+	if ((env = getenv("XDG_CACHE_HOME")) != nullptr && env[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/redshift", env);
+	} else if ((env = getenv("HOME")) != nullptr && env[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/.cache/redshift", env);
+	} else {
+		struct passwd *pwd = getpwuid(getuid());
+		if (pwd == nullptr) return -1;
+		snprintf(dir, sizeof(dir), "%s/.cache/redshift", pwd->pw_dir);
+	}
+
+	if (create) {
+		/* Create parent directory first; either may exist. */
+		char *slash = strrchr(dir, '/');
+		if (slash != nullptr) {
+			*slash = '\0';
+			mkdir(dir, 0700);
+			*slash = '/';
+		}
+		mkdir(dir, 0700);
+	}
+
+	snprintf(sp, MAX_SNAPSHOT_PATH, "%s/ramps", dir);
+	return 0;
+}
+
+/* Fill KEY with the key of the display on CONNECTOR of METHOD.
+   EDID may be NULL if the display does not provide one. */
+void
+gamma_snapshot_key(char *key, const char *method, const char *connector,
+		   const void *edid, size_t edid_size)
+{
+	if (edid == nullptr || edid_size == 0) {
+		snprintf(key, GAMMA_SNAPSHOT_KEY_SIZE, "%s:%s", method,
+			 connector);
+		return;
+	}
+
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const uint8_t *data = (const uint8_t *)edid;
+	for (size_t i = 0; i < edid_size; i++) {
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+	}
+
+	snprintf(key, GAMMA_SNAPSHOT_KEY_SIZE, "%s:%s:%016llx", method,
+		 connector, (unsigned long long)hash);
+}
+
+/* Lock the snapshot and map its file. The lock is held until the
+   snapshot is closed, so that the file cannot change in between and
+   concurrent instances do not lose each other's entries. It is taken
+   on a separate file, as commits replace the snapshot file. A
+   missing or invalid file leaves an empty snapshot; this is not an
+   error. */
+int
+gamma_snapshot_open(gamma_snapshot_t *snapshot)
+{
+	snapshot->map = nullptr;
+	snapshot->map_size = 0;
+	snapshot->added = nullptr;
+	snapshot->lock_fd = -1;
+
+	char path[MAX_SNAPSHOT_PATH];
+	char lock_path[MAX_SNAPSHOT_PATH + 8];
+	if (snapshot_path(path, 1) < 0) return 0;
+
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+	snapshot->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC,
+				 0600);
+	if (snapshot->lock_fd >= 0 && flock(snapshot->lock_fd, LOCK_EX) < 0) {
+		close(snapshot->lock_fd);
+		snapshot->lock_fd = -1;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 ||
+	    st.st_size < (off_t)sizeof(gamma_snapshot_header_t)) {
+		close(fd);
+		return 0;
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	const gamma_snapshot_header_t *header =
+		(const gamma_snapshot_header_t *)map;
+	size_t table_size = sizeof(gamma_snapshot_header_t) +
+		(size_t)header->entry_count * sizeof(gamma_snapshot_entry_t);
+	if (header->magic != GAMMA_SNAPSHOT_MAGIC ||
+	    header->version != GAMMA_SNAPSHOT_VERSION ||
+	    table_size > (size_t)st.st_size) {
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	snapshot->map = map;
+	snapshot->map_size = st.st_size;
+
+	return 0;
+}
+
+void
+gamma_snapshot_close(gamma_snapshot_t *snapshot)
+{
+	if (snapshot->map != nullptr) {
+		munmap(snapshot->map, snapshot->map_size);
+		snapshot->map = nullptr;
+	}
+
+	while (snapshot->added != nullptr) {
+		gamma_snapshot_added_t *added = snapshot->added;
+		snapshot->added = added->next;
+		free(added->ramps);
+		free(added);
+	}
+
+	if (snapshot->lock_fd >= 0) {
+		close(snapshot->lock_fd);
+		snapshot->lock_fd = -1;
+	}
+}
+
+/* Entries of the mapped file */
+static const gamma_snapshot_entry_t *
+snapshot_entries(const gamma_snapshot_t *snapshot, unsigned int *count)
+{
+	if (snapshot->map == nullptr) {
+		*count = 0;
+		return nullptr;
+	}
+
+	const gamma_snapshot_header_t *header =
+		(const gamma_snapshot_header_t *)snapshot->map;
+	*count = header->entry_count;
+	return (const gamma_snapshot_entry_t *)(header + 1);
+}
+
+/* Ramps of ENTRY in the mapped file, or NULL if it points outside. */
+static const uint16_t *
+snapshot_entry_ramps(const gamma_snapshot_t *snapshot,
+		     const gamma_snapshot_entry_t *entry)
+{
+	size_t size = 3*(size_t)entry->ramp_size*sizeof(uint16_t);
+	if (entry->offset % sizeof(uint16_t) != 0 ||
+	    entry->offset > snapshot->map_size ||
+	    size > snapshot->map_size - entry->offset) {
+		return nullptr;
+	}
+
+	return (const uint16_t *)((const char *)snapshot->map +
+				  entry->offset);
+}
+
+/* Return the saved ramps of the display with KEY, or NULL if there
+   are none of RAMP_SIZE entries. The ramps stay valid until the
+   snapshot is closed. */
+const uint16_t *
+gamma_snapshot_find(const gamma_snapshot_t *snapshot, const char *key,
+		    unsigned int ramp_size)
+{
+	unsigned int count;
+	const gamma_snapshot_entry_t *entries =
+		snapshot_entries(snapshot, &count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		const gamma_snapshot_entry_t *entry = &entries[i];
+		if (strncmp(entry->key, key, GAMMA_SNAPSHOT_KEY_SIZE) != 0 ||
+		    entry->ramp_size != ramp_size) {
+			continue;
+		}
+
+		return snapshot_entry_ramps(snapshot, entry);
+	}
+
+	return nullptr;
+}
+
+/* Add the ramps of the display with KEY, to be written by the next
+   commit. RAMPS holds red, green and blue back to back. */
+int
+gamma_snapshot_add(gamma_snapshot_t *snapshot, const char *key,
+		   const uint16_t *ramps, unsigned int ramp_size)
+{
+	gamma_snapshot_added_t *added = (gamma_snapshot_added_t *)
+		calloc(1, sizeof(gamma_snapshot_added_t));
+	if (added == nullptr) return -1;
+
+	size_t size = 3*(size_t)ramp_size*sizeof(uint16_t);
+	added->ramps = (uint16_t *)malloc(size);
+	if (added->ramps == nullptr) {
+		free(added);
+		return -1;
+	}
+
+	::memcpy(added->ramps, ramps, size);
+	strncpy(added->entry.key, key, GAMMA_SNAPSHOT_KEY_SIZE - 1);
+	added->entry.ramp_size = ramp_size;
+	added->entry.pid = (uint32_t)getpid();
+
+	added->next = snapshot->added;
+	snapshot->added = added;
+
+	return 0;
+}
+
+/* Drop the ramps of the display with KEY with the next commit. */
+int
+gamma_snapshot_remove(gamma_snapshot_t *snapshot, const char *key)
+{
+	gamma_snapshot_added_t *added = (gamma_snapshot_added_t *)
+		calloc(1, sizeof(gamma_snapshot_added_t));
+	if (added == nullptr) return -1;
+
+	/* An entry without ramps marks the removal */
+	strncpy(added->entry.key, key, GAMMA_SNAPSHOT_KEY_SIZE - 1);
+
+	added->next = snapshot->added;
+	snapshot->added = added;
+
+	return 0;
+}
+
+/* Check whether the entry of KEY belongs to another instance of
+   redshift that is still running. The ramps are then valid, but
+   remain owned by that instance. Otherwise the entry was left by an
+   instance that did not exit cleanly, and should be taken over by
+   adding it again. */
+int
+gamma_snapshot_in_use(const gamma_snapshot_t *snapshot, const char *key)
+{
+	unsigned int count;
+	const gamma_snapshot_entry_t *entries =
+		snapshot_entries(snapshot, &count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (strncmp(entries[i].key, key,
+			    GAMMA_SNAPSHOT_KEY_SIZE) != 0) {
+			continue;
+		}
+
+		pid_t pid = (pid_t)entries[i].pid;
+		if (pid <= 0 || pid == getpid()) return 0;
+		return kill(pid, 0) == 0 || errno == EPERM;
+	}
+
+	return 0;
+}
+
+/* Drop the entries of METHOD that this process owns. Called when the
+   method is freed, on every clean exit, whether or not the ramps were
+   restored: the display may be adjusted, or load another calibration,
+   before redshift runs again. An entry left in the file thus means
+   its owner did not exit cleanly. */
+int
+gamma_snapshot_release(const char *method)
+{
+	gamma_snapshot_t snapshot;
+	gamma_snapshot_open(&snapshot);
+
+	size_t method_len = strlen(method);
+	unsigned int count;
+	const gamma_snapshot_entry_t *entries =
+		snapshot_entries(&snapshot, &count);
+
+	int r = 0;
+	for (unsigned int i = 0; r == 0 && i < count; i++) {
+		const gamma_snapshot_entry_t *entry = &entries[i];
+		if (entry->pid != (uint32_t)getpid() ||
+		    strncmp(entry->key, method, method_len) != 0 ||
+		    entry->key[method_len] != ':') {
+			continue;
+		}
+
+		r = gamma_snapshot_remove(&snapshot, entry->key);
+	}
+
+	if (r == 0) r = gamma_snapshot_commit(&snapshot);
+	gamma_snapshot_close(&snapshot);
+
+	return r;
+}
+
+/* Check whether KEY was added or removed since the snapshot was
+   opened. */
+static int
+snapshot_is_added(const gamma_snapshot_t *snapshot, const char *key)
+{
+	const gamma_snapshot_added_t *added = snapshot->added;
+	for (; added != nullptr; added = added->next) {
+		if (strncmp(added->entry.key, key,
+			    GAMMA_SNAPSHOT_KEY_SIZE) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Write the snapshot to F and return the number of entries. */
+static int
+snapshot_write(FILE *f, const gamma_snapshot_t *snapshot)
+{
+	unsigned int old_count;
+	const gamma_snapshot_entry_t *old =
+		snapshot_entries(snapshot, &old_count);
+
+	/* Keep entries of other displays, replacing those added again */
+	gamma_snapshot_header_t header = {
+		GAMMA_SNAPSHOT_MAGIC, GAMMA_SNAPSHOT_VERSION, 0, 0
+	};
+	for (unsigned int i = 0; i < old_count; i++) {
+		if (snapshot_is_added(snapshot, old[i].key) ||
+		    snapshot_entry_ramps(snapshot, &old[i]) == nullptr) {
+			continue;
+		}
+		header.entry_count += 1;
+	}
+
+	const gamma_snapshot_added_t *added = snapshot->added;
+	for (; added != nullptr; added = added->next) {
+		if (added->ramps != nullptr) header.entry_count += 1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1) return -1;
+
+	size_t offset = sizeof(header) +
+		header.entry_count*sizeof(gamma_snapshot_entry_t);
+
+	/* Entry table */
+	for (int pass = 0; pass < 2; pass++) {
+		for (unsigned int i = 0; i < old_count; i++) {
+			if (snapshot_is_added(snapshot, old[i].key) ||
+			    snapshot_entry_ramps(snapshot, &old[i]) ==
+			    nullptr) {
+				continue;
+			}
+
+			if (pass == 0) {
+				gamma_snapshot_entry_t entry = old[i];
+				entry.offset = offset;
+				if (fwrite(&entry, sizeof(entry), 1, f) != 1) {
+					return -1;
+				}
+			} else {
+				const uint16_t *ramps =
+					snapshot_entry_ramps(snapshot, &old[i]);
+				if (fwrite(ramps, sizeof(uint16_t),
+					   3*old[i].ramp_size, f) !=
+				    3*old[i].ramp_size) {
+					return -1;
+				}
+			}
+			offset += 3*(size_t)old[i].ramp_size*sizeof(uint16_t);
+		}
+
+		for (added = snapshot->added; added != nullptr;
+		     added = added->next) {
+			if (added->ramps == nullptr) continue;
+
+			unsigned int ramp_size = added->entry.ramp_size;
+			if (pass == 0) {
+				gamma_snapshot_entry_t entry = added->entry;
+				entry.offset = offset;
+				if (fwrite(&entry, sizeof(entry), 1, f) != 1) {
+					return -1;
+				}
+			} else if (fwrite(added->ramps, sizeof(uint16_t),
+					  3*ramp_size, f) != 3*ramp_size) {
+				return -1;
+			}
+			offset += 3*(size_t)ramp_size*sizeof(uint16_t);
+		}
+
+		/* Ramps follow the table in the same order */
+		offset = sizeof(header) +
+			header.entry_count*sizeof(gamma_snapshot_entry_t);
+	}
+
+	return header.entry_count;
+}
+
+/* Write the snapshot with the entries added or removed since it was
+   opened. The file is replaced atomically so a crash never leaves a
+   truncated snapshot behind, and is deleted once no entries are left.
+   Does nothing if no entries were added or removed. */
+int
+gamma_snapshot_commit(gamma_snapshot_t *snapshot)
+{
+	if (snapshot->added == nullptr) return 0;
+
+	char path[MAX_SNAPSHOT_PATH];
+	char tmp_path[MAX_SNAPSHOT_PATH + 16];
+	if (snapshot_path(path, 1) < 0) return -1;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	/* The temporary file gets a name nobody else can predict, and
+	   is only readable by the user like the snapshot itself. */
+	int fd = mkstemp(tmp_path);
+	if (fd < 0) return -1;
+
+	FILE *f = nullptr;
+	if (fchmod(fd, 0600) < 0 || (f = fdopen(fd, "wb")) == nullptr) {
+		close(fd);
+		remove(tmp_path);
+		return -1;
+	}
+
+	int r = snapshot_write(f, snapshot);
+	if (fclose(f) != 0) r = -1;
+
+	if (r == 0) {
+		remove(tmp_path);
+		if (remove(path) < 0 && errno != ENOENT) return -1;
+		return 0;
+	}
+
+	if (r < 0 || rename(tmp_path, path) < 0) {
+		remove(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
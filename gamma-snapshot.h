@@ -0,0 +1,94 @@
+/* gamma-snapshot.h -- Persisted snapshot of saved gamma ramps header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_GAMMA_SNAPSHOT_H
+#define REDSHIFT_GAMMA_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* File format.
+   The file holds the ramps of every display as they were before
+   redshift first adjusted it, until the redshift instance that
+   read them exits cleanly. It is a gamma_snapshot_header_t,
+   followed by `entry_count' entries and then the ramps they point
+   to: red, green and blue, each `ramp_size' 16-bit values. All
+   fields are in host byte order, and the ramps are aligned so the
+   file can be used in place once mapped. */
+#define GAMMA_SNAPSHOT_MAGIC     0x50534752 /* "RGSP" */
+#define GAMMA_SNAPSHOT_VERSION   2
+
+#define GAMMA_SNAPSHOT_KEY_SIZE  64
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t reserved;
+} gamma_snapshot_header_t;
+
+/* Displays are identified by method, connector and a hash of the
+   EDID, so a different monitor on the same connector does not get
+   the ramps of the previous one. */
+typedef struct {
+	char key[GAMMA_SNAPSHOT_KEY_SIZE];
+	uint32_t ramp_size;
+	/* Offset of the ramps from the start of the file */
+	uint32_t offset;
+	/* Process of the redshift instance that owns the entry */
+	uint32_t pid;
+} gamma_snapshot_entry_t;
+
+typedef struct _GAMMA_SNAPSHOT_ADDED {
+	struct _GAMMA_SNAPSHOT_ADDED *next;
+	gamma_snapshot_entry_t entry;
+	uint16_t *ramps;
+} gamma_snapshot_added_t;
+
+typedef struct {
+	/* Mapped snapshot file, or NULL if there is none */
+	void *map;
+	size_t map_size;
+	/* Entries to be written by gamma_snapshot_commit, or removed
+	   if they have no ramps */
+	gamma_snapshot_added_t *added;
+	/* Lock file held while the snapshot is open, or -1 */
+	int lock_fd;
+} gamma_snapshot_t;
+
+
+void gamma_snapshot_key(char *key, const char *method,
+			const char *connector,
+			const void *edid, size_t edid_size);
+
+int gamma_snapshot_open(gamma_snapshot_t *snapshot);
+void gamma_snapshot_close(gamma_snapshot_t *snapshot);
+
+const uint16_t *gamma_snapshot_find(const gamma_snapshot_t *snapshot,
+				    const char *key,
+				    unsigned int ramp_size);
+int gamma_snapshot_add(gamma_snapshot_t *snapshot, const char *key,
+		       const uint16_t *ramps, unsigned int ramp_size);
+int gamma_snapshot_in_use(const gamma_snapshot_t *snapshot,
+			  const char *key);
+int gamma_snapshot_remove(gamma_snapshot_t *snapshot, const char *key);
+int gamma_snapshot_commit(gamma_snapshot_t *snapshot);
+
+int gamma_snapshot_release(const char *method);
+
+
+#endif /* ! REDSHIFT_GAMMA_SNAPSHOT_H */
@@ -35,6 +35,7 @@
 #include "gamma-vidmode.h"
 #include "redshift.h"
 #include "colorramp.h"
+#include "trace.h"
 
 
 int
@@ -206,9 +207,11 @@ vidmode_set_temperature(vidmode_state_t *state,
 		       setting);
 
 	/* Set new gamma ramps */
+	TRACE_BEGIN_CAT(span, "vidmode", "XF86VidModeSetGammaRamp");
 	r = XF86VidModeSetGammaRamp(state->display, state->screen_num,
 				    state->ramp_size, gamma_r, gamma_g,
 				    gamma_b);
+	TRACE_END(span);
 	if (!r) {
 		fprintf(stderr, _("X request failed: %s\n"),
 			"XF86VidModeSetGammaRamp");
@@ -201,8 +201,7 @@ redshift_set_temperature(redshift_state_t *state,
       }
    }
 
-   colorramp_fill(gamma_r, gamma_g, gamma_b, GAMMA_RAMP_SIZE,
-                  setting);
+   colorramp_fill<GAMMA_RAMP_SIZE>(gamma_r, gamma_g, gamma_b, setting);
 
    /* Set new gamma ramps */
    r = SetDeviceGammaRamp(hDC, gamma_ramps);
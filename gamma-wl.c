@@ -0,0 +1,426 @@
+/* gamma-wl.c -- Wayland gamma adjustment source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* For memfd_create and file seals */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#include "gamma-wl.h"
+#include "colorramp.h"
+#include "trace.h"
+#include "metrics.h"
+#include "wlr-gamma-control-unstable-v1-client-protocol.h"
+
+
+int
+wayland_init(wayland_state_t *state)
+{
+	/* Initialize state. */
+	state->display = NULL;
+	state->registry = NULL;
+	state->gamma_control_manager_id = 0;
+	state->gamma_control_manager = NULL;
+	state->output_count = 0;
+	state->outputs = NULL;
+	state->have_setting = 0;
+	state->pending_sync = 0;
+
+	return 0;
+}
+
+/* Create the memfd the ramps of OUTPUT are written to. The compositor
+   maps the same file, so the ramps are never copied on our side. It
+   is sealed against resizing since the compositor relies on its
+   size, and reused for every update. */
+static int
+wayland_output_map(wayland_output_t *output)
+{
+	size_t size = 3*output->ramp_size*sizeof(uint16_t);
+
+	int fd = memfd_create("redshift-gamma", MFD_CLOEXEC |
+			      MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		perror("memfd_create");
+		return -1;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+
+	void *ramps = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+	if (ramps == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	output->fd = fd;
+	output->ramps = (uint16_t *)ramps;
+
+	return 0;
+}
+
+static void
+wayland_output_unmap(wayland_output_t *output)
+{
+	if (output->ramps != NULL) {
+		munmap(output->ramps,
+		       3*output->ramp_size*sizeof(uint16_t));
+		output->ramps = NULL;
+	}
+	if (output->fd >= 0) {
+		close(output->fd);
+		output->fd = -1;
+	}
+}
+
+/* Write the ramps for SETTING to the memfd of OUTPUT and hand it to
+   the compositor. */
+static void
+wayland_output_apply(wayland_output_t *output,
+		     const color_setting_t *setting)
+{
+	if (output->gamma_control == NULL || output->ramps == NULL) return;
+
+	uint32_t ramp_size = output->ramp_size;
+	uint16_t *r_gamma = output->ramps;
+	uint16_t *g_gamma = r_gamma + ramp_size;
+	uint16_t *b_gamma = g_gamma + ramp_size;
+
+	/* The curve only changes with the gamma */
+	if (!colorramp_curve_matches(&output->curve, ramp_size, setting)) {
+		/* Initialize gamma ramps to pure state */
+		for (uint32_t i = 0; i < ramp_size; i++) {
+			uint16_t value = (double)i/ramp_size * (UINT16_MAX+1);
+			r_gamma[i] = value;
+			g_gamma[i] = value;
+			b_gamma[i] = value;
+		}
+
+		int r = colorramp_curve_update(&output->curve, r_gamma,
+					       g_gamma, b_gamma, ramp_size,
+					       setting);
+		if (r < 0) {
+			fprintf(stderr, "malloc");
+			return;
+		}
+	}
+
+	colorramp_curve_fill(&output->curve, r_gamma, g_gamma, b_gamma,
+			     setting);
+
+	/* The compositor reads from the current file offset */
+	lseek(output->fd, 0, SEEK_SET);
+	zwlr_gamma_control_v1_set_gamma(output->gamma_control, output->fd);
+}
+
+static void
+gamma_control_handle_gamma_size(void *data,
+				struct zwlr_gamma_control_v1 *gamma_control,
+				uint32_t size)
+{
+	wayland_output_t *output = (wayland_output_t *)data;
+
+	wayland_output_unmap(output);
+	output->ramp_size = size;
+	if (size == 0) return;
+
+	if (wayland_output_map(output) < 0) {
+		output->ramp_size = 0;
+		return;
+	}
+
+	/* An output that was plugged in after the first update
+	   gets the current setting right away. */
+	wayland_state_t *state = output->state;
+	if (state->have_setting) {
+		wayland_output_apply(output, &state->setting);
+		state->pending_sync = 1;
+	}
+}
+
+static void
+gamma_control_handle_failed(void *data,
+			    struct zwlr_gamma_control_v1 *gamma_control)
+{
+	wayland_output_t *output = (wayland_output_t *)data;
+
+	fprintf(stderr, _("Gamma control of Wayland output %u failed;"
+			  " another client may be adjusting it.\n"),
+		output->global_id);
+
+	zwlr_gamma_control_v1_destroy(output->gamma_control);
+	output->gamma_control = NULL;
+	wayland_output_unmap(output);
+	output->ramp_size = 0;
+}
+
+static const struct zwlr_gamma_control_v1_listener gamma_control_listener = {
+	gamma_control_handle_gamma_size,
+	gamma_control_handle_failed
+};
+
+/* Request exclusive gamma control of OUTPUT. The compositor answers
+   with the ramp size. */
+static void
+wayland_output_control(wayland_state_t *state, wayland_output_t *output)
+{
+	output->gamma_control =
+		zwlr_gamma_control_manager_v1_get_gamma_control(
+			state->gamma_control_manager, output->output);
+	zwlr_gamma_control_v1_add_listener(output->gamma_control,
+					   &gamma_control_listener, output);
+}
+
+static void
+wayland_output_destroy(wayland_output_t *output)
+{
+	if (output->gamma_control != NULL) {
+		zwlr_gamma_control_v1_destroy(output->gamma_control);
+	}
+	wl_output_destroy(output->output);
+	wayland_output_unmap(output);
+	colorramp_curve_free(&output->curve);
+	free(output);
+}
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	wayland_state_t *state = (wayland_state_t *)data;
+
+	if (strcmp(interface,
+		   zwlr_gamma_control_manager_v1_interface.name) == 0) {
+		state->gamma_control_manager_id = id;
+		state->gamma_control_manager =
+			(struct zwlr_gamma_control_manager_v1 *)
+			wl_registry_bind(registry, id,
+				&zwlr_gamma_control_manager_v1_interface, 1);
+	} else if (strcmp(interface, wl_output_interface.name) == 0) {
+		wayland_output_t **outputs = (wayland_output_t **)
+			realloc(state->outputs, (state->output_count + 1)*
+				sizeof(wayland_output_t *));
+		if (outputs == NULL) {
+			fprintf(stderr, "realloc");
+			return;
+		}
+		state->outputs = outputs;
+
+		wayland_output_t *output = (wayland_output_t *)
+			malloc(sizeof(wayland_output_t));
+		if (output == NULL) {
+			fprintf(stderr, "malloc");
+			return;
+		}
+
+		output->state = state;
+		output->global_id = id;
+		output->output = (struct wl_output *)
+			wl_registry_bind(registry, id,
+					 &wl_output_interface, 1);
+		output->gamma_control = NULL;
+		output->ramp_size = 0;
+		output->fd = -1;
+		output->ramps = NULL;
+		colorramp_curve_init(&output->curve);
+
+		state->outputs[state->output_count++] = output;
+
+		/* Outputs plugged in later are controlled right away,
+		   the initial ones once the manager is known. */
+		if (state->gamma_control_manager != NULL) {
+			wayland_output_control(state, output);
+		}
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t id)
+{
+	wayland_state_t *state = (wayland_state_t *)data;
+
+	for (int i = 0; i < state->output_count; i++) {
+		if (state->outputs[i]->global_id != id) continue;
+
+		wayland_output_destroy(state->outputs[i]);
+		state->outputs[i] = state->outputs[--state->output_count];
+		return;
+	}
+
+	if (id == state->gamma_control_manager_id) {
+		fputs(_("The compositor no longer supports gamma"
+			" control.\n"), stderr);
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+int
+wayland_start(wayland_state_t *state)
+{
+	state->display = wl_display_connect(NULL);
+	if (state->display == NULL) {
+		fputs(_("Could not connect to Wayland display.\n"), stderr);
+		return -1;
+	}
+
+	state->registry = wl_display_get_registry(state->display);
+	wl_registry_add_listener(state->registry, &registry_listener, state);
+
+	/* Collect the globals */
+	if (wl_display_roundtrip(state->display) < 0) {
+		fputs(_("Wayland display roundtrip failed.\n"), stderr);
+		return -1;
+	}
+
+	if (state->gamma_control_manager == NULL) {
+		fputs(_("The compositor does not support"
+			" wlr-gamma-control.\n"), stderr);
+		return -1;
+	}
+
+	for (int i = 0; i < state->output_count; i++) {
+		if (state->outputs[i]->gamma_control == NULL) {
+			wayland_output_control(state, state->outputs[i]);
+		}
+	}
+
+	/* Receive the ramp sizes */
+	if (wl_display_roundtrip(state->display) < 0) {
+		fputs(_("Wayland display roundtrip failed.\n"), stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+wayland_restore(wayland_state_t *state)
+{
+	/* The compositor restores the original gamma ramps
+	   when the gamma control is released. */
+	for (int i = 0; i < state->output_count; i++) {
+		wayland_output_t *output = state->outputs[i];
+		if (output->gamma_control != NULL) {
+			zwlr_gamma_control_v1_destroy(output->gamma_control);
+			output->gamma_control = NULL;
+		}
+	}
+	state->have_setting = 0;
+
+	wl_display_roundtrip(state->display);
+}
+
+void
+wayland_free(wayland_state_t *state)
+{
+	for (int i = 0; i < state->output_count; i++) {
+		wayland_output_destroy(state->outputs[i]);
+	}
+	free(state->outputs);
+	state->outputs = NULL;
+	state->output_count = 0;
+
+	if (state->gamma_control_manager != NULL) {
+		zwlr_gamma_control_manager_v1_destroy(
+			state->gamma_control_manager);
+		state->gamma_control_manager = NULL;
+	}
+	if (state->registry != NULL) {
+		wl_registry_destroy(state->registry);
+		state->registry = NULL;
+	}
+	if (state->display != NULL) {
+		wl_display_disconnect(state->display);
+		state->display = NULL;
+	}
+}
+
+void
+wayland_print_help(FILE *f)
+{
+	fputs(_("Adjust gamma ramps with the wlr-gamma-control protocol"
+		" of Wayland compositors.\n"), f);
+	fputs("\n", f);
+}
+
+int
+wayland_set_option(wayland_state_t *state, const char *key,
+		   const char *value)
+{
+	fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
+	return -1;
+}
+
+int
+wayland_set_temperature(wayland_state_t *state,
+			const color_setting_t *setting)
+{
+	int r;
+
+	state->setting = *setting;
+	state->have_setting = 1;
+
+	for (int i = 0; i < state->output_count; i++) {
+		wayland_output_apply(state->outputs[i], setting);
+	}
+
+	/* The ramps are written in place, so wait until the compositor
+	   has read them before they can be overwritten. This also picks
+	   up outputs that were plugged in or removed meanwhile. */
+	do {
+		state->pending_sync = 0;
+		TRACE_BEGIN_CAT(span, "wayland", "wl_display_roundtrip");
+		r = wl_display_roundtrip(state->display);
+		TRACE_END(span);
+		metrics_count(METRIC_ROUND_TRIPS);
+		if (r < 0) {
+			fputs(_("Lost connection to the Wayland"
+				" compositor.\n"), stderr);
+			return -1;
+		}
+	} while (state->pending_sync);
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+/* gamma-wl.h -- Wayland gamma adjustment header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_GAMMA_WL_H
+#define REDSHIFT_GAMMA_WL_H
+
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "redshift.h"
+#include "colorramp.h"
+
+
+struct _WAYLAND_STATE;
+
+typedef struct {
+	struct _WAYLAND_STATE *state;
+	uint32_t global_id;
+	struct wl_output *output;
+	struct zwlr_gamma_control_v1 *gamma_control;
+	/* Ramp size, or zero until the compositor announced it */
+	uint32_t ramp_size;
+	/* Sealed memfd holding the ramps, mapped at ramps */
+	int fd;
+	uint16_t *ramps;
+	/* Ramps scaled for each update */
+	colorramp_curve_t curve;
+} wayland_output_t;
+
+typedef struct _WAYLAND_STATE {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	uint32_t gamma_control_manager_id;
+	struct zwlr_gamma_control_manager_v1 *gamma_control_manager;
+	int output_count;
+	wayland_output_t **outputs;
+
+	/* Last setting applied, for outputs added later */
+	color_setting_t setting;
+	int have_setting;
+	/* Ramps were sent while handling events */
+	int pending_sync;
+} wayland_state_t;
+
+
+int wayland_init(wayland_state_t *state);
+int wayland_start(wayland_state_t *state);
+void wayland_free(wayland_state_t *state);
+
+void wayland_print_help(FILE *f);
+int wayland_set_option(wayland_state_t *state, const char *key,
+		       const char *value);
+
+void wayland_restore(wayland_state_t *state);
+int wayland_set_temperature(wayland_state_t *state,
+			    const color_setting_t *setting);
+
+
+#endif /* ! REDSHIFT_GAMMA_WL_H */
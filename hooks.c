@@ -28,6 +28,7 @@
 
 #include "hooks.h"
 #include "redshift.h"
+#include "metrics.h"
 
 #define MAX_HOOK_PATH  4096
 
@@ -95,6 +96,7 @@ hooks_signal_period_change(period_t prev_period, period_t period)
 		pid_t pid = fork();
 		if (pid == (pid_t)-1) {
 			fprintf(stderr, "fork");
+			metrics_count(METRIC_HOOK_FAILURES);
 			continue;
 		} else if (pid == 0) { /* Child */
 			close(STDOUT_FILENO);
@@ -108,6 +110,8 @@ hooks_signal_period_change(period_t prev_period, period_t period)
 			/* Only reached on error */
 			_exit(EXIT_FAILURE);
 		}
+
+		metrics_count(METRIC_HOOK_SPAWNS);
 #endif
 	}
 }
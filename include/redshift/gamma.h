@@ -4,6 +4,8 @@
 
 #include "_.h"
 
+#include <stddef.h>
+
 
 typedef struct _REDSHIFT_STATE redshift_state_t;
 
@@ -27,5 +29,52 @@ CLASS_DECL_REDSHIFT void redshift_restore(redshift_state_t * state);
 CLASS_DECL_REDSHIFT int redshift_set_temperature(redshift_state_t * state,  const color_setting_t * color);
 
 
+/* Sample formats of caller-supplied ramps. The 10, 12 and 16-bit
+   formats are stored in 16-bit integers, 8-bit in bytes. */
+typedef enum {
+   REDSHIFT_RAMP_U8 = 0,
+   REDSHIFT_RAMP_U10,
+   REDSHIFT_RAMP_U12,
+   REDSHIFT_RAMP_U16,
+   REDSHIFT_RAMP_FLOAT
+} redshift_ramp_format_t;
+
+/* Caller-supplied ramps. STRIDE is the distance in bytes between
+   consecutive entries of a channel, or zero if they are packed. */
+typedef struct {
+   void * red;
+   void * green;
+   void * blue;
+   int size;
+   ptrdiff_t stride;
+   redshift_ramp_format_t format;
+} redshift_ramps_t;
+
+/* Compute the ramps for a color setting without involving an
+   adjustment method. Nothing is allocated. */
+CLASS_DECL_REDSHIFT int redshift_fill_ramps(const redshift_ramps_t * ramps, const color_setting_t * color);
+
+
+/* Texel layouts of 1D lookup textures for shaders. */
+typedef enum {
+   /* Four half floats per texel, alpha is one */
+   REDSHIFT_LUT_RGBA16F = 0,
+   /* 10 bits per color in one 32-bit word, red in the lowest
+      bits, and 2 bits of alpha set to opaque */
+   REDSHIFT_LUT_RGB10A2
+} redshift_lut_format_t;
 
+/* Caller-supplied lookup texture of SIZE texels. Texel i holds the
+   output for the input i/(SIZE-1). */
+typedef struct {
+   void * data;
+   int size;
+   redshift_lut_format_t format;
+} redshift_lut_t;
 
+/* Write the adjustment for a color setting into a lookup texture.
+   If MATRIX is NULL the whole adjustment is baked into the texture.
+   Otherwise the texture only holds the gamma curve, and MATRIX is set
+   to the 3x3 row-major matrix the shader applies after it for the
+   white point and brightness. Nothing is allocated. */
+CLASS_DECL_REDSHIFT int redshift_export_lut(const redshift_lut_t * lut, const color_setting_t * color, float * matrix);
@@ -56,6 +56,14 @@ typedef int gamma_method_set_option_func(void *state, const char * key,
 typedef void gamma_method_restore_func(void *state);
 typedef int gamma_method_set_temperature_func(void *state,
 					      const color_setting_t *setting);
+typedef int gamma_method_wait_vblank_func(void *state,
+					  unsigned int *sequence);
+typedef int gamma_method_revalidate_func(void *state);
+typedef long gamma_method_prepare_func(void *state,
+				       const color_setting_t *setting,
+				       void *frame);
+typedef int gamma_method_set_prepared_func(void *state, const void *frame);
+typedef int gamma_method_readback_func(void *state);
 
 typedef struct {
 	char *name;
@@ -79,6 +87,24 @@ typedef struct {
 	gamma_method_restore_func *restore;
 	/* Set a specific color temperature. */
 	gamma_method_set_temperature_func *set_temperature;
+
+	/* Optional. Block until the next vertical blank of the
+	   adjusted display and return its sequence number. */
+	gamma_method_wait_vblank_func *wait_vblank;
+	/* Optional. Check the display state after the system resumed
+	   from suspend, which may have reset the gamma ramps. */
+	gamma_method_revalidate_func *revalidate;
+
+	/* Optional. Compute the adjustment for a setting into a frame
+	   without applying it, and return the frame size in bytes. If
+	   the frame is NULL only the size is returned. Frames stay
+	   valid until the method is revalidated or freed. */
+	gamma_method_prepare_func *prepare;
+	/* Apply a frame computed by prepare. */
+	gamma_method_set_prepared_func *set_prepared;
+	/* Optional. Read the ramps back from the display, which
+	   returns once the last update is in effect. */
+	gamma_method_readback_func *readback;
 } gamma_method_t;
 
 
@@ -0,0 +1,299 @@
+/* location-cache.c -- Cached location and background refresh source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef _WIN32
+# include <pwd.h>
+#endif
+
+#include "location-cache.h"
+
+#define MAX_CACHE_PATH  4096
+
+/* Mean radius of the earth (km) */
+#define EARTH_RADIUS  6371.0
+
+
+/* Fill CP with the path of the cache file and create the directory
+   containing it if CREATE is set. Returns -1 if there is no suitable
+   location for the cache. */
+static int
+cache_path(char *cp, int create)
+{
+	char dir[MAX_CACHE_PATH];
+	char *env;
+
+	if ((env = getenv("XDG_CACHE_HOME")) != NULL &&
+	    env[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/redshift", env);
+	} else if ((env = getenv("HOME")) != NULL &&
+		   env[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/.cache/redshift", env);
+	} else {
+#ifndef _WIN32
+		struct passwd *pwd = getpwuid(getuid());
+		if (pwd == NULL) return -1;
+		snprintf(dir, sizeof(dir), "%s/.cache/redshift", pwd->pw_dir);
+#else
+		return -1;
+#endif
+	}
+
+#ifndef _WIN32
+	if (create) {
+		/* Create parent directory first; either may exist. */
+		char *slash = strrchr(dir, '/');
+		if (slash != NULL) {
+			*slash = '\0';
+			mkdir(dir, 0700);
+			*slash = '/';
+		}
+		mkdir(dir, 0700);
+	}
+#endif
+
+	snprintf(cp, MAX_CACHE_PATH, "%s/location", dir);
+	return 0;
+}
+
+/* Load the last known location. Returns -1 if there is none. */
+int
+location_cache_load(location_t *loc)
+{
+	char path[MAX_CACHE_PATH];
+	if (cache_path(path, 0) < 0) return -1;
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return -1;
+
+	float lat, lon;
+	int r = fscanf(f, "%f %f", &lat, &lon);
+	fclose(f);
+
+	if (r != 2) return -1;
+
+	location_t cached = { lat, lon };
+	if (!location_is_valid(&cached)) return -1;
+
+	*loc = cached;
+
+	return 0;
+}
+
+/* Persist LOC as the last known location. The file is replaced
+   atomically so a crash never leaves a truncated cache behind. */
+int
+location_cache_save(const location_t *loc)
+{
+	char path[MAX_CACHE_PATH];
+	char tmp_path[MAX_CACHE_PATH + 8];
+	if (cache_path(path, 1) < 0) return -1;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) return -1;
+
+	fprintf(f, "%.4f %.4f\n", loc->lat, loc->lon);
+	if (fclose(f) != 0) {
+		remove(tmp_path);
+		return -1;
+	}
+
+	if (rename(tmp_path, path) < 0) {
+		remove(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Check that LOC is a location on earth. */
+int
+location_is_valid(const location_t *loc)
+{
+	return !isnan(loc->lat) && !isnan(loc->lon) &&
+		loc->lat >= -90.0 && loc->lat <= 90.0 &&
+		loc->lon >= -180.0 && loc->lon <= 180.0;
+}
+
+/* Great-circle distance between two locations in km. */
+double
+location_distance(const location_t *a, const location_t *b)
+{
+	double rad = M_PI / 180.0;
+	double dlat = (b->lat - a->lat) * rad;
+	double dlon = (b->lon - a->lon) * rad;
+
+	double h = sin(dlat/2)*sin(dlat/2) +
+		cos(a->lat*rad)*cos(b->lat*rad)*sin(dlon/2)*sin(dlon/2);
+
+	return 2.0*EARTH_RADIUS*asin(sqrt(h < 1.0 ? h : 1.0));
+}
+
+/* A fetch that is still running when the caller lets go of it keeps
+   this alive, so it never writes to memory of the caller. The last
+   of the two to let go frees it. */
+struct _LOCATION_FETCH {
+	location_refresh_func *fetch;
+	location_refresh_free_func *free_data;
+	void *data;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+	int refs;
+	location_refresh_status_t status;
+	location_t location;
+};
+
+static location_refresh_status_t
+refresh_run(location_fetch_t *fetch, location_t *loc)
+{
+	int r = fetch->fetch(fetch->data, loc);
+	if (r < 0 || !location_is_valid(loc)) {
+		return LOCATION_REFRESH_FAILED;
+	}
+
+	return LOCATION_REFRESH_DONE;
+}
+
+static void
+refresh_destroy(location_fetch_t *fetch)
+{
+#ifndef _WIN32
+	pthread_mutex_destroy(&fetch->lock);
+#endif
+	if (fetch->free_data != NULL) fetch->free_data(fetch->data);
+	free(fetch);
+}
+
+#ifndef _WIN32
+
+static void *
+refresh_thread(void *data)
+{
+	location_fetch_t *fetch = (location_fetch_t *)data;
+
+	location_t loc;
+	location_refresh_status_t status = refresh_run(fetch, &loc);
+
+	pthread_mutex_lock(&fetch->lock);
+	fetch->location = loc;
+	fetch->status = status;
+	int last = --fetch->refs == 0;
+	pthread_mutex_unlock(&fetch->lock);
+
+	if (last) refresh_destroy(fetch);
+
+	return NULL;
+}
+
+#endif /* ! _WIN32 */
+
+/* Start fetching a location by calling FETCH with DATA in the
+   background. DATA is released with FREE_DATA, if not NULL, once
+   the fetch has finished and the refresh has been freed; it must
+   not point to memory of the caller. */
+int
+location_refresh_start(location_refresh_t *refresh,
+		       location_refresh_func *fetch, void *data,
+		       location_refresh_free_func *free_data)
+{
+	refresh->fetch = NULL;
+	refresh->threshold = LOCATION_CACHE_THRESHOLD;
+
+	location_fetch_t *f = (location_fetch_t *)
+		malloc(sizeof(location_fetch_t));
+	if (f == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
+	f->fetch = fetch;
+	f->free_data = free_data;
+	f->data = data;
+	f->refs = 1;
+	f->status = LOCATION_REFRESH_PENDING;
+
+#ifndef _WIN32
+	pthread_mutex_init(&f->lock, NULL);
+
+	/* One reference for the thread, one for the caller */
+	f->refs = 2;
+	pthread_t thread;
+	int r = pthread_create(&thread, NULL, refresh_thread, f);
+	if (r != 0) {
+		pthread_mutex_destroy(&f->lock);
+		free(f);
+		fprintf(stderr, "pthread_create");
+		return -1;
+	}
+	pthread_detach(thread);
+#else
+	/* No threads; fetch synchronously. */
+	f->status = refresh_run(f, &f->location);
+#endif
+
+	refresh->fetch = f;
+
+	return 0;
+}
+
+/* Check whether the fetch has finished. LOC is set when
+   the result is LOCATION_REFRESH_DONE. */
+location_refresh_status_t
+location_refresh_poll(location_refresh_t *refresh, location_t *loc)
+{
+	location_fetch_t *fetch = refresh->fetch;
+#ifndef _WIN32
+	pthread_mutex_lock(&fetch->lock);
+#endif
+	location_refresh_status_t status = fetch->status;
+	if (status == LOCATION_REFRESH_DONE) *loc = fetch->location;
+#ifndef _WIN32
+	pthread_mutex_unlock(&fetch->lock);
+#endif
+
+	return status;
+}
+
+/* Release the fetch. A fetch that is still blocked is left to
+   finish on its own rather than delaying the caller; it frees the
+   shared state when done. */
+void
+location_refresh_free(location_refresh_t *refresh)
+{
+	location_fetch_t *fetch = refresh->fetch;
+	if (fetch == NULL) return;
+	refresh->fetch = NULL;
+
+#ifndef _WIN32
+	pthread_mutex_lock(&fetch->lock);
+	int last = --fetch->refs == 0;
+	pthread_mutex_unlock(&fetch->lock);
+#else
+	int last = --fetch->refs == 0;
+#endif
+
+	if (last) refresh_destroy(fetch);
+}
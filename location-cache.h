@@ -0,0 +1,67 @@
+/* location-cache.h -- Cached location and background refresh header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_LOCATION_CACHE_H
+#define REDSHIFT_LOCATION_CACHE_H
+
+#ifndef _WIN32
+# include <pthread.h>
+#endif
+
+#include "redshift.h"
+
+/* Default distance (km) a new fix must move away from the location
+   in use before the schedule is recomputed. */
+#define LOCATION_CACHE_THRESHOLD  50.0
+
+typedef enum {
+	LOCATION_REFRESH_PENDING = 0,
+	LOCATION_REFRESH_DONE,
+	LOCATION_REFRESH_FAILED
+} location_refresh_status_t;
+
+/* Obtain a location, blocking as long as needed. Returns zero
+   on success. */
+typedef int location_refresh_func(void *data, location_t *loc);
+/* Release the data of a fetch once it has finished. */
+typedef void location_refresh_free_func(void *data);
+
+/* State shared by the caller and the fetching thread. */
+typedef struct _LOCATION_FETCH location_fetch_t;
+
+/* Fetch a location in the background without blocking the caller. */
+typedef struct {
+	location_fetch_t *fetch;
+
+	/* Distance (km) a fix must move to replace the location in use */
+	double threshold;
+} location_refresh_t;
+
+int location_cache_load(location_t *loc);
+int location_cache_save(const location_t *loc);
+int location_is_valid(const location_t *loc);
+double location_distance(const location_t *a, const location_t *b);
+
+int location_refresh_start(location_refresh_t *refresh,
+			   location_refresh_func *fetch, void *data,
+			   location_refresh_free_func *free_data);
+location_refresh_status_t location_refresh_poll(location_refresh_t *refresh,
+						location_t *loc);
+void location_refresh_free(location_refresh_t *refresh);
+
+
+#endif /* ! REDSHIFT_LOCATION_CACHE_H */
@@ -0,0 +1,713 @@
+/* location-timezone.cpp -- Time zone location provider source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#ifndef _WIN32
+# include <unistd.h>
+# include <limits.h>
+#endif
+
+#include <string_view>
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#include "location-timezone.h"
+
+#define MAX_ZONE_NAME  256
+
+
+typedef struct {
+	const char *name;
+	float lat;
+	float lon;
+} zone_location_t;
+
+/* Principal location of each time zone, from zone.tab of the
+   IANA time zone database. */
+static constexpr zone_location_t zones[] = {
+	{ "Africa/Abidjan", 5.32f, -4.03f },
+	{ "Africa/Accra", 5.55f, -0.22f },
+	{ "Africa/Addis_Ababa", 9.03f, 38.70f },
+	{ "Africa/Algiers", 36.78f, 3.05f },
+	{ "Africa/Asmara", 15.33f, 38.88f },
+	{ "Africa/Bamako", 12.65f, -8.00f },
+	{ "Africa/Bangui", 4.37f, 18.58f },
+	{ "Africa/Banjul", 13.47f, -16.65f },
+	{ "Africa/Bissau", 11.85f, -15.58f },
+	{ "Africa/Blantyre", -15.78f, 35.00f },
+	{ "Africa/Brazzaville", -4.27f, 15.28f },
+	{ "Africa/Bujumbura", -3.38f, 29.37f },
+	{ "Africa/Cairo", 30.05f, 31.25f },
+	{ "Africa/Casablanca", 33.65f, -7.58f },
+	{ "Africa/Ceuta", 35.88f, -5.32f },
+	{ "Africa/Conakry", 9.52f, -13.72f },
+	{ "Africa/Dakar", 14.67f, -17.43f },
+	{ "Africa/Dar_es_Salaam", -6.80f, 39.28f },
+	{ "Africa/Djibouti", 11.60f, 43.15f },
+	{ "Africa/Douala", 4.05f, 9.70f },
+	{ "Africa/El_Aaiun", 27.15f, -13.20f },
+	{ "Africa/Freetown", 8.50f, -13.25f },
+	{ "Africa/Gaborone", -24.65f, 25.92f },
+	{ "Africa/Harare", -17.83f, 31.05f },
+	{ "Africa/Johannesburg", -26.25f, 28.00f },
+	{ "Africa/Juba", 4.85f, 31.62f },
+	{ "Africa/Kampala", 0.32f, 32.42f },
+	{ "Africa/Khartoum", 15.60f, 32.53f },
+	{ "Africa/Kigali", -1.95f, 30.07f },
+	{ "Africa/Kinshasa", -4.30f, 15.30f },
+	{ "Africa/Lagos", 6.45f, 3.40f },
+	{ "Africa/Libreville", 0.38f, 9.45f },
+	{ "Africa/Lome", 6.13f, 1.22f },
+	{ "Africa/Luanda", -8.80f, 13.23f },
+	{ "Africa/Lubumbashi", -11.67f, 27.47f },
+	{ "Africa/Lusaka", -15.42f, 28.28f },
+	{ "Africa/Malabo", 3.75f, 8.78f },
+	{ "Africa/Maputo", -25.97f, 32.58f },
+	{ "Africa/Maseru", -29.47f, 27.50f },
+	{ "Africa/Mbabane", -26.30f, 31.10f },
+	{ "Africa/Mogadishu", 2.07f, 45.37f },
+	{ "Africa/Monrovia", 6.30f, -10.78f },
+	{ "Africa/Nairobi", -1.28f, 36.82f },
+	{ "Africa/Ndjamena", 12.12f, 15.05f },
+	{ "Africa/Niamey", 13.52f, 2.12f },
+	{ "Africa/Nouakchott", 18.10f, -15.95f },
+	{ "Africa/Ouagadougou", 12.37f, -1.52f },
+	{ "Africa/Porto-Novo", 6.48f, 2.62f },
+	{ "Africa/Sao_Tome", 0.33f, 6.73f },
+	{ "Africa/Tripoli", 32.90f, 13.18f },
+	{ "Africa/Tunis", 36.80f, 10.18f },
+	{ "Africa/Windhoek", -22.57f, 17.10f },
+	{ "America/Adak", 51.88f, -176.66f },
+	{ "America/Anchorage", 61.22f, -149.90f },
+	{ "America/Anguilla", 18.20f, -63.07f },
+	{ "America/Antigua", 17.05f, -61.80f },
+	{ "America/Araguaina", -7.20f, -48.20f },
+	{ "America/Argentina/Buenos_Aires", -34.60f, -58.45f },
+	{ "America/Argentina/Catamarca", -28.47f, -65.78f },
+	{ "America/Argentina/Cordoba", -31.40f, -64.18f },
+	{ "America/Argentina/Jujuy", -24.18f, -65.30f },
+	{ "America/Argentina/La_Rioja", -29.43f, -66.85f },
+	{ "America/Argentina/Mendoza", -32.88f, -68.82f },
+	{ "America/Argentina/Rio_Gallegos", -51.63f, -69.22f },
+	{ "America/Argentina/Salta", -24.78f, -65.42f },
+	{ "America/Argentina/San_Juan", -31.53f, -68.52f },
+	{ "America/Argentina/San_Luis", -33.32f, -66.35f },
+	{ "America/Argentina/Tucuman", -26.82f, -65.22f },
+	{ "America/Argentina/Ushuaia", -54.80f, -68.30f },
+	{ "America/Aruba", 12.50f, -69.97f },
+	{ "America/Asuncion", -25.27f, -57.67f },
+	{ "America/Atikokan", 48.76f, -91.62f },
+	{ "America/Bahia", -12.98f, -38.52f },
+	{ "America/Bahia_Banderas", 20.80f, -105.25f },
+	{ "America/Barbados", 13.10f, -59.62f },
+	{ "America/Belem", -1.45f, -48.48f },
+	{ "America/Belize", 17.50f, -88.20f },
+	{ "America/Blanc-Sablon", 51.42f, -57.12f },
+	{ "America/Boa_Vista", 2.82f, -60.67f },
+	{ "America/Bogota", 4.60f, -74.08f },
+	{ "America/Boise", 43.61f, -116.20f },
+	{ "America/Cambridge_Bay", 69.11f, -105.05f },
+	{ "America/Campo_Grande", -20.45f, -54.62f },
+	{ "America/Cancun", 21.08f, -86.77f },
+	{ "America/Caracas", 10.50f, -66.93f },
+	{ "America/Cayenne", 4.93f, -52.33f },
+	{ "America/Cayman", 19.30f, -81.38f },
+	{ "America/Chicago", 41.85f, -87.65f },
+	{ "America/Chihuahua", 28.63f, -106.08f },
+	{ "America/Ciudad_Juarez", 31.73f, -106.48f },
+	{ "America/Costa_Rica", 9.93f, -84.08f },
+	{ "America/Coyhaique", -45.57f, -72.07f },
+	{ "America/Creston", 49.10f, -116.52f },
+	{ "America/Cuiaba", -15.58f, -56.08f },
+	{ "America/Curacao", 12.18f, -69.00f },
+	{ "America/Danmarkshavn", 76.77f, -18.67f },
+	{ "America/Dawson", 64.07f, -139.42f },
+	{ "America/Dawson_Creek", 55.77f, -120.23f },
+	{ "America/Denver", 39.74f, -104.98f },
+	{ "America/Detroit", 42.33f, -83.05f },
+	{ "America/Dominica", 15.30f, -61.40f },
+	{ "America/Edmonton", 53.55f, -113.47f },
+	{ "America/Eirunepe", -6.67f, -69.87f },
+	{ "America/El_Salvador", 13.70f, -89.20f },
+	{ "America/Fort_Nelson", 58.80f, -122.70f },
+	{ "America/Fortaleza", -3.72f, -38.50f },
+	{ "America/Glace_Bay", 46.20f, -59.95f },
+	{ "America/Goose_Bay", 53.33f, -60.42f },
+	{ "America/Grand_Turk", 21.47f, -71.13f },
+	{ "America/Grenada", 12.05f, -61.75f },
+	{ "America/Guadeloupe", 16.23f, -61.53f },
+	{ "America/Guatemala", 14.63f, -90.52f },
+	{ "America/Guayaquil", -2.17f, -79.83f },
+	{ "America/Guyana", 6.80f, -58.17f },
+	{ "America/Halifax", 44.65f, -63.60f },
+	{ "America/Havana", 23.13f, -82.37f },
+	{ "America/Hermosillo", 29.07f, -110.97f },
+	{ "America/Indiana/Indianapolis", 39.77f, -86.16f },
+	{ "America/Indiana/Knox", 41.30f, -86.62f },
+	{ "America/Indiana/Marengo", 38.38f, -86.34f },
+	{ "America/Indiana/Petersburg", 38.49f, -87.28f },
+	{ "America/Indiana/Tell_City", 37.95f, -86.76f },
+	{ "America/Indiana/Vevay", 38.75f, -85.07f },
+	{ "America/Indiana/Vincennes", 38.68f, -87.53f },
+	{ "America/Indiana/Winamac", 41.05f, -86.60f },
+	{ "America/Inuvik", 68.35f, -133.72f },
+	{ "America/Iqaluit", 63.73f, -68.47f },
+	{ "America/Jamaica", 17.97f, -76.79f },
+	{ "America/Juneau", 58.30f, -134.42f },
+	{ "America/Kentucky/Louisville", 38.25f, -85.76f },
+	{ "America/Kentucky/Monticello", 36.83f, -84.85f },
+	{ "America/Kralendijk", 12.15f, -68.28f },
+	{ "America/La_Paz", -16.50f, -68.15f },
+	{ "America/Lima", -12.05f, -77.05f },
+	{ "America/Los_Angeles", 34.05f, -118.24f },
+	{ "America/Lower_Princes", 18.05f, -63.05f },
+	{ "America/Maceio", -9.67f, -35.72f },
+	{ "America/Managua", 12.15f, -86.28f },
+	{ "America/Manaus", -3.13f, -60.02f },
+	{ "America/Marigot", 18.07f, -63.08f },
+	{ "America/Martinique", 14.60f, -61.08f },
+	{ "America/Matamoros", 25.83f, -97.50f },
+	{ "America/Mazatlan", 23.22f, -106.42f },
+	{ "America/Menominee", 45.11f, -87.61f },
+	{ "America/Merida", 20.97f, -89.62f },
+	{ "America/Metlakatla", 55.13f, -131.58f },
+	{ "America/Mexico_City", 19.40f, -99.15f },
+	{ "America/Miquelon", 47.05f, -56.33f },
+	{ "America/Moncton", 46.10f, -64.78f },
+	{ "America/Monterrey", 25.67f, -100.32f },
+	{ "America/Montevideo", -34.91f, -56.21f },
+	{ "America/Montserrat", 16.72f, -62.22f },
+	{ "America/Nassau", 25.08f, -77.35f },
+	{ "America/New_York", 40.71f, -74.01f },
+	{ "America/Nome", 64.50f, -165.41f },
+	{ "America/Noronha", -3.85f, -32.42f },
+	{ "America/North_Dakota/Beulah", 47.26f, -101.78f },
+	{ "America/North_Dakota/Center", 47.12f, -101.30f },
+	{ "America/North_Dakota/New_Salem", 46.84f, -101.41f },
+	{ "America/Nuuk", 64.18f, -51.73f },
+	{ "America/Ojinaga", 29.57f, -104.42f },
+	{ "America/Panama", 8.97f, -79.53f },
+	{ "America/Paramaribo", 5.83f, -55.17f },
+	{ "America/Phoenix", 33.45f, -112.07f },
+	{ "America/Port-au-Prince", 18.53f, -72.33f },
+	{ "America/Port_of_Spain", 10.65f, -61.52f },
+	{ "America/Porto_Velho", -8.77f, -63.90f },
+	{ "America/Puerto_Rico", 18.47f, -66.11f },
+	{ "America/Punta_Arenas", -53.15f, -70.92f },
+	{ "America/Rankin_Inlet", 62.82f, -92.08f },
+	{ "America/Recife", -8.05f, -34.90f },
+	{ "America/Regina", 50.40f, -104.65f },
+	{ "America/Resolute", 74.70f, -94.83f },
+	{ "America/Rio_Branco", -9.97f, -67.80f },
+	{ "America/Santarem", -2.43f, -54.87f },
+	{ "America/Santiago", -33.45f, -70.67f },
+	{ "America/Santo_Domingo", 18.47f, -69.90f },
+	{ "America/Sao_Paulo", -23.53f, -46.62f },
+	{ "America/Scoresbysund", 70.48f, -21.97f },
+	{ "America/Sitka", 57.18f, -135.30f },
+	{ "America/St_Barthelemy", 17.88f, -62.85f },
+	{ "America/St_Johns", 47.57f, -52.72f },
+	{ "America/St_Kitts", 17.30f, -62.72f },
+	{ "America/St_Lucia", 14.02f, -61.00f },
+	{ "America/St_Thomas", 18.35f, -64.93f },
+	{ "America/St_Vincent", 13.15f, -61.23f },
+	{ "America/Swift_Current", 50.28f, -107.83f },
+	{ "America/Tegucigalpa", 14.10f, -87.22f },
+	{ "America/Thule", 76.57f, -68.78f },
+	{ "America/Tijuana", 32.53f, -117.02f },
+	{ "America/Toronto", 43.65f, -79.38f },
+	{ "America/Tortola", 18.45f, -64.62f },
+	{ "America/Vancouver", 49.27f, -123.12f },
+	{ "America/Whitehorse", 60.72f, -135.05f },
+	{ "America/Winnipeg", 49.88f, -97.15f },
+	{ "America/Yakutat", 59.55f, -139.73f },
+	{ "Antarctica/Casey", -66.28f, 110.52f },
+	{ "Antarctica/Davis", -68.58f, 77.97f },
+	{ "Antarctica/DumontDUrville", -66.67f, 140.02f },
+	{ "Antarctica/Macquarie", -54.50f, 158.95f },
+	{ "Antarctica/Mawson", -67.60f, 62.88f },
+	{ "Antarctica/McMurdo", -77.83f, 166.60f },
+	{ "Antarctica/Palmer", -64.80f, -64.10f },
+	{ "Antarctica/Rothera", -67.57f, -68.13f },
+	{ "Antarctica/Syowa", -69.01f, 39.59f },
+	{ "Antarctica/Troll", -72.01f, 2.53f },
+	{ "Antarctica/Vostok", -78.40f, 106.90f },
+	{ "Arctic/Longyearbyen", 78.00f, 16.00f },
+	{ "Asia/Aden", 12.75f, 45.20f },
+	{ "Asia/Almaty", 43.25f, 76.95f },
+	{ "Asia/Amman", 31.95f, 35.93f },
+	{ "Asia/Anadyr", 64.75f, 177.48f },
+	{ "Asia/Aqtau", 44.52f, 50.27f },
+	{ "Asia/Aqtobe", 50.28f, 57.17f },
+	{ "Asia/Ashgabat", 37.95f, 58.38f },
+	{ "Asia/Atyrau", 47.12f, 51.93f },
+	{ "Asia/Baghdad", 33.35f, 44.42f },
+	{ "Asia/Bahrain", 26.38f, 50.58f },
+	{ "Asia/Baku", 40.38f, 49.85f },
+	{ "Asia/Bangkok", 13.75f, 100.52f },
+	{ "Asia/Barnaul", 53.37f, 83.75f },
+	{ "Asia/Beirut", 33.88f, 35.50f },
+	{ "Asia/Bishkek", 42.90f, 74.60f },
+	{ "Asia/Brunei", 4.93f, 114.92f },
+	{ "Asia/Chita", 52.05f, 113.47f },
+	{ "Asia/Colombo", 6.93f, 79.85f },
+	{ "Asia/Damascus", 33.50f, 36.30f },
+	{ "Asia/Dhaka", 23.72f, 90.42f },
+	{ "Asia/Dili", -8.55f, 125.58f },
+	{ "Asia/Dubai", 25.30f, 55.30f },
+	{ "Asia/Dushanbe", 38.58f, 68.80f },
+	{ "Asia/Famagusta", 35.12f, 33.95f },
+	{ "Asia/Gaza", 31.50f, 34.47f },
+	{ "Asia/Hebron", 31.53f, 35.09f },
+	{ "Asia/Ho_Chi_Minh", 10.75f, 106.67f },
+	{ "Asia/Hong_Kong", 22.28f, 114.15f },
+	{ "Asia/Hovd", 48.02f, 91.65f },
+	{ "Asia/Irkutsk", 52.27f, 104.33f },
+	{ "Asia/Jakarta", -6.17f, 106.80f },
+	{ "Asia/Jayapura", -2.53f, 140.70f },
+	{ "Asia/Jerusalem", 31.78f, 35.22f },
+	{ "Asia/Kabul", 34.52f, 69.20f },
+	{ "Asia/Kamchatka", 53.02f, 158.65f },
+	{ "Asia/Karachi", 24.87f, 67.05f },
+	{ "Asia/Kathmandu", 27.72f, 85.32f },
+	{ "Asia/Khandyga", 62.66f, 135.55f },
+	{ "Asia/Kolkata", 22.53f, 88.37f },
+	{ "Asia/Krasnoyarsk", 56.02f, 92.83f },
+	{ "Asia/Kuala_Lumpur", 3.17f, 101.70f },
+	{ "Asia/Kuching", 1.55f, 110.33f },
+	{ "Asia/Kuwait", 29.33f, 47.98f },
+	{ "Asia/Macau", 22.20f, 113.54f },
+	{ "Asia/Magadan", 59.57f, 150.80f },
+	{ "Asia/Makassar", -5.12f, 119.40f },
+	{ "Asia/Manila", 14.59f, 120.97f },
+	{ "Asia/Muscat", 23.60f, 58.58f },
+	{ "Asia/Nicosia", 35.17f, 33.37f },
+	{ "Asia/Novokuznetsk", 53.75f, 87.12f },
+	{ "Asia/Novosibirsk", 55.03f, 82.92f },
+	{ "Asia/Omsk", 55.00f, 73.40f },
+	{ "Asia/Oral", 51.22f, 51.35f },
+	{ "Asia/Phnom_Penh", 11.55f, 104.92f },
+	{ "Asia/Pontianak", -0.03f, 109.33f },
+	{ "Asia/Pyongyang", 39.02f, 125.75f },
+	{ "Asia/Qatar", 25.28f, 51.53f },
+	{ "Asia/Qostanay", 53.20f, 63.62f },
+	{ "Asia/Qyzylorda", 44.80f, 65.47f },
+	{ "Asia/Riyadh", 24.63f, 46.72f },
+	{ "Asia/Sakhalin", 46.97f, 142.70f },
+	{ "Asia/Samarkand", 39.67f, 66.80f },
+	{ "Asia/Seoul", 37.55f, 126.97f },
+	{ "Asia/Shanghai", 31.23f, 121.47f },
+	{ "Asia/Singapore", 1.28f, 103.85f },
+	{ "Asia/Srednekolymsk", 67.47f, 153.72f },
+	{ "Asia/Taipei", 25.05f, 121.50f },
+	{ "Asia/Tashkent", 41.33f, 69.30f },
+	{ "Asia/Tbilisi", 41.72f, 44.82f },
+	{ "Asia/Tehran", 35.67f, 51.43f },
+	{ "Asia/Thimphu", 27.47f, 89.65f },
+	{ "Asia/Tokyo", 35.65f, 139.74f },
+	{ "Asia/Tomsk", 56.50f, 84.97f },
+	{ "Asia/Ulaanbaatar", 47.92f, 106.88f },
+	{ "Asia/Urumqi", 43.80f, 87.58f },
+	{ "Asia/Ust-Nera", 64.56f, 143.23f },
+	{ "Asia/Vientiane", 17.97f, 102.60f },
+	{ "Asia/Vladivostok", 43.17f, 131.93f },
+	{ "Asia/Yakutsk", 62.00f, 129.67f },
+	{ "Asia/Yangon", 16.78f, 96.17f },
+	{ "Asia/Yekaterinburg", 56.85f, 60.60f },
+	{ "Asia/Yerevan", 40.18f, 44.50f },
+	{ "Atlantic/Azores", 37.73f, -25.67f },
+	{ "Atlantic/Bermuda", 32.28f, -64.77f },
+	{ "Atlantic/Canary", 28.10f, -15.40f },
+	{ "Atlantic/Cape_Verde", 14.92f, -23.52f },
+	{ "Atlantic/Faroe", 62.02f, -6.77f },
+	{ "Atlantic/Madeira", 32.63f, -16.90f },
+	{ "Atlantic/Reykjavik", 64.15f, -21.85f },
+	{ "Atlantic/South_Georgia", -54.27f, -36.53f },
+	{ "Atlantic/St_Helena", -15.92f, -5.70f },
+	{ "Atlantic/Stanley", -51.70f, -57.85f },
+	{ "Australia/Adelaide", -34.92f, 138.58f },
+	{ "Australia/Brisbane", -27.47f, 153.03f },
+	{ "Australia/Broken_Hill", -31.95f, 141.45f },
+	{ "Australia/Darwin", -12.47f, 130.83f },
+	{ "Australia/Eucla", -31.72f, 128.87f },
+	{ "Australia/Hobart", -42.88f, 147.32f },
+	{ "Australia/Lindeman", -20.27f, 149.00f },
+	{ "Australia/Lord_Howe", -31.55f, 159.08f },
+	{ "Australia/Melbourne", -37.82f, 144.97f },
+	{ "Australia/Perth", -31.95f, 115.85f },
+	{ "Australia/Sydney", -33.87f, 151.22f },
+	{ "Europe/Amsterdam", 52.37f, 4.90f },
+	{ "Europe/Andorra", 42.50f, 1.52f },
+	{ "Europe/Astrakhan", 46.35f, 48.05f },
+	{ "Europe/Athens", 37.97f, 23.72f },
+	{ "Europe/Belgrade", 44.83f, 20.50f },
+	{ "Europe/Berlin", 52.50f, 13.37f },
+	{ "Europe/Bratislava", 48.15f, 17.12f },
+	{ "Europe/Brussels", 50.83f, 4.33f },
+	{ "Europe/Bucharest", 44.43f, 26.10f },
+	{ "Europe/Budapest", 47.50f, 19.08f },
+	{ "Europe/Busingen", 47.70f, 8.68f },
+	{ "Europe/Chisinau", 47.00f, 28.83f },
+	{ "Europe/Copenhagen", 55.67f, 12.58f },
+	{ "Europe/Dublin", 53.33f, -6.25f },
+	{ "Europe/Gibraltar", 36.13f, -5.35f },
+	{ "Europe/Guernsey", 49.45f, -2.54f },
+	{ "Europe/Helsinki", 60.17f, 24.97f },
+	{ "Europe/Isle_of_Man", 54.15f, -4.47f },
+	{ "Europe/Istanbul", 41.02f, 28.97f },
+	{ "Europe/Jersey", 49.18f, -2.11f },
+	{ "Europe/Kaliningrad", 54.72f, 20.50f },
+	{ "Europe/Kirov", 58.60f, 49.65f },
+	{ "Europe/Kyiv", 50.43f, 30.52f },
+	{ "Europe/Lisbon", 38.72f, -9.13f },
+	{ "Europe/Ljubljana", 46.05f, 14.52f },
+	{ "Europe/London", 51.51f, -0.13f },
+	{ "Europe/Luxembourg", 49.60f, 6.15f },
+	{ "Europe/Madrid", 40.40f, -3.68f },
+	{ "Europe/Malta", 35.90f, 14.52f },
+	{ "Europe/Mariehamn", 60.10f, 19.95f },
+	{ "Europe/Minsk", 53.90f, 27.57f },
+	{ "Europe/Monaco", 43.70f, 7.38f },
+	{ "Europe/Moscow", 55.76f, 37.62f },
+	{ "Europe/Oslo", 59.92f, 10.75f },
+	{ "Europe/Paris", 48.87f, 2.33f },
+	{ "Europe/Podgorica", 42.43f, 19.27f },
+	{ "Europe/Prague", 50.08f, 14.43f },
+	{ "Europe/Riga", 56.95f, 24.10f },
+	{ "Europe/Rome", 41.90f, 12.48f },
+	{ "Europe/Samara", 53.20f, 50.15f },
+	{ "Europe/San_Marino", 43.92f, 12.47f },
+	{ "Europe/Sarajevo", 43.87f, 18.42f },
+	{ "Europe/Saratov", 51.57f, 46.03f },
+	{ "Europe/Simferopol", 44.95f, 34.10f },
+	{ "Europe/Skopje", 41.98f, 21.43f },
+	{ "Europe/Sofia", 42.68f, 23.32f },
+	{ "Europe/Stockholm", 59.33f, 18.05f },
+	{ "Europe/Tallinn", 59.42f, 24.75f },
+	{ "Europe/Tirane", 41.33f, 19.83f },
+	{ "Europe/Ulyanovsk", 54.33f, 48.40f },
+	{ "Europe/Vaduz", 47.15f, 9.52f },
+	{ "Europe/Vatican", 41.90f, 12.45f },
+	{ "Europe/Vienna", 48.22f, 16.33f },
+	{ "Europe/Vilnius", 54.68f, 25.32f },
+	{ "Europe/Volgograd", 48.73f, 44.42f },
+	{ "Europe/Warsaw", 52.25f, 21.00f },
+	{ "Europe/Zagreb", 45.80f, 15.97f },
+	{ "Europe/Zurich", 47.38f, 8.53f },
+	{ "Indian/Antananarivo", -18.92f, 47.52f },
+	{ "Indian/Chagos", -7.33f, 72.42f },
+	{ "Indian/Christmas", -10.42f, 105.72f },
+	{ "Indian/Cocos", -12.17f, 96.92f },
+	{ "Indian/Comoro", -11.68f, 43.27f },
+	{ "Indian/Kerguelen", -49.35f, 70.22f },
+	{ "Indian/Mahe", -4.67f, 55.47f },
+	{ "Indian/Maldives", 4.17f, 73.50f },
+	{ "Indian/Mauritius", -20.17f, 57.50f },
+	{ "Indian/Mayotte", -12.78f, 45.23f },
+	{ "Indian/Reunion", -20.87f, 55.47f },
+	{ "Pacific/Apia", -13.83f, -171.73f },
+	{ "Pacific/Auckland", -36.87f, 174.77f },
+	{ "Pacific/Bougainville", -6.22f, 155.57f },
+	{ "Pacific/Chatham", -43.95f, -176.55f },
+	{ "Pacific/Chuuk", 7.42f, 151.78f },
+	{ "Pacific/Easter", -27.15f, -109.43f },
+	{ "Pacific/Efate", -17.67f, 168.42f },
+	{ "Pacific/Fakaofo", -9.37f, -171.23f },
+	{ "Pacific/Fiji", -18.13f, 178.42f },
+	{ "Pacific/Funafuti", -8.52f, 179.22f },
+	{ "Pacific/Galapagos", -0.90f, -89.60f },
+	{ "Pacific/Gambier", -23.13f, -134.95f },
+	{ "Pacific/Guadalcanal", -9.53f, 160.20f },
+	{ "Pacific/Guam", 13.47f, 144.75f },
+	{ "Pacific/Honolulu", 21.31f, -157.86f },
+	{ "Pacific/Kanton", -2.78f, -171.72f },
+	{ "Pacific/Kiritimati", 1.87f, -157.33f },
+	{ "Pacific/Kosrae", 5.32f, 162.98f },
+	{ "Pacific/Kwajalein", 9.08f, 167.33f },
+	{ "Pacific/Majuro", 7.15f, 171.20f },
+	{ "Pacific/Marquesas", -9.00f, -139.50f },
+	{ "Pacific/Midway", 28.22f, -177.37f },
+	{ "Pacific/Nauru", -0.52f, 166.92f },
+	{ "Pacific/Niue", -19.02f, -169.92f },
+	{ "Pacific/Norfolk", -29.05f, 167.97f },
+	{ "Pacific/Noumea", -22.27f, 166.45f },
+	{ "Pacific/Pago_Pago", -14.27f, -170.70f },
+	{ "Pacific/Palau", 7.33f, 134.48f },
+	{ "Pacific/Pitcairn", -25.07f, -130.08f },
+	{ "Pacific/Pohnpei", 6.97f, 158.22f },
+	{ "Pacific/Port_Moresby", -9.50f, 147.17f },
+	{ "Pacific/Rarotonga", -21.23f, -159.77f },
+	{ "Pacific/Saipan", 15.20f, 145.75f },
+	{ "Pacific/Tahiti", -17.53f, -149.57f },
+	{ "Pacific/Tarawa", 1.42f, 173.00f },
+	{ "Pacific/Tongatapu", -21.13f, -175.20f },
+	{ "Pacific/Wake", 19.28f, 166.62f },
+	{ "Pacific/Wallis", -13.30f, -176.17f },
+};
+
+static constexpr size_t ZONE_COUNT = sizeof(zones)/sizeof(zones[0]);
+
+/* The names are looked up with a perfect hash built at compile time
+   (hash and displace): each name first picks a bucket, and each
+   bucket has a seed that sends all its names to distinct slots. */
+static constexpr size_t ZONE_BUCKETS = ZONE_COUNT/4 + 1;
+static constexpr size_t ZONE_SLOTS = 512;
+
+static_assert(ZONE_SLOTS > ZONE_COUNT, "Zone hash table too small");
+
+static constexpr uint32_t
+zone_hash(std::string_view name, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 16777619u);
+	for (char c : name) {
+		h ^= (uint8_t)c;
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+typedef struct {
+	uint16_t seed[ZONE_BUCKETS];
+	int16_t slot[ZONE_SLOTS];
+} zone_table_t;
+
+static constexpr zone_table_t
+zone_table_build()
+{
+	zone_table_t table = {};
+	for (size_t i = 0; i < ZONE_SLOTS; i++) table.slot[i] = -1;
+
+	/* Group the names by bucket */
+	size_t bucket_of[ZONE_COUNT] = {};
+	size_t bucket_size[ZONE_BUCKETS] = {};
+	for (size_t i = 0; i < ZONE_COUNT; i++) {
+		bucket_of[i] = zone_hash(zones[i].name, 0) % ZONE_BUCKETS;
+		bucket_size[bucket_of[i]] += 1;
+	}
+
+	/* Place the largest buckets first while the table is empty */
+	size_t order[ZONE_BUCKETS] = {};
+	for (size_t b = 0; b < ZONE_BUCKETS; b++) order[b] = b;
+	for (size_t i = 1; i < ZONE_BUCKETS; i++) {
+		for (size_t j = i; j > 0 &&
+			     bucket_size[order[j]] > bucket_size[order[j-1]]; j--) {
+			size_t t = order[j];
+			order[j] = order[j-1];
+			order[j-1] = t;
+		}
+	}
+
+	for (size_t k = 0; k < ZONE_BUCKETS; k++) {
+		size_t b = order[k];
+		if (bucket_size[b] == 0) break;
+
+		for (uint32_t seed = 1; ; seed++) {
+			size_t slots[ZONE_COUNT] = {};
+			size_t n = 0;
+			bool ok = true;
+			for (size_t i = 0; ok && i < ZONE_COUNT; i++) {
+				if (bucket_of[i] != b) continue;
+				size_t s = zone_hash(zones[i].name, seed) %
+					ZONE_SLOTS;
+				if (table.slot[s] >= 0) ok = false;
+				for (size_t j = 0; j < n; j++) {
+					if (slots[j] == s) ok = false;
+				}
+				slots[n++] = s;
+			}
+			if (!ok) continue;
+
+			n = 0;
+			for (size_t i = 0; i < ZONE_COUNT; i++) {
+				if (bucket_of[i] != b) continue;
+				table.slot[slots[n++]] = (int16_t)i;
+			}
+			table.seed[b] = (uint16_t)seed;
+			break;
+		}
+	}
+
+	return table;
+}
+
+static constexpr zone_table_t zone_table = zone_table_build();
+
+
+/* Find the principal location of time zone NAME. */
+static const zone_location_t *
+zone_lookup(const char *name)
+{
+	uint32_t bucket = zone_hash(name, 0) % ZONE_BUCKETS;
+	uint32_t slot = zone_hash(name, zone_table.seed[bucket]) % ZONE_SLOTS;
+
+	int index = zone_table.slot[slot];
+	if (index < 0 || strcmp(zones[index].name, name) != 0) return NULL;
+
+	return &zones[index];
+}
+
+/* Strip a path to a zone file down to the zone name. */
+static const char *
+zone_from_path(const char *path)
+{
+	const char *name = strstr(path, "zoneinfo/");
+	if (name == NULL) return NULL;
+	name += strlen("zoneinfo/");
+
+	/* Alternative trees like zoneinfo/posix/ hold the same zones */
+	if (strncmp(name, "posix/", 6) == 0) name += 6;
+	else if (strncmp(name, "right/", 6) == 0) name += 6;
+
+	return name;
+}
+
+/* Determine the name of the local time zone from TZ, the link
+   /etc/localtime or /etc/timezone. */
+static int
+zone_local(char *zone, size_t size)
+{
+	const char *tz = getenv("TZ");
+	if (tz != NULL && tz[0] != '\0') {
+		if (tz[0] == ':') tz++;
+		if (tz[0] == '/') {
+			tz = zone_from_path(tz);
+			if (tz == NULL) return -1;
+		}
+		snprintf(zone, size, "%s", tz);
+		return 0;
+	}
+
+#ifndef _WIN32
+	char path[PATH_MAX];
+	ssize_t len = readlink("/etc/localtime", path, sizeof(path) - 1);
+	if (len > 0) {
+		path[len] = '\0';
+		const char *name = zone_from_path(path);
+		if (name != NULL) {
+			snprintf(zone, size, "%s", name);
+			return 0;
+		}
+	}
+
+	FILE *f = fopen("/etc/timezone", "r");
+	if (f != NULL) {
+		char *r = fgets(zone, size, f);
+		fclose(f);
+		if (r != NULL) {
+			zone[strcspn(zone, " \t\r\n")] = '\0';
+			if (zone[0] != '\0') return 0;
+		}
+	}
+#endif
+
+	return -1;
+}
+
+
+int
+location_timezone_init(location_timezone_state_t *state)
+{
+	state->zone = NULL;
+	state->loc.lat = NAN;
+	state->loc.lon = NAN;
+
+	return 0;
+}
+
+int
+location_timezone_start(location_timezone_state_t *state)
+{
+	char zone[MAX_ZONE_NAME];
+	if (state->zone != NULL) {
+		snprintf(zone, sizeof(zone), "%s", state->zone);
+	} else if (zone_local(zone, sizeof(zone)) < 0) {
+		fputs(_("Unable to determine the local time zone.\n"), stderr);
+		return -1;
+	}
+
+	const zone_location_t *z = zone_lookup(zone);
+	if (z == NULL) {
+		fprintf(stderr, _("No location known for time zone `%s'.\n"),
+			zone);
+		return -1;
+	}
+
+	state->loc.lat = z->lat;
+	state->loc.lon = z->lon;
+
+	return 0;
+}
+
+void
+location_timezone_free(location_timezone_state_t *state)
+{
+	free(state->zone);
+	state->zone = NULL;
+}
+
+void
+location_timezone_print_help(FILE *f)
+{
+	fputs(_("Use the principal location of the local time zone.\n"), f);
+	fputs("\n", f);
+
+	/* TRANSLATORS: Time zone help output
+	   left column must not be translated */
+	fputs(_("  zone=NAME\tTime zone to use instead of the local"
+		" one\n"), f);
+	fputs("\n", f);
+	fputs(_("The location is only accurate to within the time zone.\n"),
+	      f);
+	fputs("\n", f);
+}
+
+int
+location_timezone_set_option(location_timezone_state_t *state,
+			     const char *key, const char *value)
+{
+	if (strcasecmp(key, "zone") == 0) {
+		free(state->zone);
+		state->zone = strdup(value);
+		if (state->zone == NULL) {
+			fprintf(stderr, "strdup");
+			return -1;
+		}
+	} else {
+		fprintf(stderr, _("Unknown method parameter: `%s'.\n"), key);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+location_timezone_get_location(location_timezone_state_t *state,
+			       location_t *loc)
+{
+	*loc = state->loc;
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+/* metrics.c -- Operational counters and latency histograms source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "metrics.h"
+#include "systemtime.h"
+
+#define MAX_METRICS_PATH  4096
+
+/* Minutes over which the wakeup rate is measured */
+#define RATE_MINUTES  60
+
+typedef struct {
+	const char *name;
+	const char *help;
+} metric_info_t;
+
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] = {
+	{ "redshift_ticks_total",
+	  "Iterations of the main loop." },
+	{ "redshift_uploads_total",
+	  "Color settings sent to the display." },
+	{ "redshift_uploads_skipped_total",
+	  "Updates skipped as not perceptibly different." },
+	{ "redshift_round_trips_total",
+	  "Blocking round trips to the display server." },
+	{ "redshift_hook_spawns_total",
+	  "Hook processes started." },
+	{ "redshift_hook_failures_total",
+	  "Hook processes that could not be started." },
+	{ "redshift_location_refreshes_total",
+	  "Locations obtained in the background." },
+	{ "redshift_location_failures_total",
+	  "Background location fetches that failed." }
+};
+
+static const metric_info_t histogram_info[METRIC_HISTOGRAM_COUNT] = {
+	{ "redshift_upload_latency_seconds",
+	  "Time taken to apply a setting to the display." },
+	{ "redshift_compute_latency_seconds",
+	  "Time taken to compute the setting of a tick." }
+};
+
+/* Quantiles reported for every histogram */
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+#define QUANTILE_COUNT  4
+
+typedef struct {
+	uint64_t buckets[METRICS_BUCKETS];
+	uint64_t count;
+	double sum;
+	double max;
+} histogram_t;
+
+/* Metrics are only updated from the main thread. */
+static uint64_t counters[METRIC_COUNTER_COUNT];
+static histogram_t histograms[METRIC_HISTOGRAM_COUNT];
+
+/* Ticks in each of the last minutes, and the minute they count */
+static uint64_t minute_ticks[RATE_MINUTES];
+static long minute_stamp[RATE_MINUTES];
+
+
+void
+metrics_count(metric_counter_t counter)
+{
+	counters[counter] += 1;
+}
+
+/* Count an iteration of the main loop at monotonic time NOW. */
+void
+metrics_tick(double now)
+{
+	counters[METRIC_TICKS] += 1;
+
+	long minute = (long)(now / 60.0);
+	int slot = minute % RATE_MINUTES;
+	if (minute_stamp[slot] != minute) {
+		minute_stamp[slot] = minute;
+		minute_ticks[slot] = 0;
+	}
+	minute_ticks[slot] += 1;
+}
+
+static int
+bucket_index(uint64_t value)
+{
+	if (value < METRICS_SUB_BUCKETS) return value;
+
+	int msb = 63 - __builtin_clzll(value);
+	int group = msb - METRICS_SUB_BUCKET_BITS + 1;
+	return group*METRICS_SUB_BUCKETS +
+		(int)(value >> (msb - METRICS_SUB_BUCKET_BITS)) -
+		METRICS_SUB_BUCKETS;
+}
+
+/* Lowest value of bucket INDEX and the number of values in it */
+static uint64_t
+bucket_lower(int index, uint64_t *width)
+{
+	if (index < METRICS_SUB_BUCKETS) {
+		*width = 1;
+		return index;
+	}
+
+	int group = index / METRICS_SUB_BUCKETS;
+	int sub = index % METRICS_SUB_BUCKETS;
+	*width = (uint64_t)1 << (group - 1);
+	return (uint64_t)(METRICS_SUB_BUCKETS + sub) << (group - 1);
+}
+
+/* Record a latency of SECONDS. */
+void
+metrics_observe(metric_histogram_t histogram, double seconds)
+{
+	histogram_t *h = &histograms[histogram];
+
+	if (!(seconds >= 0.0)) seconds = 0.0;
+	double usecs = seconds * 1000000.0;
+	uint64_t value = usecs < (double)UINT32_MAX ?
+		(uint64_t)(usecs + 0.5) : UINT32_MAX;
+
+	h->buckets[bucket_index(value)] += 1;
+	h->count += 1;
+	h->sum += seconds;
+	if (seconds > h->max) h->max = seconds;
+}
+
+/* Value in seconds below which fraction Q of the values fall. Values
+   are reported as the middle of their bucket. */
+static double
+histogram_quantile(const histogram_t *h, double q)
+{
+	if (h->count == 0) return NAN;
+
+	uint64_t rank = (uint64_t)ceil(q * h->count);
+	if (rank < 1) rank = 1;
+
+	uint64_t seen = 0;
+	for (int i = 0; i < METRICS_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen < rank) continue;
+
+		uint64_t width;
+		uint64_t lower = bucket_lower(i, &width);
+		double value = (lower + (width - 1) / 2.0) / 1000000.0;
+		return value < h->max ? value : h->max;
+	}
+
+	return h->max;
+}
+
+static void
+metrics_write_text(FILE *f, double now)
+{
+	for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+		const metric_info_t *info = &counter_info[i];
+		fprintf(f, "# HELP %s %s\n", info->name, info->help);
+		fprintf(f, "# TYPE %s counter\n", info->name);
+		fprintf(f, "%s %llu\n", info->name,
+			(unsigned long long)counters[i]);
+	}
+
+	uint64_t ticks = 0;
+	long minute = (long)(now / 60.0);
+	for (int i = 0; i < RATE_MINUTES; i++) {
+		if (minute_stamp[i] > minute - RATE_MINUTES) {
+			ticks += minute_ticks[i];
+		}
+	}
+	fputs("# HELP redshift_wakeups_per_hour"
+	      " Iterations of the main loop in the last hour.\n", f);
+	fputs("# TYPE redshift_wakeups_per_hour gauge\n", f);
+	fprintf(f, "redshift_wakeups_per_hour %llu\n",
+		(unsigned long long)ticks);
+
+	for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+		const metric_info_t *info = &histogram_info[i];
+		const histogram_t *h = &histograms[i];
+
+		fprintf(f, "# HELP %s %s\n", info->name, info->help);
+		fprintf(f, "# TYPE %s summary\n", info->name);
+		for (int j = 0; j < QUANTILE_COUNT; j++) {
+			double value = histogram_quantile(h, quantiles[j]);
+			if (isnan(value)) {
+				fprintf(f, "%s{quantile=\"%g\"} NaN\n",
+					info->name, quantiles[j]);
+			} else {
+				fprintf(f, "%s{quantile=\"%g\"} %.6f\n",
+					info->name, quantiles[j], value);
+			}
+		}
+		fprintf(f, "%s_sum %.6f\n", info->name, h->sum);
+		fprintf(f, "%s_count %llu\n", info->name,
+			(unsigned long long)h->count);
+
+		fprintf(f, "# TYPE %s_max gauge\n", info->name);
+		fprintf(f, "%s_max %.6f\n", info->name, h->max);
+	}
+}
+
+/* Write all metrics to PATH in the Prometheus text exposition format,
+   e.g. for the textfile collector of node_exporter. The file is
+   replaced atomically so readers never see a partial file. */
+int
+metrics_write(const char *path)
+{
+	char tmp_path[MAX_METRICS_PATH + 8];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	double now;
+	int r = systemtime_get_monotonic(&now);
+	if (r < 0) return -1;
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) return -1;
+
+	metrics_write_text(f, now);
+
+	if (fclose(f) != 0) {
+		remove(tmp_path);
+		return -1;
+	}
+
+	if (rename(tmp_path, path) < 0) {
+		remove(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
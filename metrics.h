@@ -0,0 +1,62 @@
+/* metrics.h -- Operational counters and latency histograms header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_METRICS_H
+#define REDSHIFT_METRICS_H
+
+#include <stdint.h>
+
+/* Minimum number of seconds between writes of the metrics file */
+#define METRICS_WRITE_INTERVAL  5.0
+
+/* Histograms record microseconds with 16 linear sub-buckets per
+   power of two, so a recorded value is within 6.25% of the true
+   value. Values above 2^32 microseconds are clamped. */
+#define METRICS_SUB_BUCKET_BITS  4
+#define METRICS_SUB_BUCKETS      (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_BITS         32
+#define METRICS_BUCKETS \
+	((METRICS_MAX_BITS - METRICS_SUB_BUCKET_BITS + 1) * \
+	 METRICS_SUB_BUCKETS)
+
+typedef enum {
+	METRIC_TICKS = 0,
+	METRIC_UPLOADS,
+	METRIC_UPLOADS_SKIPPED,
+	METRIC_ROUND_TRIPS,
+	METRIC_HOOK_SPAWNS,
+	METRIC_HOOK_FAILURES,
+	METRIC_LOCATION_REFRESHES,
+	METRIC_LOCATION_FAILURES,
+	METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+	METRIC_UPLOAD_LATENCY = 0,
+	METRIC_COMPUTE_LATENCY,
+	METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+
+void metrics_count(metric_counter_t counter);
+void metrics_tick(double now);
+void metrics_observe(metric_histogram_t histogram, double seconds);
+
+int metrics_write(const char *path);
+
+
+#endif /* ! REDSHIFT_METRICS_H */
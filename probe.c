@@ -0,0 +1,299 @@
+/* probe.c -- Concurrent startup probing source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#ifndef _WIN32
+# include <unistd.h>
+# include <pthread.h>
+#endif
+
+#include "probe.h"
+#include "systemtime.h"
+
+typedef enum {
+	SLOT_RUNNING = 0,
+	SLOT_SUCCEEDED,
+	SLOT_FAILED
+} slot_status_t;
+
+struct _PROBE;
+
+typedef struct {
+	struct _PROBE *probe;
+	int index;
+	probe_run_func *run;
+	probe_discard_func *discard;
+	void *data;
+	slot_status_t status;
+	double end;
+	/* Still running when the winner was chosen */
+	int abandoned;
+} probe_slot_t;
+
+/* Shared between the caller and the candidate threads. Candidates
+   that are abandoned keep it alive until they finish. */
+typedef struct _PROBE {
+#ifndef _WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+	int refs;
+	int decided;
+	int winner;
+	double start;
+	probe_slot_t *slots;
+} probe_t;
+
+
+#ifndef _WIN32
+
+static void
+probe_destroy(probe_t *probe)
+{
+	pthread_cond_destroy(&probe->cond);
+	pthread_mutex_destroy(&probe->lock);
+	free(probe->slots);
+	free(probe);
+}
+
+static void *
+probe_thread(void *data)
+{
+	probe_slot_t *slot = (probe_slot_t *)data;
+	probe_t *probe = slot->probe;
+
+	int r = slot->run(slot->data);
+
+	double now;
+	systemtime_get_monotonic(&now);
+
+	pthread_mutex_lock(&probe->lock);
+	slot->status = r == 0 ? SLOT_SUCCEEDED : SLOT_FAILED;
+	slot->end = now;
+
+	/* Once the winner is known the caller no longer looks at this
+	   candidate, so it has to clean up after itself. */
+	int discard = probe->decided && probe->winner != slot->index;
+	int last = --probe->refs == 0;
+	pthread_cond_signal(&probe->cond);
+	pthread_mutex_unlock(&probe->lock);
+
+	if (discard) slot->discard(slot->data, r == 0);
+	if (last) probe_destroy(probe);
+
+	return NULL;
+}
+
+/* Choose a winner among the candidates that have finished. Sets
+   PENDING if a candidate that could still win is running. */
+static int
+probe_choose(probe_t *probe, probe_job_t *jobs, int count,
+	     probe_mode_t mode, double deadline, double now,
+	     int *pending, double *wake)
+{
+	int winner = -1;
+	*pending = 0;
+	*wake = deadline > 0.0 ? deadline : INFINITY;
+
+	for (int i = 0; i < count; i++) {
+		probe_slot_t *slot = &probe->slots[i];
+
+		if (slot->status == SLOT_SUCCEEDED) {
+			if (winner < 0 || slot->end < probe->slots[winner].end) {
+				winner = i;
+			}
+			/* Earlier candidates have all failed or timed out. */
+			if (mode == PROBE_PRIORITY) break;
+			continue;
+		} else if (slot->status == SLOT_FAILED) {
+			continue;
+		}
+
+		double expiry = *wake;
+		if (jobs[i].timeout > 0.0 &&
+		    probe->start + jobs[i].timeout < expiry) {
+			expiry = probe->start + jobs[i].timeout;
+		}
+		if (now >= expiry) continue;
+
+		*pending = 1;
+		if (expiry < *wake) *wake = expiry;
+
+		/* A later candidate cannot win while this one may. */
+		if (mode == PROBE_PRIORITY) break;
+	}
+
+	return winner;
+}
+
+/* Run the COUNT candidates in JOBS concurrently and return the index
+   of the winner, or -1 if none succeeded in time. Candidates that
+   exceed their timeout or DEADLINE (monotonic time from
+   systemtime_get_monotonic, or zero for none)
+   are abandoned: they are left to finish and discard themselves in
+   the background. ABANDONED is set to the number of such candidates
+   if not NULL. */
+int
+probe_race(probe_job_t *jobs, int count, probe_mode_t mode,
+	   double deadline, int *abandoned)
+{
+	if (abandoned != NULL) *abandoned = 0;
+	if (count == 0) return -1;
+
+	probe_t *probe = (probe_t *)malloc(sizeof(probe_t));
+	if (probe == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
+	probe->slots = (probe_slot_t *)calloc(count, sizeof(probe_slot_t));
+	if (probe->slots == NULL) {
+		fprintf(stderr, "malloc");
+		free(probe);
+		return -1;
+	}
+
+	/* Deadlines are on the monotonic clock, so that the system
+	   clock being set while probing does not move them. */
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+#if _POSIX_TIMERS > 0
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+#endif
+	pthread_mutex_init(&probe->lock, NULL);
+	pthread_cond_init(&probe->cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	probe->refs = 1;
+	probe->decided = 0;
+	probe->winner = -1;
+	systemtime_get_monotonic(&probe->start);
+
+	pthread_mutex_lock(&probe->lock);
+
+	for (int i = 0; i < count; i++) {
+		probe_slot_t *slot = &probe->slots[i];
+		slot->probe = probe;
+		slot->index = i;
+		slot->run = jobs[i].run;
+		slot->discard = jobs[i].discard;
+		slot->data = jobs[i].data;
+		slot->status = SLOT_RUNNING;
+
+		pthread_t thread;
+		int r = pthread_create(&thread, NULL, probe_thread, slot);
+		if (r != 0) {
+			fprintf(stderr, "pthread_create");
+			slot->status = SLOT_FAILED;
+			continue;
+		}
+
+		pthread_detach(thread);
+		probe->refs += 1;
+	}
+
+	int winner;
+	while (1) {
+		double now;
+		systemtime_get_monotonic(&now);
+
+		int pending;
+		double wake;
+		winner = probe_choose(probe, jobs, count, mode, deadline,
+				      now, &pending, &wake);
+		if (winner >= 0 || !pending) break;
+
+		if (isinf(wake)) {
+			pthread_cond_wait(&probe->cond, &probe->lock);
+		} else {
+			struct timespec ts;
+			ts.tv_sec = (time_t)wake;
+			ts.tv_nsec = (long)((wake - ts.tv_sec) * 1000000000.0);
+			pthread_cond_timedwait(&probe->cond, &probe->lock,
+					       &ts);
+		}
+	}
+
+	probe->decided = 1;
+	probe->winner = winner;
+
+	if (winner >= 0) {
+		jobs[winner].elapsed = probe->slots[winner].end - probe->start;
+	}
+
+	/* Candidates that are still running discard themselves.
+	   Finished ones are no longer touched by their threads. */
+	for (int i = 0; i < count; i++) {
+		probe_slot_t *slot = &probe->slots[i];
+		slot->abandoned = slot->status == SLOT_RUNNING;
+		if (slot->abandoned && abandoned != NULL) *abandoned += 1;
+	}
+	pthread_mutex_unlock(&probe->lock);
+
+	for (int i = 0; i < count; i++) {
+		if (i == winner || probe->slots[i].abandoned) continue;
+		probe->slots[i].discard(probe->slots[i].data,
+					probe->slots[i].status ==
+					SLOT_SUCCEEDED);
+	}
+
+	pthread_mutex_lock(&probe->lock);
+	int last = --probe->refs == 0;
+	pthread_mutex_unlock(&probe->lock);
+
+	if (last) probe_destroy(probe);
+
+	return winner;
+}
+
+#else /* _WIN32 */
+
+/* Without threads the candidates are tried one at a time in order
+   and the first one that succeeds wins. */
+int
+probe_race(probe_job_t *jobs, int count, probe_mode_t mode,
+	   double deadline, int *abandoned)
+{
+	if (abandoned != NULL) *abandoned = 0;
+
+	int winner = -1;
+	for (int i = 0; i < count; i++) {
+		double start;
+		systemtime_get_monotonic(&start);
+
+		if (winner >= 0 || (deadline > 0.0 && start >= deadline)) {
+			jobs[i].discard(jobs[i].data, 0);
+			continue;
+		}
+
+		int r = jobs[i].run(jobs[i].data);
+		if (r == 0) {
+			double now;
+			systemtime_get_monotonic(&now);
+			jobs[i].elapsed = now - start;
+			winner = i;
+		} else {
+			jobs[i].discard(jobs[i].data, 0);
+		}
+	}
+
+	return winner;
+}
+
+#endif /* _WIN32 */
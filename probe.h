@@ -0,0 +1,53 @@
+/* probe.h -- Concurrent startup probing header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_PROBE_H
+#define REDSHIFT_PROBE_H
+
+/* Run a candidate. Blocks as long as needed and returns zero
+   on success. */
+typedef int probe_run_func(void *data);
+/* Release a candidate that was not chosen. STARTED is non-zero if
+   its run function succeeded. Called exactly once for every
+   candidate except the winner, possibly from another thread. */
+typedef void probe_discard_func(void *data, int started);
+
+typedef enum {
+	/* Choose the first candidate in the list that succeeds. */
+	PROBE_PRIORITY = 0,
+	/* Choose the candidate that succeeds first. */
+	PROBE_FIRST
+} probe_mode_t;
+
+typedef struct {
+	probe_run_func *run;
+	probe_discard_func *discard;
+	void *data;
+
+	/* Seconds the candidate may take, or zero for no limit */
+	double timeout;
+
+	/* Seconds the candidate took, set for the winner */
+	double elapsed;
+} probe_job_t;
+
+
+int probe_race(probe_job_t *jobs, int count, probe_mode_t mode,
+	       double deadline, int *abandoned);
+
+
+#endif /* ! REDSHIFT_PROBE_H */
@@ -49,6 +49,12 @@
 #include "systemtime.h"
 #include "hooks.h"
 #include "signals.h"
+#include "control.h"
+#include "transition.h"
+#include "location-cache.h"
+#include "probe.h"
+#include "trace.h"
+#include "metrics.h"
 
 /* pause() is not defined on windows platform but is not needed either.
    Use a noop macro instead. */
@@ -58,6 +64,14 @@
 
 #include "gamma-dummy.h"
 
+#ifdef ENABLE_SHM
+# include "gamma-shm.h"
+#endif
+
+#ifdef ENABLE_WAYLAND
+# include "gamma-wl.h"
+#endif
+
 #ifdef ENABLE_DRM
 # include "gamma-drm.h"
 #endif
@@ -80,6 +94,7 @@
 
 
 #include "location-manual.h"
+#include "location-timezone.h"
 
 #ifdef ENABLE_GEOCLUE
 # include "location-geoclue.h"
@@ -98,6 +113,10 @@
 
 /* Union of state data for gamma adjustment methods */
 typedef union {
+	gamma_dummy_state_t dummy;
+#ifdef ENABLE_WAYLAND
+	wayland_state_t wayland;
+#endif
 #ifdef ENABLE_DRM
 	drm_state_t drm;
 #endif
@@ -113,11 +132,26 @@ typedef union {
 #ifdef ENABLE_WINGDI
 	w32gdi_state_t w32gdi;
 #endif
+#ifdef ENABLE_SHM
+	shm_state_t shm;
+#endif
 } gamma_state_t;
 
 
 /* Gamma adjustment method structs */
 static const gamma_method_t gamma_methods[] = {
+#ifdef ENABLE_WAYLAND
+	{
+		"wayland", 1,
+		(gamma_method_init_func *)wayland_init,
+		(gamma_method_start_func *)wayland_start,
+		(gamma_method_free_func *)wayland_free,
+		(gamma_method_print_help_func *)wayland_print_help,
+		(gamma_method_set_option_func *)wayland_set_option,
+		(gamma_method_restore_func *)wayland_restore,
+		(gamma_method_set_temperature_func *)wayland_set_temperature
+	},
+#endif
 #ifdef ENABLE_DRM
 	{
 		"drm", 0,
@@ -127,7 +161,12 @@ static const gamma_method_t gamma_methods[] = {
 		(gamma_method_print_help_func *)drm_print_help,
 		(gamma_method_set_option_func *)drm_set_option,
 		(gamma_method_restore_func *)drm_restore,
-		(gamma_method_set_temperature_func *)drm_set_temperature
+		(gamma_method_set_temperature_func *)drm_set_temperature,
+		(gamma_method_wait_vblank_func *)drm_wait_vblank,
+		(gamma_method_revalidate_func *)drm_revalidate,
+		(gamma_method_prepare_func *)drm_prepare,
+		(gamma_method_set_prepared_func *)drm_set_prepared,
+		(gamma_method_readback_func *)drm_readback
 	},
 #endif
 #ifdef ENABLE_RANDR
@@ -139,7 +178,12 @@ static const gamma_method_t gamma_methods[] = {
 		(gamma_method_print_help_func *)randr_print_help,
 		(gamma_method_set_option_func *)randr_set_option,
 		(gamma_method_restore_func *)randr_restore,
-		(gamma_method_set_temperature_func *)randr_set_temperature
+		(gamma_method_set_temperature_func *)randr_set_temperature,
+		NULL,
+		(gamma_method_revalidate_func *)randr_revalidate,
+		(gamma_method_prepare_func *)randr_prepare,
+		(gamma_method_set_prepared_func *)randr_set_prepared,
+		(gamma_method_readback_func *)randr_readback
 	},
 #endif
 #ifdef ENABLE_VIDMODE
@@ -177,6 +221,18 @@ static const gamma_method_t gamma_methods[] = {
 		(gamma_method_restore_func *)w32gdi_restore,
 		(gamma_method_set_temperature_func *)w32gdi_set_temperature
 	},
+#endif
+#ifdef ENABLE_SHM
+	{
+		"shm", 0,
+		(gamma_method_init_func *)shm_init,
+		(gamma_method_start_func *)shm_start,
+		(gamma_method_free_func *)shm_free,
+		(gamma_method_print_help_func *)shm_print_help,
+		(gamma_method_set_option_func *)shm_set_option,
+		(gamma_method_restore_func *)shm_restore,
+		(gamma_method_set_temperature_func *)shm_set_temperature
+	},
 #endif
 	{
 		"dummy", 0,
@@ -186,7 +242,11 @@ static const gamma_method_t gamma_methods[] = {
 		(gamma_method_print_help_func *)gamma_dummy_print_help,
 		(gamma_method_set_option_func *)gamma_dummy_set_option,
 		(gamma_method_restore_func *)gamma_dummy_restore,
-		(gamma_method_set_temperature_func *)gamma_dummy_set_temperature
+		(gamma_method_set_temperature_func *)gamma_dummy_set_temperature,
+		NULL,
+		NULL,
+		(gamma_method_prepare_func *)gamma_dummy_prepare,
+		(gamma_method_set_prepared_func *)gamma_dummy_set_prepared
 	},
 	{ NULL }
 };
@@ -195,6 +255,7 @@ static const gamma_method_t gamma_methods[] = {
 /* Union of state data for location providers */
 typedef union {
 	location_manual_state_t manual;
+	location_timezone_state_t timezone;
 #ifdef ENABLE_GEOCLUE
 	location_geoclue_state_t geoclue;
 #endif
@@ -245,6 +306,18 @@ static const location_provider_t location_providers[] = {
 		location_corelocation_get_location
 	},
 #endif
+	{
+		"timezone",
+		(location_provider_init_func *)location_timezone_init,
+		(location_provider_start_func *)location_timezone_start,
+		(location_provider_free_func *)location_timezone_free,
+		(location_provider_print_help_func *)
+		location_timezone_print_help,
+		(location_provider_set_option_func *)
+		location_timezone_set_option,
+		(location_provider_get_location_func *)
+		location_timezone_get_location
+	},
 	{
 		"manual",
 		(location_provider_init_func *)location_manual_init,
@@ -290,7 +363,6 @@ static const location_provider_t location_providers[] = {
 
 /* Duration of sleep between screen updates (milliseconds). */
 #define SLEEP_DURATION        5000
-#define SLEEP_DURATION_SHORT  100
 
 /* Program modes. */
 typedef enum {
@@ -298,7 +370,8 @@ typedef enum {
 	PROGRAM_MODE_ONE_SHOT,
 	PROGRAM_MODE_PRINT,
 	PROGRAM_MODE_RESET,
-	PROGRAM_MODE_MANUAL
+	PROGRAM_MODE_MANUAL,
+	PROGRAM_MODE_BENCHMARK
 } program_mode_t;
 
 /* Transition scheme.
@@ -309,8 +382,49 @@ typedef struct {
 	double low;
 	color_setting_t day;
 	color_setting_t night;
+
+	/* Color space for interpolation and the smallest perceptual
+	   difference worth sending to the display. */
+	interpolation_t interpolation;
+	double min_delta_e;
 } transition_scheme_t;
 
+/* Seconds an adjustment method may take to start when
+   methods are probed. */
+#define METHOD_PROBE_TIMEOUT  5.0
+
+/* Seconds the location providers have to deliver a fix before
+   the cached or manually configured location is used. */
+#define LOCATION_PROBE_DEADLINE  10.0
+
+/* Phases of startup, in order. Each is timed from the end
+   of the previous one. */
+typedef enum {
+	STARTUP_OPTIONS = 0,
+	STARTUP_CONFIG,
+	STARTUP_LOCATION,
+	STARTUP_METHOD,
+	STARTUP_FIRST_ADJUSTMENT,
+	STARTUP_TARGET,
+	STARTUP_PHASES
+} startup_phase_t;
+
+static const char *startup_phase_names[STARTUP_PHASES] = {
+	N_("Command line"),
+	N_("Configuration"),
+	N_("Location"),
+	N_("Adjustment method"),
+	N_("First adjustment"),
+	/* TRANSLATORS: Time from the first adjustment until the
+	   initial transition reaches the target setting */
+	N_("Initial transition")
+};
+
+/* Monotonic time at startup and at the end of each phase, for
+   reporting the time to first ramp. */
+static double startup_time = NAN;
+static double startup_marks[STARTUP_PHASES];
+
 /* Names of periods of day */
 static const char *period_names[] = {
 	/* TRANSLATORS: Name printed when period of day is unknown */
@@ -402,8 +516,9 @@ interpolate_color_settings(const transition_scheme_t *transition,
 		(transition->low - transition->high);
 	alpha = CLAMP(0.0, alpha, 1.0);
 
-	result->temperature = (1.0-alpha)*night->temperature +
-		alpha*day->temperature;
+	result->temperature = transition_mix_temperature(
+		night->temperature, day->temperature, alpha,
+		transition->interpolation);
 	result->brightness = (1.0-alpha)*night->brightness +
 		alpha*day->brightness;
 	for (int i = 0; i < 3; i++) {
@@ -455,6 +570,10 @@ print_help(const char *program_name)
 		"  -O TEMP\tOne shot manual mode (set color temperature)\n"
 		"  -p\t\tPrint mode (only print parameters and exit)\n"
 		"  -x\t\tReset mode (erase adjustment from screen)\n"
+		"  -B N\t\tBenchmark mode (apply N settings and report"
+		" latency)\n"
+		"  -e\t\tExit once the screen is adjusted and report"
+		" startup time\n"
 		"  -r\t\tDisable temperature transitions\n"
 		"  -t DAY:NIGHT\tColor temperature to set at daytime/night\n"),
 	      stdout);
@@ -673,7 +792,9 @@ method_try_start(const gamma_method_t *method,
 	}
 
 	/* Start method. */
+	TRACE_BEGIN_CAT(start_span, method->name, "start");
 	r = method->start(state);
+	TRACE_END(start_span);
 	if (r < 0) {
 		method->free(state);
 		fprintf(stderr, _("Failed to start adjustment method %s.\n"),
@@ -684,6 +805,239 @@ method_try_start(const gamma_method_t *method,
 	return 0;
 }
 
+/* Location provider raced against the others for a fix. */
+typedef struct {
+	const location_provider_t *provider;
+	char *args;
+	config_ini_state_t *config;
+	location_state_t state;
+	location_t loc;
+} provider_probe_t;
+
+static int
+provider_probe_run(void *data)
+{
+	provider_probe_t *probe = (provider_probe_t *)data;
+
+	int r = provider_try_start(probe->provider, &probe->state,
+				   probe->config, probe->args);
+	if (r < 0) return -1;
+
+	r = probe->provider->get_location(&probe->state, &probe->loc);
+	probe->provider->free(&probe->state);
+	if (r < 0 || !location_is_valid(&probe->loc)) {
+		fprintf(stderr, _("Unable to get location from"
+				  " provider `%s'.\n"),
+			probe->provider->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+provider_probe_discard(void *data, int started)
+{
+	free(data);
+}
+
+/* Where and how long to look for the location. */
+typedef struct {
+	/* Provider given on the command line, or NULL for all */
+	const location_provider_t *provider;
+	char *provider_args;
+	config_ini_state_t *config;
+	/* Seconds until the search gives up */
+	double deadline;
+	int verbose;
+	/* Set if providers were still running at the deadline */
+	int abandoned;
+} location_search_t;
+
+/* Start the location providers at once and take the first valid
+   fix. The manual and time zone providers only take part if they
+   were requested, otherwise they are fallbacks of the caller. */
+static int
+location_search(location_search_t *search, location_t *loc)
+{
+	probe_job_t jobs[sizeof(location_providers)/
+			 sizeof(location_providers[0])];
+	int job_count = 0;
+	for (int i = 0; location_providers[i].name != NULL; i++) {
+		const location_provider_t *p = &location_providers[i];
+		if (search->provider != NULL) {
+			if (p != search->provider) continue;
+		} else if (strcmp(p->name, "manual") == 0 ||
+			   strcmp(p->name, "timezone") == 0) {
+			continue;
+		}
+
+		provider_probe_t *probe = (provider_probe_t *)
+			malloc(sizeof(provider_probe_t));
+		if (probe == NULL) {
+			fprintf(stderr, "malloc");
+			return -1;
+		}
+		probe->provider = p;
+		probe->args = search->provider_args;
+		probe->config = search->config;
+
+		jobs[job_count].run = provider_probe_run;
+		jobs[job_count].discard = provider_probe_discard;
+		jobs[job_count].data = probe;
+		jobs[job_count].timeout = 0.0;
+		job_count += 1;
+	}
+
+	double now;
+	int r = systemtime_get_monotonic(&now);
+	if (r < 0) now = 0.0;
+
+	int abandoned;
+	int winner = probe_race(jobs, job_count, PROBE_FIRST,
+				now + search->deadline, &abandoned);
+	if (abandoned > 0) search->abandoned = 1;
+	if (winner < 0) return -1;
+
+	provider_probe_t *probe = (provider_probe_t *)jobs[winner].data;
+	*loc = probe->loc;
+
+	printf(_("Using provider `%s'.\n"), probe->provider->name);
+	if (search->verbose) {
+		printf(_("Location from provider `%s' after %.0f ms.\n"),
+		       probe->provider->name, jobs[winner].elapsed*1000.0);
+	}
+	free(probe);
+
+	return 0;
+}
+
+/* Get the location from the provider called NAME, configured
+   from the configuration file only. */
+static int
+location_from_provider(config_ini_state_t *config, const char *name,
+		       location_t *loc)
+{
+	const location_provider_t *provider = location_providers;
+	while (strcmp(provider->name, name) != 0) provider++;
+
+	location_state_t state;
+	int r = provider_try_start(provider, &state, config, NULL);
+	if (r < 0) return -1;
+
+	r = provider->get_location(&state, loc);
+	provider->free(&state);
+
+	return r;
+}
+
+/* Read the location from the manual provider section of the
+   configuration, if both coordinates are given there. */
+static int
+location_from_config(config_ini_state_t *config, location_t *loc)
+{
+	config_ini_section_t *section =
+		config_ini_get_section(config, "manual");
+	if (section == NULL) return -1;
+
+	int have_lat = 0, have_lon = 0;
+	for (config_ini_setting_t *setting = section->settings;
+	     setting != NULL; setting = setting->next) {
+		if (strcasecmp(setting->name, "lat") == 0) have_lat = 1;
+		if (strcasecmp(setting->name, "lon") == 0) have_lon = 1;
+	}
+	if (!have_lat || !have_lon) return -1;
+
+	return location_from_provider(config, "manual", loc);
+}
+
+/* Search for the location in the background. If no provider
+   answers, the configured location replaces the approximate
+   one in use. */
+static int
+location_search_fetch(void *data, location_t *loc)
+{
+	location_search_t *search = (location_search_t *)data;
+
+	int r = location_search(search, loc);
+	if (r < 0 && search->provider == NULL) {
+		r = location_from_config(search->config, loc);
+	}
+
+	return r;
+}
+
+/* Adjustment method started concurrently with the others. */
+typedef struct {
+	const gamma_method_t *method;
+	config_ini_state_t *config;
+	gamma_state_t state;
+} method_probe_t;
+
+static int
+method_probe_run(void *data)
+{
+	method_probe_t *probe = (method_probe_t *)data;
+	return method_try_start(probe->method, &probe->state,
+				probe->config, NULL);
+}
+
+static void
+method_probe_discard(void *data, int started)
+{
+	method_probe_t *probe = (method_probe_t *)data;
+	if (started) probe->method->free(&probe->state);
+	free(probe);
+}
+
+static void
+startup_init()
+{
+	systemtime_get_monotonic(&startup_time);
+	for (int i = 0; i < STARTUP_PHASES; i++) startup_marks[i] = NAN;
+}
+
+/* Record the end of PHASE. Only the first call for a phase counts. */
+static void
+startup_mark(startup_phase_t phase)
+{
+	if (!isnan(startup_marks[phase])) return;
+	systemtime_get_monotonic(&startup_marks[phase]);
+}
+
+/* Record that an adjustment was applied. TARGET is set if it was the
+   setting itself rather than a step of the initial transition towards
+   it. Returns 1 the first time the target is applied. */
+static int
+startup_adjusted(int target)
+{
+	if (!isnan(startup_marks[STARTUP_TARGET])) return 0;
+
+	startup_mark(STARTUP_FIRST_ADJUSTMENT);
+	if (!target) return 0;
+
+	startup_mark(STARTUP_TARGET);
+	return 1;
+}
+
+/* Print how long each phase of startup took. */
+static void
+print_startup_report()
+{
+	fputs(_("Startup phases:\n"), stdout);
+
+	double prev = startup_time;
+	for (int i = 0; i < STARTUP_PHASES; i++) {
+		if (isnan(startup_marks[i])) continue;
+		printf(_("  %-20s %8.1f ms\n"), _(startup_phase_names[i]),
+		       (startup_marks[i] - prev)*1000.0);
+		prev = startup_marks[i];
+	}
+
+	printf(_("Target setting applied after %.1f ms.\n"),
+	       (prev - startup_time)*1000.0);
+}
+
 /* A gamma string contains either one floating point value,
    or three values separated by colon. */
 static int
@@ -770,22 +1124,156 @@ find_location_provider(const char *name)
 }
 
 
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Print percentiles of the COUNT latencies in SAMPLES (seconds). */
+static void
+print_latency(const char *label, double *samples, int count)
+{
+	qsort(samples, count, sizeof(double), compare_double);
+	printf(_("%s: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms,"
+		 " max %.3f ms\n"), label,
+	       samples[(count - 1)*50/100]*1000.0,
+	       samples[(count - 1)*90/100]*1000.0,
+	       samples[(count - 1)*99/100]*1000.0,
+	       samples[count - 1]*1000.0);
+}
+
+/* Apply COUNT settings alternating between BASE and the neutral
+   setting, as in a short transition, and report how long it takes
+   from a new setting until the method has applied it. Methods that
+   can read the ramps back do so before the time is taken, others
+   are only timed until the update was sent. Methods that can
+   prepare frames also report computing and uploading apart. */
+static int
+run_benchmark(const gamma_method_t *method, gamma_state_t *state,
+	      const color_setting_t *base, int count)
+{
+	int r;
+
+	double *apply = (double *)malloc(3*count*sizeof(double));
+	if (apply == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+	double *compute = &apply[count];
+	double *upload = &apply[2*count];
+
+	void *frame = NULL;
+	long frame_size = 0;
+	if (method->prepare != NULL && method->set_prepared != NULL) {
+		frame_size = method->prepare(state, base, NULL);
+		if (frame_size > 0) frame = malloc(frame_size);
+	}
+
+	double start;
+	systemtime_get_monotonic(&start);
+
+	for (int i = 0; i < count; i++) {
+		/* Sweep towards neutral and back so consecutive settings
+		   differ like the frames of a transition do. */
+		double alpha = (double)(i % 64)/63;
+		if ((i / 64) % 2 == 1) alpha = 1.0 - alpha;
+
+		color_setting_t setting;
+		transition_mix_setting(base, NEUTRAL_TEMP, alpha,
+				       INTERPOLATION_LINEAR, &setting);
+
+		double t0, t1, t2;
+		systemtime_get_monotonic(&t0);
+		if (frame != NULL) {
+			r = method->prepare(state, &setting, frame) < 0 ?
+				-1 : 0;
+			systemtime_get_monotonic(&t1);
+			if (r == 0) r = method->set_prepared(state, frame);
+		} else {
+			r = method->set_temperature(state, &setting);
+			t1 = t0;
+		}
+		if (r == 0 && method->readback != NULL) {
+			r = method->readback(state);
+		}
+		systemtime_get_monotonic(&t2);
+
+		if (r < 0) {
+			fputs(_("Temperature adjustment failed.\n"),
+			      stderr);
+			free(frame);
+			free(apply);
+			return -1;
+		}
+
+		apply[i] = t2 - t0;
+		compute[i] = t1 - t0;
+		upload[i] = t2 - t1;
+	}
+
+	double end;
+	systemtime_get_monotonic(&end);
+
+	printf(_("Method `%s': %i updates in %.3f s, %.1f updates/s.\n"),
+	       method->name, count, end - start, count/(end - start));
+	if (method->readback == NULL) {
+		printf(_("Updates are timed until sent, the method"
+			 " cannot read them back.\n"));
+	}
+	print_latency(_("Apply"), apply, count);
+	if (frame != NULL) {
+		printf(_("Frame size: %li bytes.\n"), frame_size);
+		print_latency(_("Compute"), compute, count);
+		print_latency(_("Upload"), upload, count);
+	}
+
+	free(frame);
+	free(apply);
+
+	method->restore(state);
+
+	return 0;
+}
+
+
 /* Run continual mode loop
    This is the main loop of the continual mode which keeps track of the
    current time and continuously updates the screen to the appropriate
    color temperature. */
 static int
-run_continual_mode(const location_t *loc,
+run_continual_mode(location_t *loc,
+		   location_refresh_t *refresh,
 		   const transition_scheme_t *scheme,
 		   const gamma_method_t *method,
 		   gamma_state_t *state,
-		   int transition, int verbose)
+		   control_state_t *ctl,
+		   systemtime_watch_t *watch,
+		   unsigned int frame_budget,
+		   const char *metrics_path,
+		   int transition, int exit_after_apply, int verbose)
 {
 	int r;
 
+	/* Time the metrics file was last written */
+	double metrics_written = -INFINITY;
+
 	/* Make an initial transition from 6500K */
 	int short_trans_delta = -1;
 	int short_trans_len = 10;
+	int short_trans_start = 1;
+
+	/* Short transitions are driven by time and paced by the
+	   display refresh when the method supports it. */
+	transition_t trans;
+	transition_init(&trans, frame_budget);
+
+	/* Frames of the ongoing short transition computed
+	   ahead of time, if the method supports it. */
+	transition_plan_t plan;
+	transition_plan_init(&plan);
 
 	/* Amount of adjustment to apply. At zero the color
 	   temperature will be exactly as calculated, and at one it
@@ -808,19 +1296,48 @@ run_continual_mode(const location_t *loc,
 	color_setting_t prev_interp =
 		{ -1, { NAN, NAN, NAN }, NAN };
 
+	/* Last setting sent to the display. Updates that are
+	   not perceptibly different from it are skipped. */
+	color_setting_t applied =
+		{ -1, { NAN, NAN, NAN }, NAN };
+
 	/* Continuously adjust color temperature */
 	int done = 0;
 	int disabled = 0;
+	int prev_paused = 0;
+	int keep_adjustment = 0;
 	while (1) {
+		/* Check whether a control client paused or resumed. Only
+		   a change of the pause state toggles, so a disable by
+		   signal is not undone by a socket that is not paused. */
+		int pause_toggle = 0;
+		if (ctl != NULL) {
+			double now;
+			r = systemtime_get_time(&now);
+			if (r == 0) {
+				int paused = control_is_paused(ctl, now);
+				pause_toggle = paused != prev_paused &&
+					paused != disabled;
+				prev_paused = paused;
+			}
+		}
+
 		/* Check to see if disable signal was caught */
-		if (disable) {
+		if (disable || pause_toggle) {
 			short_trans_len = 2;
+			short_trans_start = 1;
 			if (!disabled) {
 				/* Transition to disabled state */
 				short_trans_delta = 1;
 			} else {
 				/* Transition back to enabled */
 				short_trans_delta = -1;
+
+				/* Toggling by signal ends a pause */
+				if (ctl != NULL) {
+					control_resume(ctl);
+					prev_paused = 0;
+				}
 			}
 			disabled = !disabled;
 			disable = 0;
@@ -844,6 +1361,7 @@ run_continual_mode(const location_t *loc,
 					   back to 6500K */
 					short_trans_delta = 1;
 					short_trans_len = 2;
+					short_trans_start = 1;
 				}
 
 				done = 1;
@@ -851,13 +1369,79 @@ run_continual_mode(const location_t *loc,
 			exiting = 0;
 		}
 
+#ifdef ENABLE_TRACE
+		/* Check to see if trace dump signal was caught */
+		if (dump_trace) {
+			trace_dump(NULL);
+			dump_trace = 0;
+		}
+#endif
+
+		/* After the clock was set or the system resumed the
+		   adjustment may be stale, or reset by the driver.
+		   Check the display and apply it again right away. */
+		if (systemtime_watch_changed(watch)) {
+			if (verbose) {
+				fputs(_("System clock changed or system"
+					" resumed.\n"), stdout);
+			}
+			if (method->revalidate != NULL) {
+				r = method->revalidate(state);
+				if (r < 0) {
+					fputs(_("Unable to check display"
+						" state.\n"), stderr);
+					transition_plan_free(&plan);
+					return -1;
+				}
+			}
+			applied.temperature = -1;
+			plan.valid = 0;
+		}
+
 		/* Read timestamp */
 		double now;
 		r = systemtime_get_time(&now);
 		if (r < 0) {
 			fputs(_("Unable to read system time.\n"), stderr);
+			transition_plan_free(&plan);
+			return -1;
+		}
+
+		double tick_start;
+		r = systemtime_get_monotonic(&tick_start);
+		if (r < 0) {
+			fputs(_("Unable to read system time.\n"), stderr);
+			transition_plan_free(&plan);
 			return -1;
 		}
+		metrics_tick(tick_start);
+
+		/* Pick up a location fetched in the background. The
+		   schedule only changes if the fix moved far enough. */
+		if (refresh != NULL) {
+			location_t fix;
+			location_refresh_status_t status =
+				location_refresh_poll(refresh, &fix);
+			if (status == LOCATION_REFRESH_DONE) {
+				metrics_count(METRIC_LOCATION_REFRESHES);
+				location_cache_save(&fix);
+				if (location_distance(loc, &fix) >=
+				    refresh->threshold) {
+					*loc = fix;
+					if (verbose) print_location(loc);
+				}
+			} else if (status == LOCATION_REFRESH_FAILED) {
+				metrics_count(METRIC_LOCATION_FAILURES);
+				fputs(_("Unable to update location;"
+					" keeping cached location.\n"),
+				      stderr);
+			}
+
+			if (status != LOCATION_REFRESH_PENDING) {
+				location_refresh_free(refresh);
+				refresh = NULL;
+			}
+		}
 
 		/* Skip over transition if transitions are disabled */
 		int set_adjustments = 0;
@@ -871,12 +1455,30 @@ run_continual_mode(const location_t *loc,
 		}
 
 		/* Current angular elevation of the sun */
+		TRACE_BEGIN(solar_span, "solar_elevation");
 		double elevation = solar_elevation(now, loc->lat,
 						   loc->lon);
+		TRACE_END(solar_span);
 
 		/* Use elevation of sun to set color temperature */
+		TRACE_BEGIN(interp_span, "interpolate");
 		color_setting_t interp;
 		interpolate_color_settings(scheme, elevation, &interp);
+		TRACE_END(interp_span);
+
+		/* Apply overrides set by control clients */
+		if (ctl != NULL) {
+			if (ctl->temperature > 0) {
+				interp.temperature = CLAMP(MIN_TEMP,
+							   ctl->temperature,
+							   MAX_TEMP);
+			}
+			if (!isnan(ctl->brightness)) {
+				interp.brightness = CLAMP(MIN_BRIGHTNESS,
+							  ctl->brightness,
+							  MAX_BRIGHTNESS);
+			}
+		}
 
 		/* Print period if it changed during this update,
 		   or if we are in transition. In transition we
@@ -893,32 +1495,73 @@ run_continual_mode(const location_t *loc,
 
 		/* Activate hooks if period changed */
 		if (period != prev_period) {
+			TRACE_BEGIN(hooks_span, "hooks");
 			hooks_signal_period_change(prev_period, period);
+			TRACE_END(hooks_span);
 		}
 
 		/* Ongoing short transition */
+		int in_transition = short_trans_delta != 0;
+		const void *frame = NULL;
 		if (short_trans_delta) {
+			double mono;
+			r = systemtime_get_monotonic(&mono);
+			if (r < 0) {
+				fputs(_("Unable to read system time.\n"),
+				      stderr);
+				transition_plan_free(&plan);
+				return -1;
+			}
+
+			if (short_trans_start) {
+				transition_start(&trans, adjustment_alpha,
+						 short_trans_delta < 0 ?
+						 0.0 : 1.0,
+						 short_trans_len, mono);
+				short_trans_start = 0;
+
+				/* Compute all frames up front so each
+				   step is only an upload. */
+				TRACE_BEGIN(plan_span, "transition_plan");
+				transition_plan_build(&plan, &trans, &interp,
+						      NEUTRAL_TEMP,
+						      scheme->interpolation,
+						      method, state);
+				TRACE_END(plan_span);
+			}
+
 			/* Calculate alpha */
-			adjustment_alpha += short_trans_delta * 0.1 /
-				(float)short_trans_len;
+			adjustment_alpha = transition_step(&trans, mono);
+
+			/* Use the precomputed frame unless the
+			   target changed since the transition began. */
+			frame = transition_plan_frame(&plan, &trans, &interp);
 
 			/* Stop transition when done */
-			if (adjustment_alpha <= 0.0 ||
-			    adjustment_alpha >= 1.0) {
+			if (!trans.active) {
 				short_trans_delta = 0;
+				plan.valid = 0;
 			}
-
-			/* Clamp alpha value */
-			adjustment_alpha = CLAMP(0.0, adjustment_alpha, 1.0);
 		}
 
 		/* Interpolate between 6500K and calculated
 		   temperature */
-		interp.temperature = adjustment_alpha*6500 +
-			(1.0-adjustment_alpha)*interp.temperature;
+		TRACE_BEGIN(mix_span, "transition_mix");
+		if (frame != NULL) {
+			::memcpy_dup(&interp, frame, sizeof(color_setting_t));
+		} else {
+			transition_mix_setting(&interp, NEUTRAL_TEMP,
+					       adjustment_alpha,
+					       scheme->interpolation,
+					       &interp);
+		}
+		TRACE_END(mix_span);
 
-		interp.brightness = adjustment_alpha*1.0 +
-			(1.0-adjustment_alpha)*interp.brightness;
+		double compute_end;
+		if (systemtime_get_monotonic(&compute_end) == 0) {
+			metrics_observe(METRIC_COMPUTE_LATENCY,
+					compute_end - tick_start);
+		}
 
 		/* Quit loop when done */
 		if (done && !short_trans_delta) break;
@@ -936,14 +1579,78 @@ run_continual_mode(const location_t *loc,
 			}
 		}
 
-		/* Adjust temperature */
-		if (!disabled || short_trans_delta || set_adjustments) {
-			r = method->set_temperature(state, &interp);
+		/* Notify control clients */
+		if (ctl != NULL) {
+			control_publish(ctl, &interp, period, disabled, loc);
+		}
+
+		/* Adjust temperature. The first update, the final frame
+		   of a transition and explicit adjustments are always
+		   applied. */
+		int force = set_adjustments ||
+			(in_transition && !short_trans_delta);
+		if ((!disabled || in_transition || set_adjustments) &&
+		    !force && transition_delta_e(&applied, &interp) <
+		    scheme->min_delta_e) {
+			metrics_count(METRIC_UPLOADS_SKIPPED);
+		} else if (!disabled || in_transition || set_adjustments) {
+			double upload_start, upload_end;
+			int timed = systemtime_get_monotonic(&upload_start) == 0;
+
+			TRACE_BEGIN_CAT(apply_span, method->name, "apply");
+			if (frame != NULL) {
+				r = method->set_prepared(state, frame);
+			} else {
+				r = method->set_temperature(state, &interp);
+			}
+			TRACE_END(apply_span);
 			if (r < 0) {
 				fputs(_("Temperature adjustment"
 					" failed.\n"), stderr);
+				transition_plan_free(&plan);
 				return -1;
 			}
+
+			metrics_count(METRIC_UPLOADS);
+			if (timed && systemtime_get_monotonic(&upload_end) == 0) {
+				metrics_observe(METRIC_UPLOAD_LATENCY,
+						upload_end - upload_start);
+			}
+
+			::memcpy_dup(&applied, &interp,
+			       sizeof(color_setting_t));
+
+			if (startup_adjusted(!short_trans_delta) &&
+			    (verbose || exit_after_apply)) {
+				print_startup_report();
+			}
+
+			/* Exit with the adjustment in place */
+			if (exit_after_apply && !short_trans_delta) {
+				keep_adjustment = 1;
+				break;
+			}
+		}
+
+		if (verbose && in_transition && !short_trans_delta) {
+			printf(_("Transition: %u frames, %u dropped,"
+				 " %u over budget\n"), trans.frames + 1,
+			       trans.dropped, trans.over_budget);
+		}
+
+		/* Write metrics, at most every few seconds during
+		   a transition. A file that cannot be written is given
+		   up on rather than reported on every tick. */
+		if (metrics_path != NULL &&
+		    tick_start - metrics_written >= METRICS_WRITE_INTERVAL) {
+			r = metrics_write(metrics_path);
+			if (r < 0) {
+				fprintf(stderr, _("Unable to write metrics"
+						  " to `%s'.\n"),
+					metrics_path);
+				metrics_path = NULL;
+			}
+			metrics_written = tick_start;
 		}
 
 		/* Save temperature as previous */
@@ -951,16 +1658,47 @@ run_continual_mode(const location_t *loc,
 		::memcpy_dup(&prev_interp, &interp,
 		       sizeof(color_setting_t));
 
-		/* millis_sleep for 5 seconds or 0.1 second. */
+		/* millis_sleep for 5 seconds, or until the next frame of
+		   a short transition, waking up early if the clock is set
+		   or the system resumes. When a control socket is open,
+		   serve clients meanwhile and wake up early if they change
+		   an override. */
+		unsigned int sleep_duration = SLEEP_DURATION;
 		if (short_trans_delta) {
-			systemtime_msleep(SLEEP_DURATION_SHORT);
+			double mono;
+			r = systemtime_get_monotonic(&mono);
+			if (r < 0) {
+				fputs(_("Unable to read system time.\n"),
+				      stderr);
+				transition_plan_free(&plan);
+				return -1;
+			}
+
+			transition_frame_done(&trans, mono);
+			sleep_duration = transition_wait_frame(&trans, method,
+							       state, mono);
+		}
+
+		if (sleep_duration == 0) {
+			/* Paced by vertical blank */
+		} else if (ctl != NULL) {
+			int fd = systemtime_watch_arm(watch, sleep_duration);
+			r = control_wait(ctl, sleep_duration, fd);
+			if (r < 0) {
+				transition_plan_free(&plan);
+				return -1;
+			}
 		} else {
-			systemtime_msleep(SLEEP_DURATION);
+			systemtime_watch_sleep(watch, sleep_duration);
 		}
 	}
 
+	transition_plan_free(&plan);
+
+	if (metrics_path != NULL) metrics_write(metrics_path);
+
 	/* Restore saved gamma ramps */
-	method->restore(state);
+	if (!keep_adjustment) method->restore(state);
 
 	return 0;
 }
@@ -970,6 +1708,8 @@ main(int argc, char *argv[])
 {
 	int r;
 
+	startup_init();
+
 #ifdef ENABLE_NLS
 	/* Init locale */
 	setlocale(LC_CTYPE, "");
@@ -996,8 +1736,12 @@ main(int argc, char *argv[])
 	scheme.night.gamma[0] = NAN;
 	scheme.night.brightness = NAN;
 
+	scheme.interpolation = INTERPOLATION_LINEAR;
+	scheme.min_delta_e = NAN;
+
 	/* Temperature for manual mode */
 	int temp_set = -1;
+	int benchmark_count = 0;
 
 	const gamma_method_t *method = NULL;
 	char *method_args = NULL;
@@ -1008,6 +1752,12 @@ main(int argc, char *argv[])
 	int transition = -1;
 	program_mode_t mode = PROGRAM_MODE_CONTINUAL;
 	int verbose = 0;
+	int exit_after_apply = 0;
+	char *control_path = NULL;
+	char *metrics_path = NULL;
+	int frame_budget = -1;
+	double location_threshold = NAN;
+	double location_deadline = NAN;
 	char *s;
 
 	/* Flush messages consistently even if redirected to a pipe or
@@ -1018,17 +1768,24 @@ main(int argc, char *argv[])
 
 	/* Parse command line arguments. */
 	int opt;
-	while ((opt = getopt(argc, argv, "b:c:g:hl:m:oO:prt:vVx")) != -1) {
+	while ((opt = getopt(argc, argv, "b:B:c:eg:hl:m:oO:prt:vVx")) != -1) {
 		switch (opt) {
 		case 'b':
 			parse_brightness_string(optarg,
 						&scheme.day.brightness,
 						&scheme.night.brightness);
 			break;
+		case 'B':
+			mode = PROGRAM_MODE_BENCHMARK;
+			benchmark_count = atoi(optarg);
+			break;
 		case 'c':
 			free(config_filepath);
 			config_filepath = strdup(optarg);
 			break;
+		case 'e':
+			exit_after_apply = 1;
+			break;
 		case 'g':
 			r = parse_gamma_string(optarg, scheme.day.gamma);
 			if (r < 0) {
@@ -1167,6 +1924,8 @@ main(int argc, char *argv[])
 		}
 	}
 
+	startup_mark(STARTUP_OPTIONS);
+
 	/* Load settings from config file. */
 	config_ini_state_t config_state;
 	r = config_ini_init(&config_state, config_filepath);
@@ -1276,6 +2035,36 @@ main(int argc, char *argv[])
 						exit(EXIT_FAILURE);
 					}
 				}
+			} else if (strcasecmp(setting->name,
+					      "interpolation") == 0) {
+				r = transition_parse_interpolation(
+					setting->value, &scheme.interpolation);
+				if (r < 0) {
+					fprintf(stderr, _("Unknown interpolation"
+							  " `%s'.\n"),
+						setting->value);
+					exit(EXIT_FAILURE);
+				}
+			} else if (strcasecmp(setting->name,
+					      "min-delta-e") == 0) {
+				scheme.min_delta_e = atof(setting->value);
+			} else if (strcasecmp(setting->name,
+					      "location-threshold") == 0) {
+				location_threshold = atof(setting->value);
+			} else if (strcasecmp(setting->name,
+					      "location-deadline") == 0) {
+				location_deadline = atof(setting->value);
+			} else if (strcasecmp(setting->name,
+					      "frame-budget") == 0) {
+				frame_budget = atoi(setting->value);
+			} else if (strcasecmp(setting->name,
+					      "control-socket") == 0) {
+				free(control_path);
+				control_path = strdup(setting->value);
+			} else if (strcasecmp(setting->name,
+					      "metrics-file") == 0) {
+				free(metrics_path);
+				metrics_path = strdup(setting->value);
 			} else if (strcasecmp(setting->name,
 					      "location-provider") == 0) {
 				if (provider == NULL) {
@@ -1327,63 +2116,109 @@ main(int argc, char *argv[])
 	}
 
 	if (transition < 0) transition = 1;
+	if (frame_budget <= 0) frame_budget = TRANSITION_FRAME_BUDGET;
+	if (isnan(scheme.min_delta_e)) {
+		scheme.min_delta_e = TRANSITION_MIN_DELTA_E;
+	}
+	if (isnan(location_deadline) || location_deadline <= 0.0) {
+		location_deadline = LOCATION_PROBE_DEADLINE;
+	}
 
-	location_t loc = { NAN, NAN };
+	startup_mark(STARTUP_CONFIG);
 
-	/* Initialize location provider. If provider is NULL
-	   try all providers until one that works is found. */
-	location_state_t location_state;
+	location_t loc = { NAN, NAN };
 
-	/* Location is not needed for reset mode and manual mode. */
+	/* Find the location. If provider is NULL all providers are
+	   raced and the first fix within the deadline is used. */
+	location_search_t search = {
+		provider, provider_args, &config_state,
+		location_deadline, verbose, 0
+	};
+	location_refresh_t refresh;
+	location_refresh_t *refreshing = NULL;
+
+	/* Location is not needed for reset, manual and
+	   benchmark mode. */
 	if (mode != PROGRAM_MODE_RESET &&
-	    mode != PROGRAM_MODE_MANUAL) {
-		if (provider != NULL) {
-			/* Use provider specified on command line. */
-			r = provider_try_start(provider, &location_state,
-					       &config_state, provider_args);
-			if (r < 0) exit(EXIT_FAILURE);
-		} else {
-			/* Try all providers, use the first that works. */
-			for (int i = 0;
-			     location_providers[i].name != NULL; i++) {
-				const location_provider_t *p =
-					&location_providers[i];
-				fprintf(stderr,
-					_("Trying location provider `%s'...\n"),
-					p->name);
-				r = provider_try_start(p, &location_state,
-						       &config_state, NULL);
-				if (r < 0) {
-					fputs(_("Trying next provider...\n"),
-					      stderr);
-					continue;
-				}
+	    mode != PROGRAM_MODE_MANUAL &&
+	    mode != PROGRAM_MODE_BENCHMARK) {
+		/* Locations given by the user or derived from the time
+		   zone are used as is and not cached. */
+		int exact = provider != NULL &&
+			(strcmp(provider->name, "manual") == 0 ||
+			 strcmp(provider->name, "timezone") == 0);
+
+		/* In continual mode start with the last known location, or
+		   the location of the time zone, and let the providers
+		   update it in the background. */
+		int use_cache = 0, use_timezone = 0;
+		if (mode == PROGRAM_MODE_CONTINUAL && !exact) {
+			use_cache = location_cache_load(&loc) == 0;
+			if (!use_cache && provider == NULL) {
+				use_timezone = location_from_provider(
+					&config_state, "timezone", &loc) == 0;
+			}
+		}
 
-				/* Found provider that works. */
-				printf(_("Using provider `%s'.\n"), p->name);
-				provider = p;
-				break;
+		if (use_cache || use_timezone) {
+			/* The search may outlive this function, so it
+			   gets a copy of its own. */
+			location_search_t *background = (location_search_t *)
+				malloc(sizeof(location_search_t));
+			if (background == NULL) {
+				fprintf(stderr, "malloc");
+				exit(EXIT_FAILURE);
 			}
+			*background = search;
 
-			/* Failure if no providers were successful at this
-			   point. */
-			if (provider == NULL) {
-				fputs(_("No more location providers"
-					" to try.\n"), stderr);
+			r = location_refresh_start(&refresh,
+						   location_search_fetch,
+						   background, free);
+			if (r < 0) {
+				free(background);
 				exit(EXIT_FAILURE);
 			}
-		}
+			if (!isnan(location_threshold)) {
+				refresh.threshold = location_threshold;
+			}
+			refreshing = &refresh;
 
-		/* Get current location. */
-		r = provider->get_location(&location_state, &loc);
-		if (r < 0) {
-		        fputs(_("Unable to get location from provider.\n"),
-		              stderr);
-		        exit(EXIT_FAILURE);
+			if (verbose) {
+				fputs(use_cache ?
+				      _("Using cached location until a"
+					" provider responds.\n") :
+				      _("Using location of the time zone until"
+					" a provider responds.\n"), stdout);
+			}
+		} else {
+			/* Get current location, falling back to the last
+			   known location, the configured one and finally
+			   the location of the time zone. */
+			r = location_search(&search, &loc);
+			if (r == 0) {
+				if (!exact) location_cache_save(&loc);
+			} else if (exact) {
+				exit(EXIT_FAILURE);
+			} else if (location_cache_load(&loc) == 0) {
+				fputs(_("Unable to get location from provider;"
+					" using cached location.\n"), stderr);
+			} else if (location_from_config(&config_state,
+							&loc) == 0) {
+				fputs(_("Unable to get location from provider;"
+					" using manual location.\n"), stderr);
+			} else if (location_from_provider(&config_state,
+							  "timezone",
+							  &loc) == 0) {
+				fputs(_("Unable to get location from provider;"
+					" using location of the time zone.\n"),
+				      stderr);
+			} else {
+				fputs(_("Unable to get location from"
+					" provider.\n"), stderr);
+				exit(EXIT_FAILURE);
+			}
 		}
 
-		provider->free(&location_state);
-
 		if (verbose) {
 			print_location(&loc);
 
@@ -1434,6 +2269,14 @@ main(int argc, char *argv[])
 		}
 	}
 
+	startup_mark(STARTUP_LOCATION);
+
+	if (mode == PROGRAM_MODE_BENCHMARK && benchmark_count < 1) {
+		fputs(_("Number of benchmark updates must be positive.\n"),
+		      stderr);
+		exit(EXIT_FAILURE);
+	}
+
 	if (mode == PROGRAM_MODE_MANUAL) {
 		/* Check color temperature to be set */
 		if (temp_set < MIN_TEMP || temp_set > MAX_TEMP) {
@@ -1482,42 +2325,79 @@ main(int argc, char *argv[])
 
 	/* Initialize gamma adjustment method. If method is NULL
 	   try all methods until one that works is found. */
-	gamma_state_t state;
+	gamma_state_t method_state;
+	gamma_state_t *state = &method_state;
+	/* Probe of the method in use. Its state stays where it was
+	   started, as the method may have handed out pointers to it. */
+	method_probe_t *method_probe = NULL;
+	int abandoned = 0;
 
 	/* Gamma adjustment not needed for print mode */
 	if (mode != PROGRAM_MODE_PRINT) {
 		if (method != NULL) {
 			/* Use method specified on command line. */
-			r = method_try_start(method, &state, &config_state,
+			r = method_try_start(method, state, &config_state,
 					     method_args);
 			if (r < 0) exit(EXIT_FAILURE);
 		} else {
-			/* Try all methods, use the first that works. */
+			/* Start all methods at once and use the first one
+			   in the list that works, so a slow display does
+			   not add to the time spent on failing methods. */
+			probe_job_t jobs[sizeof(gamma_methods)/
+					 sizeof(gamma_methods[0])];
+			int job_count = 0;
 			for (int i = 0; gamma_methods[i].name != NULL; i++) {
 				const gamma_method_t *m = &gamma_methods[i];
 				if (!m->autostart) continue;
 
-				r = method_try_start(m, &state, &config_state, NULL);
-				if (r < 0) {
-					fputs(_("Trying next method...\n"), stderr);
-					continue;
+				method_probe_t *probe = (method_probe_t *)
+					malloc(sizeof(method_probe_t));
+				if (probe == NULL) {
+					fprintf(stderr, "malloc");
+					exit(EXIT_FAILURE);
 				}
-
-				/* Found method that works. */
-				printf(_("Using method `%s'.\n"), m->name);
-				method = m;
-				break;
+				probe->method = m;
+				probe->config = &config_state;
+
+				jobs[job_count].run = method_probe_run;
+				jobs[job_count].discard = method_probe_discard;
+				jobs[job_count].data = probe;
+				jobs[job_count].timeout = METHOD_PROBE_TIMEOUT;
+				job_count += 1;
 			}
 
+			int winner = probe_race(jobs, job_count,
+						PROBE_PRIORITY, 0.0,
+						&abandoned);
+
 			/* Failure if no methods were successful at this point. */
-			if (method == NULL) {
+			if (winner < 0) {
 				fputs(_("No more methods to try.\n"), stderr);
 				exit(EXIT_FAILURE);
 			}
+
+			method_probe_t *probe =
+				(method_probe_t *)jobs[winner].data;
+			method = probe->method;
+			state = &probe->state;
+			method_probe = probe;
+
+			printf(_("Using method `%s'.\n"), method->name);
+			if (verbose) {
+				printf(_("Method `%s' started in %.0f ms.\n"),
+				       method->name,
+				       jobs[winner].elapsed*1000.0);
+			}
 		}
 	}
 
-	config_ini_free(&config_state);
+	startup_mark(STARTUP_METHOD);
+
+	/* Methods and providers that are still running may be
+	   reading the configuration; it is left for the process exit. */
+	if (abandoned == 0 && !search.abandoned && refreshing == NULL) {
+		config_ini_free(&config_state);
+	}
 
 	switch (mode) {
 	case PROGRAM_MODE_ONE_SHOT:
@@ -1528,7 +2408,7 @@ main(int argc, char *argv[])
 		r = systemtime_get_time(&now);
 		if (r < 0) {
 			fputs(_("Unable to read system time.\n"), stderr);
-			method->free(&state);
+			method->free(state);
 			exit(EXIT_FAILURE);
 		}
 
@@ -1561,13 +2441,17 @@ main(int argc, char *argv[])
 		}
 
 		/* Adjust temperature */
-		r = method->set_temperature(&state, &interp);
+		r = method->set_temperature(state, &interp);
 		if (r < 0) {
 			fputs(_("Temperature adjustment failed.\n"), stderr);
-			method->free(&state);
+			method->free(state);
 			exit(EXIT_FAILURE);
 		}
 
+		if (startup_adjusted(1) && (verbose || exit_after_apply)) {
+			print_startup_report();
+		}
+
 		/* In Quartz (OSX) the gamma adjustments will automatically
 		   revert when the process exits. Therefore, we have to loop
 		   until CTRL-C is received. */
@@ -1585,10 +2469,10 @@ main(int argc, char *argv[])
 		color_setting_t manual;
 		::memcpy_dup(&manual, &scheme.day, sizeof(color_setting_t));
 		manual.temperature = temp_set;
-		r = method->set_temperature(&state, &manual);
+		r = method->set_temperature(state, &manual);
 		if (r < 0) {
 			fputs(_("Temperature adjustment failed.\n"), stderr);
-			method->free(&state);
+			method->free(state);
 			exit(EXIT_FAILURE);
 		}
 
@@ -1605,10 +2489,10 @@ main(int argc, char *argv[])
 	{
 		/* Reset screen */
 		color_setting_t reset = { NEUTRAL_TEMP, { 1.0, 1.0, 1.0 }, 1.0 };
-		r = method->set_temperature(&state, &reset);
+		r = method->set_temperature(state, &reset);
 		if (r < 0) {
 			fputs(_("Temperature adjustment failed.\n"), stderr);
-			method->free(&state);
+			method->free(state);
 			exit(EXIT_FAILURE);
 		}
 
@@ -1621,18 +2505,60 @@ main(int argc, char *argv[])
 		}
 	}
 	break;
+	case PROGRAM_MODE_BENCHMARK:
+	{
+		/* Measure with the night setting, which is the
+		   furthest from neutral in common use. */
+		r = run_benchmark(method, state, &scheme.night,
+				  benchmark_count);
+		if (r < 0) {
+			method->free(state);
+			exit(EXIT_FAILURE);
+		}
+	}
+	break;
 	case PROGRAM_MODE_CONTINUAL:
 	{
-		r = run_continual_mode(&loc, &scheme,
-				       method, &state,
-				       transition, verbose);
+		/* Open control socket if configured */
+		control_state_t control_state;
+		control_state_t *ctl = NULL;
+		if (control_path != NULL) {
+			control_init(&control_state);
+			r = control_start(&control_state, control_path);
+			if (r < 0) {
+				fprintf(stderr, _("Unable to open control"
+						  " socket `%s'.\n"),
+					control_path);
+				method->free(state);
+				exit(EXIT_FAILURE);
+			}
+			ctl = &control_state;
+		}
+
+		systemtime_watch_t watch;
+		systemtime_watch_init(&watch);
+
+		r = run_continual_mode(&loc, refreshing, &scheme,
+				       method, state, ctl, &watch,
+				       frame_budget, metrics_path,
+				       transition, exit_after_apply, verbose);
+		systemtime_watch_free(&watch);
+		if (ctl != NULL) control_free(ctl);
 		if (r < 0) exit(EXIT_FAILURE);
 	}
 	break;
 	}
 
 	/* Clean up gamma adjustment state */
-	method->free(&state);
+	method->free(state);
+	free(method_probe);
+	free(control_path);
+	free(metrics_path);
+
+	if (refreshing != NULL) location_refresh_free(refreshing);
 
-	return EXIT_SUCCESS;
+	/* A location search still running in the background reads the
+	   configuration, which lives in this frame. Exit without
+	   returning so it stays valid until the process ends. */
+	exit(EXIT_SUCCESS);
 }
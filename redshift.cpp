@@ -31,10 +31,89 @@
 #endif
 
 #include "redshift/gamma.h"
+#include "colorramp.h"
 
 #include <stdlib.h>
 
 
+int redshift_fill_ramps(const redshift_ramps_t * ramps, const color_setting_t * color)
+{
+
+   static const int bits[] = { 8, 10, 12, 16, 0 };
+   static const size_t sizes[] = { 1, 2, 2, 2, sizeof(float) };
+
+   if (ramps == nullptr || color == nullptr || ramps->size <= 0 ||
+      ramps->format < REDSHIFT_RAMP_U8 || ramps->format > REDSHIFT_RAMP_FLOAT)
+   {
+
+      return -1;
+
+   }
+
+   ptrdiff_t stride = ramps->stride != 0 ? ramps->stride : (ptrdiff_t)sizes[ramps->format];
+
+   if (ramps->format == REDSHIFT_RAMP_U16 && stride == sizeof(uint16_t))
+   {
+
+      /* Packed 16-bit ramps use the kernels of the adjustment methods */
+      uint16_t * gamma[3] = { (uint16_t *)ramps->red, (uint16_t *)ramps->green, (uint16_t *)ramps->blue };
+
+      for (int c = 0; c < 3; c++)
+      {
+
+         for (int i = 0; i < ramps->size; i++)
+         {
+
+            gamma[c][i] = (uint16_t)((double)i / ramps->size * (UINT16_MAX + 1));
+
+         }
+
+      }
+
+      colorramp_fill(gamma[0], gamma[1], gamma[2], ramps->size, color);
+
+      return 0;
+
+   }
+
+   colorramp_fill_strided(ramps->red, ramps->green, ramps->blue, ramps->size, stride, bits[ramps->format], color);
+
+   return 0;
+
+}
+
+
+int redshift_export_lut(const redshift_lut_t * lut, const color_setting_t * color, float * matrix)
+{
+
+   if (lut == nullptr || color == nullptr || lut->data == nullptr || lut->size <= 0)
+   {
+
+      return -1;
+
+   }
+
+   int format;
+
+   switch (lut->format)
+   {
+   case REDSHIFT_LUT_RGBA16F:
+      format = COLORRAMP_LUT_RGBA16F;
+      break;
+   case REDSHIFT_LUT_RGB10A2:
+      format = COLORRAMP_LUT_RGB10A2;
+      break;
+   default:
+      return -1;
+   }
+
+   colorramp_fill_lut(lut->data, lut->size, format, color, matrix);
+
+   return 0;
+
+}
+
+
 redshift_state_t * redshift_alloc()
 {
 
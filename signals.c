@@ -28,12 +28,16 @@
 #endif
 
 #include "signals.h"
+#include "trace.h"
 
 
 #if defined(HAVE_SIGNAL_H) && !defined(__WIN32__)
 
 volatile sig_atomic_t exiting = 0;
 volatile sig_atomic_t disable = 0;
+#ifdef ENABLE_TRACE
+volatile sig_atomic_t dump_trace = 0;
+#endif
 
 
 /* Signal handler for exit signals */
@@ -50,6 +54,15 @@ sigdisable(int signo)
 	disable = 1;
 }
 
+#ifdef ENABLE_TRACE
+/* Signal handler for trace dump signal */
+static void
+sigdumptrace(int signo)
+{
+	dump_trace = 1;
+}
+#endif
+
 #endif /* ! HAVE_SIGNAL_H || __WIN32__ */
 
 
@@ -90,6 +103,19 @@ signals_install_handlers(void)
 		return -1;
 	}
 
+#ifdef ENABLE_TRACE
+	/* Install signal handler for USR2 signal */
+	sigact.sa_handler = sigdumptrace;
+	sigact.sa_mask = sigset;
+	sigact.sa_flags = 0;
+
+	r = sigaction(SIGUSR2, &sigact, NULL);
+	if (r < 0) {
+		fprintf(stderr, "sigaction");
+		return -1;
+	}
+#endif
+
 	/* Ignore CHLD signal. This causes child processes
 	   (hooks) to be reaped automatically. */
 	sigact.sa_handler = SIG_IGN;
@@ -25,10 +25,16 @@
 
 extern volatile sig_atomic_t exiting;
 extern volatile sig_atomic_t disable;
+# ifdef ENABLE_TRACE
+extern volatile sig_atomic_t dump_trace;
+# else
+#  define dump_trace  0
+# endif
 
 #else /* ! HAVE_SIGNAL_H || __WIN32__ */
 #  define exiting  0
 #  define disable  0
+#  define dump_trace  0
 #endif /* ! HAVE_SIGNAL_H || __WIN32__ */
 
 
@@ -18,6 +18,9 @@
 */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
 #include <unistd.h>
 
 #ifndef _WIN32
@@ -31,8 +34,17 @@
 # include <windows.h>
 #endif
 
+#ifdef __linux__
+# include <poll.h>
+# include <sys/timerfd.h>
+#endif
+
 #include "systemtime.h"
 
+/* Change of a clock offset (seconds) treated as a jump rather
+   than as drift correction. */
+#define SYSTEMTIME_JUMP_THRESHOLD  1.0
+
 
 /* Return current time in T as the number of seconds since the epoch. */
 int
@@ -70,6 +82,33 @@ systemtime_get_time(double *t)
 	return 0;
 }
 
+/* Return a monotonic timestamp in T, in seconds from an unspecified
+   starting point. Used to measure intervals that must not be affected
+   by changes to the system clock. */
+int
+systemtime_get_monotonic(double *t)
+{
+#if defined(_WIN32) /* Windows */
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	*t = (double)count.QuadPart / freq.QuadPart;
+#elif _POSIX_TIMERS > 0 /* POSIX timers */
+	struct timespec now;
+	int r = clock_gettime(CLOCK_MONOTONIC, &now);
+	if (r < 0) {
+		fprintf(stderr, "clock_gettime");
+		return -1;
+	}
+
+	*t = now.tv_sec + (now.tv_nsec / 1000000000.0);
+#else /* other platforms */
+	return systemtime_get_time(t);
+#endif
+
+	return 0;
+}
+
 /* millis_sleep for a number of milliseconds. */
 void
 systemtime_msleep(unsigned int msecs)
@@ -83,3 +122,123 @@ systemtime_msleep(unsigned int msecs)
 	millis_sleep(msecs);
 #endif
 }
+
+/* Read the offsets of the boot and wall clocks to the monotonic
+   clock. The monotonic clock stops during suspend, while the boot
+   clock does not, and the wall clock may be set at any time. */
+static void
+watch_offsets(double *boot_offset, double *real_offset)
+{
+	double mono, real;
+	systemtime_get_monotonic(&mono);
+	systemtime_get_time(&real);
+	*real_offset = real - mono;
+
+	*boot_offset = 0.0;
+#ifdef __linux__
+	struct timespec boot;
+	if (clock_gettime(CLOCK_BOOTTIME, &boot) == 0) {
+		*boot_offset = boot.tv_sec + (boot.tv_nsec / 1000000000.0) -
+			mono;
+	}
+#endif
+}
+
+void
+systemtime_watch_init(systemtime_watch_t *watch)
+{
+	watch->fd = -1;
+#ifdef __linux__
+	watch->fd = timerfd_create(CLOCK_REALTIME,
+				   TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+	watch_offsets(&watch->boot_offset, &watch->real_offset);
+}
+
+void
+systemtime_watch_free(systemtime_watch_t *watch)
+{
+	if (watch->fd >= 0) {
+		close(watch->fd);
+		watch->fd = -1;
+	}
+}
+
+/* Arm the watch to fire after MSECS milliseconds of wall clock time,
+   or as soon as the clock is set. Since the wall clock keeps running
+   during suspend it also fires right after resume. Returns a file
+   descriptor to poll, or -1 if clock changes cannot be watched. */
+int
+systemtime_watch_arm(systemtime_watch_t *watch, unsigned int msecs)
+{
+#ifdef __linux__
+	if (watch->fd < 0) return -1;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	struct itimerspec timer = { { 0, 0 }, now };
+	timer.it_value.tv_sec += msecs / 1000;
+	timer.it_value.tv_nsec += (msecs % 1000)*1000000;
+	if (timer.it_value.tv_nsec >= 1000000000) {
+		timer.it_value.tv_sec += 1;
+		timer.it_value.tv_nsec -= 1000000000;
+	}
+
+	int r = timerfd_settime(watch->fd,
+				TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+				&timer, NULL);
+	if (r < 0) return -1;
+
+	return watch->fd;
+#else
+	return -1;
+#endif
+}
+
+/* Sleep for MSECS milliseconds, waking up early if the clock is set
+   or the system resumes from suspend. */
+void
+systemtime_watch_sleep(systemtime_watch_t *watch, unsigned int msecs)
+{
+#ifdef __linux__
+	int fd = systemtime_watch_arm(watch, msecs);
+	if (fd >= 0) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		poll(&pfd, 1, msecs);
+		return;
+	}
+#endif
+	systemtime_msleep(msecs);
+}
+
+/* Return 1 if the clock was set or the system resumed from suspend
+   since the last call, otherwise 0. */
+int
+systemtime_watch_changed(systemtime_watch_t *watch)
+{
+	int changed = 0;
+
+#ifdef __linux__
+	if (watch->fd >= 0) {
+		uint64_t expirations;
+		ssize_t r = read(watch->fd, &expirations,
+				 sizeof(expirations));
+		if (r < 0 && errno == ECANCELED) changed = 1;
+	}
+#endif
+
+	double boot_offset, real_offset;
+	watch_offsets(&boot_offset, &real_offset);
+	if (fabs(boot_offset - watch->boot_offset) >
+	    SYSTEMTIME_JUMP_THRESHOLD ||
+	    fabs(real_offset - watch->real_offset) >
+	    SYSTEMTIME_JUMP_THRESHOLD) {
+		changed = 1;
+	}
+
+	watch->boot_offset = boot_offset;
+	watch->real_offset = real_offset;
+
+	return changed;
+}
@@ -21,7 +21,25 @@
 #define REDSHIFT_SYSTEMTIME_H
 
 
+/* Watch for changes of the system clock and for resume from
+   suspend, which both invalidate a schedule based on sleeping. */
+typedef struct {
+	/* Timer cancelled on clock changes, or -1 if unsupported */
+	int fd;
+	/* Offsets of the boot and wall clocks to the monotonic clock */
+	double boot_offset;
+	double real_offset;
+} systemtime_watch_t;
+
+
 int systemtime_get_time(double *now);
+int systemtime_get_monotonic(double *now);
 void systemtime_msleep(unsigned int msecs);
 
+void systemtime_watch_init(systemtime_watch_t *watch);
+void systemtime_watch_free(systemtime_watch_t *watch);
+int systemtime_watch_arm(systemtime_watch_t *watch, unsigned int msecs);
+void systemtime_watch_sleep(systemtime_watch_t *watch, unsigned int msecs);
+int systemtime_watch_changed(systemtime_watch_t *watch);
+
 #endif /* ! REDSHIFT_SYSTEMTIME_H */
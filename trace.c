@@ -0,0 +1,266 @@
+/* trace.c -- Tracing of hot path spans source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef ENABLE_NLS
+# include <libintl.h>
+# define _(s) gettext(s)
+#else
+# define _(s) s
+#endif
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_TRACE_PATH  4096
+
+typedef struct {
+	const char *category;
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+} trace_event_t;
+
+/* Spans of one thread. Only the owning thread writes to the ring, so
+   recording takes no lock; a reader copies the ring and drops the
+   spans that may have been overwritten meanwhile. */
+typedef struct {
+	/* Number of spans recorded so far */
+	uint64_t head;
+	int tid;
+	trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+/* Rings are never freed, as threads that were abandoned during
+   startup may still record spans when the trace is dumped. */
+static trace_ring_t *rings[TRACE_MAX_THREADS];
+static int ring_count = 0;
+
+static __thread trace_ring_t *thread_ring = NULL;
+static __thread int thread_untraced = 0;
+
+
+/* Monotonic time in nanoseconds */
+static uint64_t
+trace_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Return the ring of the calling thread, registering it on first
+   use. Returns NULL if there is no room for another thread. */
+static trace_ring_t *
+trace_ring(void)
+{
+	if (thread_ring != NULL || thread_untraced) return thread_ring;
+
+	int index = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+	if (index >= TRACE_MAX_THREADS) {
+		thread_untraced = 1;
+		return NULL;
+	}
+
+	trace_ring_t *ring = (trace_ring_t *)calloc(1, sizeof(trace_ring_t));
+	if (ring == NULL) {
+		thread_untraced = 1;
+		return NULL;
+	}
+	ring->tid = index + 1;
+
+	__atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+	thread_ring = ring;
+
+	return ring;
+}
+
+trace_span_t
+trace_begin(const char *category, const char *name)
+{
+	trace_span_t span = { category, name, trace_now() };
+	return span;
+}
+
+void
+trace_end(const trace_span_t *span)
+{
+	uint64_t end = trace_now();
+
+	trace_ring_t *ring = trace_ring();
+	if (ring == NULL) return;
+
+	uint64_t head = ring->head;
+	trace_event_t *event = &ring->events[head % TRACE_RING_SIZE];
+	event->category = span->category != NULL ?
+		span->category : "redshift";
+	event->name = span->name;
+	event->start = span->start;
+	event->duration = end - span->start;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy the spans of RING into EVENTS. Returns the number of spans
+   that were not overwritten while copying. */
+static int
+trace_copy(trace_ring_t *ring, trace_event_t *events)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+	for (uint64_t i = first; i < head; i++) {
+		events[i - first] = ring->events[i % TRACE_RING_SIZE];
+	}
+
+	/* The span being recorded now replaces the oldest one, so
+	   every span up to that one may be torn. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64_t valid = now >= TRACE_RING_SIZE ?
+		now - TRACE_RING_SIZE + 1 : 0;
+	if (valid <= first) return head - first;
+	if (valid >= head) return 0;
+
+	int skip = valid - first;
+	for (uint64_t i = valid; i < head; i++) {
+		events[i - valid] = events[i - valid + skip];
+	}
+
+	return head - valid;
+}
+
+static int
+trace_write(FILE *f, trace_event_t *events)
+{
+	int pid = getpid();
+	int count = 0;
+
+	fputs("{\"traceEvents\":[\n", f);
+
+	for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+		trace_ring_t *ring = __atomic_load_n(&rings[i],
+						     __ATOMIC_ACQUIRE);
+		if (ring == NULL) continue;
+
+		int n = trace_copy(ring, events);
+		for (int j = 0; j < n; j++) {
+			fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\","
+				"\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f}",
+				count > 0 ? ",\n" : "",
+				events[j].name, events[j].category,
+				pid, ring->tid, events[j].start / 1000.0,
+				events[j].duration / 1000.0);
+			count += 1;
+		}
+	}
+
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+
+	return count;
+}
+
+/* Write the recorded spans as Chrome trace JSON to PATH, or if NULL
+   to redshift-trace-PID.json in the runtime directory. The file can
+   be loaded in chrome://tracing or Perfetto. */
+int
+trace_dump(const char *path)
+{
+	char default_path[MAX_TRACE_PATH];
+	char tmp_path[MAX_TRACE_PATH + 8];
+
+	if (path == NULL) {
+		const char *dir = getenv("XDG_RUNTIME_DIR");
+		if (dir == NULL || dir[0] == '\0') dir = "/tmp";
+		snprintf(default_path, sizeof(default_path),
+			 "%s/redshift-trace-%d.json", dir, (int)getpid());
+		path = default_path;
+	}
+
+	trace_event_t *events = (trace_event_t *)
+		malloc(TRACE_RING_SIZE * sizeof(trace_event_t));
+	if (events == NULL) {
+		fprintf(stderr, "malloc");
+		return -1;
+	}
+
+	/* The runtime directory may be missing and /tmp used instead,
+	   so the temporary file must not have a predictable name. */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	FILE *f = NULL;
+	int fd = mkstemp(tmp_path);
+	if (fd >= 0 && (f = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		remove(tmp_path);
+	}
+	if (f == NULL) {
+		fprintf(stderr, _("Unable to write trace to `%s'.\n"), path);
+		free(events);
+		return -1;
+	}
+
+	int count = trace_write(f, events);
+	free(events);
+
+	if (fclose(f) != 0 || rename(tmp_path, path) < 0) {
+		remove(tmp_path);
+		fprintf(stderr, _("Unable to write trace to `%s'.\n"), path);
+		return -1;
+	}
+
+	fprintf(stderr, _("Wrote %d spans to `%s'.\n"), count, path);
+
+	return 0;
+}
+
+#else /* ! ENABLE_TRACE */
+
+trace_span_t
+trace_begin(const char *category, const char *name)
+{
+	trace_span_t span = { category, name, 0 };
+	return span;
+}
+
+void
+trace_end(const trace_span_t *span)
+{
+	(void)span;
+}
+
+int
+trace_dump(const char *path)
+{
+	(void)path;
+	fputs(_("Tracing is not enabled in this build.\n"), stderr);
+	return -1;
+}
+
+#endif /* ! ENABLE_TRACE */
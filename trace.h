@@ -0,0 +1,66 @@
+/* trace.h -- Tracing of hot path spans header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_TRACE_H
+#define REDSHIFT_TRACE_H
+
+#include <stdint.h>
+
+/* Tracing needs thread local storage and a monotonic clock. */
+#if defined(ENABLE_TRACE) && defined(_WIN32)
+# undef ENABLE_TRACE
+#endif
+
+/* Spans recorded per thread. Older spans are overwritten. */
+#define TRACE_RING_SIZE    4096
+/* Threads that can record spans */
+#define TRACE_MAX_THREADS  16
+
+typedef struct {
+	const char *category;
+	const char *name;
+	uint64_t start;
+} trace_span_t;
+
+#ifdef ENABLE_TRACE
+
+/* Record the time from TRACE_BEGIN to TRACE_END as span NAME.
+   Names and categories must be string literals, or otherwise outlive
+   the program, since only the pointers are recorded. Without
+   ENABLE_TRACE both compile to nothing. */
+# define TRACE_BEGIN(span, name) \
+	trace_span_t span = trace_begin(NULL, name)
+# define TRACE_BEGIN_CAT(span, category, name) \
+	trace_span_t span = trace_begin(category, name)
+# define TRACE_END(span)  trace_end(&(span))
+
+#else /* ! ENABLE_TRACE */
+
+# define TRACE_BEGIN(span, name)  do { } while (0)
+# define TRACE_BEGIN_CAT(span, category, name)  do { } while (0)
+# define TRACE_END(span)  do { } while (0)
+
+#endif /* ! ENABLE_TRACE */
+
+
+trace_span_t trace_begin(const char *category, const char *name);
+void trace_end(const trace_span_t *span);
+
+int trace_dump(const char *path);
+
+
+#endif /* ! REDSHIFT_TRACE_H */
@@ -0,0 +1,394 @@
+/* transition.c -- Short transition engine source
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "transition.h"
+#include "colorramp.h"
+
+
+void
+transition_init(transition_t *trans, unsigned int frame_budget)
+{
+	trans->active = 0;
+	trans->from = 0.0;
+	trans->to = 0.0;
+	trans->start = 0.0;
+	trans->duration = 0.0;
+	trans->progress = 0.0;
+
+	trans->frame_budget = frame_budget / 1000.0;
+	trans->frame_start = 0.0;
+	trans->deadline = 0.0;
+	trans->have_sequence = 0;
+	trans->sequence = 0;
+
+	trans->frames = 0;
+	trans->dropped = 0;
+	trans->over_budget = 0;
+}
+
+/* Start a transition from alpha FROM to alpha TO at time NOW. DURATION
+   is the time in seconds for a full transition between 0 and 1, so
+   transitions that start half-way finish in half the time. */
+void
+transition_start(transition_t *trans, double from, double to,
+		 double duration, double now)
+{
+	trans->active = 1;
+	trans->from = from;
+	trans->to = to;
+	trans->start = now;
+	trans->duration = fabs(to - from) * duration;
+	trans->progress = 0.0;
+
+	trans->frame_start = now;
+	trans->deadline = now;
+	trans->have_sequence = 0;
+
+	trans->frames = 0;
+	trans->dropped = 0;
+	trans->over_budget = 0;
+}
+
+/* Alpha value of the transition at PROGRESS between zero and one. */
+static double
+transition_alpha(const transition_t *trans, double progress)
+{
+	/* Ease in and out so the first and last steps,
+	   which are the most noticeable, are the smallest. */
+	double eased = progress*progress*(3.0 - 2.0*progress);
+
+	return trans->from + (trans->to - trans->from)*eased;
+}
+
+/* Return the alpha value of the transition at time NOW. The
+   transition becomes inactive once the final value is reached. */
+double
+transition_step(transition_t *trans, double now)
+{
+	trans->frame_start = now;
+
+	double progress = 1.0;
+	if (trans->duration > 0.0) {
+		progress = (now - trans->start) / trans->duration;
+	}
+
+	if (progress >= 1.0) {
+		trans->active = 0;
+		trans->progress = 1.0;
+		return trans->to;
+	} else if (progress < 0.0) {
+		progress = 0.0;
+	}
+
+	trans->progress = progress;
+
+	return transition_alpha(trans, progress);
+}
+
+/* Record that the ramps for the current frame have been
+   computed and uploaded at time NOW. */
+void
+transition_frame_done(transition_t *trans, double now)
+{
+	trans->frames += 1;
+	if (now - trans->frame_start > trans->frame_budget) {
+		trans->over_budget += 1;
+	}
+}
+
+/* Pace the next frame. If the adjustment method can wait for the
+   vertical blank this blocks until it arrives and returns zero.
+   Otherwise the frames are paced by the frame budget and the
+   number of milliseconds the caller should sleep is returned. */
+unsigned int
+transition_wait_frame(transition_t *trans, const gamma_method_t *method,
+		      void *state, double now)
+{
+	if (method->wait_vblank != NULL) {
+		unsigned int sequence;
+		int r = method->wait_vblank(state, &sequence);
+		if (r == 0) {
+			if (trans->have_sequence &&
+			    sequence - trans->sequence > 1) {
+				trans->dropped +=
+					sequence - trans->sequence - 1;
+			}
+			trans->sequence = sequence;
+			trans->have_sequence = 1;
+			return 0;
+		}
+	}
+
+	trans->deadline += trans->frame_budget;
+	if (now > trans->deadline) {
+		/* Skip the frames we were too late for */
+		unsigned int missed = (unsigned int)
+			((now - trans->deadline) / trans->frame_budget);
+		trans->dropped += missed;
+		trans->deadline += (missed + 1) * trans->frame_budget;
+	}
+
+	return (unsigned int)ceil((trans->deadline - now) * 1000.0);
+}
+
+/* Convert the white point of TEMPERATURE at BRIGHTNESS to CIE Lab
+   relative to D65. The white point and brightness scale the encoded
+   signal, so they are linearized with an approximate 2.2 gamma. */
+static void
+temperature_to_lab(int temperature, double brightness, double *lab)
+{
+	float white_point[3];
+	colorramp_white_point(temperature, white_point);
+
+	double rgb[3];
+	for (int i = 0; i < 3; i++) {
+		rgb[i] = pow(white_point[i]*brightness, 2.2);
+	}
+
+	/* Linear sRGB to XYZ, normalized to the D65 white */
+	double xyz[3];
+	xyz[0] = (0.4124*rgb[0] + 0.3576*rgb[1] + 0.1805*rgb[2]) / 0.95047;
+	xyz[1] = (0.2126*rgb[0] + 0.7152*rgb[1] + 0.0722*rgb[2]);
+	xyz[2] = (0.0193*rgb[0] + 0.1192*rgb[1] + 0.9505*rgb[2]) / 1.08883;
+
+	double f[3];
+	for (int i = 0; i < 3; i++) {
+		if (xyz[i] > 216.0/24389.0) {
+			f[i] = cbrt(xyz[i]);
+		} else {
+			f[i] = (24389.0/27.0*xyz[i] + 16.0) / 116.0;
+		}
+	}
+
+	lab[0] = 116.0*f[1] - 16.0;
+	lab[1] = 500.0*(f[0] - f[1]);
+	lab[2] = 200.0*(f[1] - f[2]);
+}
+
+static double
+lab_distance(const double *a, const double *b)
+{
+	double dl = a[0] - b[0];
+	double da = a[1] - b[1];
+	double db = a[2] - b[2];
+	return sqrt(dl*dl + da*da + db*db);
+}
+
+/* Parse interpolation mode name. */
+int
+transition_parse_interpolation(const char *str, interpolation_t *mode)
+{
+	if (strcasecmp(str, "linear") == 0) {
+		*mode = INTERPOLATION_LINEAR;
+	} else if (strcasecmp(str, "mired") == 0) {
+		*mode = INTERPOLATION_MIRED;
+	} else if (strcasecmp(str, "lab") == 0) {
+		*mode = INTERPOLATION_LAB;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Interpolate between two color temperatures. ALPHA is the weight of
+   TO. Mired (reciprocal megakelvin) is close to perceptually uniform
+   and cheap. Lab interpolates the white points and returns the
+   temperature on the blackbody locus closest to the result. */
+int
+transition_mix_temperature(int from, int to, double alpha,
+			   interpolation_t mode)
+{
+	switch (mode) {
+	case INTERPOLATION_LINEAR:
+		break;
+	case INTERPOLATION_MIRED:
+	{
+		double mired = (1.0 - alpha)*(1000000.0/from) +
+			alpha*(1000000.0/to);
+		return (int)lround(1000000.0/mired);
+	}
+	case INTERPOLATION_LAB:
+	{
+		double lab_from[3], lab_to[3], target[3];
+		temperature_to_lab(from, 1.0, lab_from);
+		temperature_to_lab(to, 1.0, lab_to);
+		for (int i = 0; i < 3; i++) {
+			target[i] = (1.0 - alpha)*lab_from[i] +
+				alpha*lab_to[i];
+		}
+
+		/* The distance to the target is unimodal along the
+		   locus between the end points. */
+		int lo = from < to ? from : to;
+		int hi = from < to ? to : from;
+		while (hi - lo > 2) {
+			int m1 = lo + (hi - lo)/3;
+			int m2 = hi - (hi - lo)/3;
+			double lab1[3], lab2[3];
+			temperature_to_lab(m1, 1.0, lab1);
+			temperature_to_lab(m2, 1.0, lab2);
+			if (lab_distance(lab1, target) <
+			    lab_distance(lab2, target)) {
+				hi = m2;
+			} else {
+				lo = m1;
+			}
+		}
+		return (lo + hi)/2;
+	}
+	}
+
+	return (int)lround((1.0 - alpha)*from + alpha*to);
+}
+
+/* Perceptual difference between the effect of two color settings.
+   Returns infinity if either is unset or the gamma differs, since
+   those changes must always be applied. */
+double
+transition_delta_e(const color_setting_t *a, const color_setting_t *b)
+{
+	if (a->temperature < 0 || b->temperature < 0) return INFINITY;
+
+	for (int i = 0; i < 3; i++) {
+		if (fabs(a->gamma[i] - b->gamma[i]) > 0.0005) {
+			return INFINITY;
+		}
+	}
+
+	double lab_a[3], lab_b[3];
+	temperature_to_lab(a->temperature, a->brightness, lab_a);
+	temperature_to_lab(b->temperature, b->brightness, lab_b);
+
+	return lab_distance(lab_a, lab_b);
+}
+
+/* Mix BASE with the neutral color temperature NEUTRAL. ALPHA is the
+   weight of the neutral setting. */
+void
+transition_mix_setting(const color_setting_t *base, int neutral,
+		       double alpha, interpolation_t mode,
+		       color_setting_t *result)
+{
+	*result = *base;
+	result->temperature = transition_mix_temperature(
+		base->temperature, neutral, alpha, mode);
+	result->brightness = alpha*1.0 + (1.0-alpha)*base->brightness;
+}
+
+void
+transition_plan_init(transition_plan_t *plan)
+{
+	plan->pool = NULL;
+	plan->pool_size = 0;
+	plan->frame_size = 0;
+	plan->count = 0;
+	plan->valid = 0;
+}
+
+void
+transition_plan_free(transition_plan_t *plan)
+{
+	free(plan->pool);
+	transition_plan_init(plan);
+}
+
+/* Compute the frames of the transition TRANS of BASE towards the
+   NEUTRAL color temperature, one per frame budget. Returns -1 if the
+   method cannot prepare frames or they do not fit in the pool, in
+   which case the plan is left invalid. */
+int
+transition_plan_build(transition_plan_t *plan, const transition_t *trans,
+		      const color_setting_t *base, int neutral,
+		      interpolation_t mode,
+		      const gamma_method_t *method, void *state)
+{
+	plan->valid = 0;
+	if (method->prepare == NULL || method->set_prepared == NULL) {
+		return -1;
+	}
+
+	long frame_size = method->prepare(state, base, NULL);
+	if (frame_size <= 0) return -1;
+
+	/* Keep frames aligned for the ramps that follow the setting */
+	frame_size = (frame_size + 7) & ~7L;
+
+	unsigned int count = 2;
+	if (trans->frame_budget > 0.0) {
+		count = (unsigned int)
+			ceil(trans->duration / trans->frame_budget) + 1;
+		if (count < 2) count = 2;
+	}
+
+	/* Fewer frames than steps would make the transition
+	   visibly coarser, so rather compute it step by step. */
+	if ((size_t)frame_size > TRANSITION_POOL_SIZE / count) return -1;
+
+	size_t size = count*(size_t)frame_size;
+	if (size > plan->pool_size) {
+		void *pool = realloc(plan->pool, size);
+		if (pool == NULL) return -1;
+		plan->pool = pool;
+		plan->pool_size = size;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		double alpha = transition_alpha(trans, (double)i/(count-1));
+
+		color_setting_t setting;
+		transition_mix_setting(base, neutral, alpha, mode, &setting);
+
+		void *frame = (char *)plan->pool + i*(size_t)frame_size;
+		long r = method->prepare(state, &setting, frame);
+		if (r < 0) return -1;
+	}
+
+	plan->frame_size = frame_size;
+	plan->count = count;
+	plan->base = *base;
+	plan->valid = 1;
+
+	return 0;
+}
+
+/* Return the precomputed frame for the current step of TRANS, or
+   NULL if there is none for BASE. A frame starts with the setting
+   it was computed for. */
+const void *
+transition_plan_frame(const transition_plan_t *plan,
+		      const transition_t *trans,
+		      const color_setting_t *base)
+{
+	if (!plan->valid ||
+	    base->temperature != plan->base.temperature ||
+	    base->brightness != plan->base.brightness ||
+	    memcmp(base->gamma, plan->base.gamma, sizeof(base->gamma)) != 0) {
+		return NULL;
+	}
+
+	unsigned int i = (unsigned int)lround(trans->progress *
+					      (plan->count - 1));
+	if (i >= plan->count) i = plan->count - 1;
+
+	return (const char *)plan->pool + i*plan->frame_size;
+}
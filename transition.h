@@ -0,0 +1,112 @@
+/* transition.h -- Short transition engine header
+   This file is part of Redshift.
+
+   Redshift is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Redshift is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Redshift.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REDSHIFT_TRANSITION_H
+#define REDSHIFT_TRANSITION_H
+
+#include "redshift.h"
+
+/* Default time budget for one frame of a transition (milliseconds). */
+#define TRANSITION_FRAME_BUDGET  16
+
+/* Color space used to interpolate between color temperatures. */
+typedef enum {
+	INTERPOLATION_LINEAR = 0,
+	INTERPOLATION_MIRED,
+	INTERPOLATION_LAB
+} interpolation_t;
+
+/* Default minimum perceptual difference (CIE76 delta E) between
+   consecutive updates. Smaller changes are not sent to the display. */
+#define TRANSITION_MIN_DELTA_E  0.5
+
+/* Upper bound on the memory used for the precomputed frames of one
+   transition (bytes). Longer transitions or larger ramps are
+   computed frame by frame instead. */
+#define TRANSITION_POOL_SIZE  (4*1024*1024)
+
+/* A short transition of the adjustment alpha, driven by time
+   rather than by a fixed step per update. */
+typedef struct {
+	int active;
+	double from;
+	double to;
+	double start;
+	double duration;
+	/* Fraction of the duration elapsed at the last step */
+	double progress;
+
+	/* Frame pacing */
+	double frame_budget;
+	double frame_start;
+	double deadline;
+	int have_sequence;
+	unsigned int sequence;
+
+	/* Statistics */
+	unsigned int frames;
+	unsigned int dropped;
+	unsigned int over_budget;
+} transition_t;
+
+/* The frames of a short transition computed ahead of time by the
+   adjustment method, so each step only has to upload one. The frames
+   are sampled evenly over the progress of the transition. */
+typedef struct {
+	void *pool;
+	size_t pool_size;
+	size_t frame_size;
+	unsigned int count;
+
+	/* Setting the transition was planned for */
+	color_setting_t base;
+	int valid;
+} transition_plan_t;
+
+
+void transition_init(transition_t *trans, unsigned int frame_budget);
+void transition_start(transition_t *trans, double from, double to,
+		      double duration, double now);
+double transition_step(transition_t *trans, double now);
+void transition_frame_done(transition_t *trans, double now);
+unsigned int transition_wait_frame(transition_t *trans,
+				   const gamma_method_t *method,
+				   void *state, double now);
+
+int transition_parse_interpolation(const char *str,
+				   interpolation_t *mode);
+int transition_mix_temperature(int from, int to, double alpha,
+			       interpolation_t mode);
+double transition_delta_e(const color_setting_t *a,
+			  const color_setting_t *b);
+void transition_mix_setting(const color_setting_t *base, int neutral,
+			    double alpha, interpolation_t mode,
+			    color_setting_t *result);
+
+void transition_plan_init(transition_plan_t *plan);
+void transition_plan_free(transition_plan_t *plan);
+int transition_plan_build(transition_plan_t *plan,
+			  const transition_t *trans,
+			  const color_setting_t *base, int neutral,
+			  interpolation_t mode,
+			  const gamma_method_t *method, void *state);
+const void *transition_plan_frame(const transition_plan_t *plan,
+				  const transition_t *trans,
+				  const color_setting_t *base);
+
+
+#endif /* ! REDSHIFT_TRANSITION_H */